@@ -11,7 +11,10 @@
             NoEvent = 0,
             ReadEvent = 1,
             WriteEvent = 2,
-            ReadWriteEvent = ReadEvent + WriteEvent
+            ReadWriteEvent = ReadEvent + WriteEvent,
+            ModemChangeEvent = 4,
+            ErrorEvent = 8,
+            TxEmptyEvent = 16
         }
     }
 }
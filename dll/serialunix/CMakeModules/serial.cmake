@@ -64,6 +64,7 @@ check_symbol_exists(TIOCCBRK "sys/ioctl.h" HAVE_TERMIOS_TIOCCBRK)
 check_symbol_exists(TIOCINQ  "sys/ioctl.h" HAVE_TERMIOS_TIOCINQ)
 check_symbol_exists(FIONREAD "sys/ioctl.h" HAVE_TERMIOS_FIONREAD)
 check_symbol_exists(TIOCOUTQ "sys/ioctl.h" HAVE_TERMIOS_TIOCOUTQ)
+check_symbol_exists(TIOCSERGETLSR "sys/ioctl.h" HAVE_TERMIOS_TIOCSERGETLSR)
 check_symbol_exists(TIOCNXCL "sys/ioctl.h" HAVE_TERMIOS_TIOCNXCL)
 check_symbol_exists(TIOCEXCL "sys/ioctl.h" HAVE_TERMIOS_TIOCEXCL)
 
@@ -71,4 +72,8 @@ check_symbol_exists(TIOCGICOUNT "sys/ioctl.h" HAVE_TERMIOS_TIOCGICOUNT)
 check_symbol_exists(TIOCMIWAIT  "sys/ioctl.h" HAVE_TERMIOS_TIOCMIWAIT)
 set(CMAKE_EXTRA_INCLUDE_FILES "linux/serial.h")
 check_type_size("struct serial_icounter_struct" HAVE_LINUX_SERIAL_ICOUNTER_STRUCT)
+check_type_size("struct serial_struct" HAVE_LINUX_SERIAL_STRUCT)
 set(CMAKE_EXTRA_INCLUDE_FILES)
+
+check_symbol_exists(TIOCGSERIAL "sys/ioctl.h" HAVE_TERMIOS_TIOCGSERIAL)
+check_symbol_exists(TIOCSSERIAL "sys/ioctl.h" HAVE_TERMIOS_TIOCSSERIAL)
@@ -3,4 +3,27 @@
 #
 
 include(CheckSymbolExists)
+include(CheckIncludeFile)
 check_symbol_exists(min "stdlib.h" HAVE_STDLIB_MIN)
+
+check_include_file("sys/epoll.h" HAVE_SYS_EPOLL_H)
+check_include_file("sys/eventfd.h" HAVE_SYS_EVENTFD_H)
+check_include_file("sys/sysmacros.h" HAVE_SYS_SYSMACROS_H)
+
+set(CMAKE_REQUIRED_DEFINITIONS -D_GNU_SOURCE)
+check_symbol_exists(ppoll "poll.h" HAVE_PPOLL)
+set(CMAKE_REQUIRED_DEFINITIONS)
+
+check_include_file("linux/io_uring.h" HAVE_LINUX_IO_URING_H)
+check_symbol_exists(__NR_io_uring_setup "sys/syscall.h" HAVE_SYS_IO_URING_SETUP)
+check_symbol_exists(IORING_FEAT_EXT_ARG "linux/io_uring.h" HAVE_LINUX_IORING_FEAT_EXT_ARG)
+
+include(CheckCSourceCompiles)
+check_c_source_compiles("
+#include <immintrin.h>
+__attribute__((target(\"avx2\"))) static int f(const char *p) {
+  __m256i v = _mm256_loadu_si256((const __m256i *)p);
+  return _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, v));
+}
+int main(void) { char b[32] = {0}; return __builtin_cpu_supports(\"avx2\") ? f(b) : 0; }
+" HAVE_AVX2_TARGET)
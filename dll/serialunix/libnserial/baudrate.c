@@ -211,3 +211,26 @@ void serial_setdefaultbaud(struct serialhandle *handle)
     bauditem++;
   }
 }
+
+// Gets the time to send one character in nanoseconds, from the start bit to
+// the end of the stop bits. Returns 0 if the baud rate is not known.
+long long chartime(struct serialhandle *handle)
+{
+  if (handle->baudrate <= 0) return 0;
+
+  // Counted in half bits, for 1.5 stop bits.
+  long long halfbits = 2 + 2 * handle->databits;
+  if (handle->parity != NOPARITY) halfbits += 2;
+  switch (handle->stopbits) {
+  case ONE5:
+    halfbits += 3;
+    break;
+  case TWO:
+    halfbits += 4;
+    break;
+  default:
+    halfbits += 2;
+    break;
+  }
+  return halfbits * (NSEC_PER_SEC / 2) / handle->baudrate;
+}
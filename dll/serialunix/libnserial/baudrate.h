@@ -25,4 +25,8 @@ extern struct validbaud baudrates[];
 
 void serial_setdefaultbaud(struct serialhandle *handle);
 
+// Gets the time to send one character in nanoseconds, from the start bit to
+// the end of the stop bits. Returns 0 if the baud rate is not known.
+long long chartime(struct serialhandle *handle);
+
 #endif
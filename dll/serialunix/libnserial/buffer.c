@@ -0,0 +1,177 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : buffer.c
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Allocates the buffers of the library.
+//
+// Small buffers are aligned to a cache line, so that they don't share a
+// cache line with other data, and buffers of at least a page are aligned to
+// a page. Buffers of at least a huge page are mapped directly, preferring
+// huge pages, so that reading a large buffer doesn't miss the TLB for every
+// page. If no huge pages are reserved, transparent huge pages are requested.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// For MAP_ANONYMOUS and MADV_HUGEPAGE
+#define _GNU_SOURCE
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define NSERIAL_EXPORTS
+#include "nserial.h"
+#include "serialhandle.h"
+#include "errmsg.h"
+#include "buffer.h"
+#include "log.h"
+#include "readuntil.h"
+
+// The size of a cache line on most current processors.
+#define CACHELINESIZE 64
+
+// The size of a huge page, if the kernel doesn't tell.
+#define HUGEPAGEDEFAULT (2 * 1024 * 1024)
+
+static pthread_once_t hugepageonce = PTHREAD_ONCE_INIT;
+static size_t hugepagesize = 0;
+
+// Reads the size of the huge pages used by MAP_HUGETLB. If it's not known,
+// no huge pages are mapped.
+static void readhugepagesize(void)
+{
+  FILE *meminfo = fopen("/proc/meminfo", "r");
+  if (meminfo == NULL) return;
+
+  char line[128];
+  size_t kb;
+  while (fgets(line, sizeof(line), meminfo)) {
+    if (sscanf(line, "Hugepagesize: %zu kB", &kb) == 1) {
+      hugepagesize = kb * 1024;
+      break;
+    }
+  }
+  fclose(meminfo);
+}
+
+// Buffers at least this size are mapped, preferring huge pages. The length
+// mapped is rounded up to a huge page, which munmap() needs for huge pages.
+static size_t mapsizealign(void)
+{
+  pthread_once(&hugepageonce, readhugepagesize);
+  return hugepagesize ? hugepagesize : HUGEPAGEDEFAULT;
+}
+
+char *bufferalloc(struct serialhandle *handle, size_t size)
+{
+  void *buffer;
+  size_t mapalign = mapsizealign();
+
+  if (size >= mapalign) {
+    size_t mapsize = (size + mapalign - 1) & ~(mapalign - 1);
+#ifdef MAP_HUGETLB
+    if (hugepagesize) {
+      buffer = mmap(NULL, mapsize, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (buffer != MAP_FAILED) return buffer;
+      nslog(handle, NSLOG_INFO,
+            "bufferalloc: no huge pages for %zu bytes: errno=%d", size, errno);
+    }
+#endif
+    buffer = mmap(NULL, mapsize, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+      serial_seterror(handle, ERRMSG_OUTOFMEMORY);
+      errno = ENOMEM;
+      return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(buffer, mapsize, MADV_HUGEPAGE);
+#endif
+    return buffer;
+  }
+
+  size_t pagesize = sysconf(_SC_PAGESIZE);
+  size_t align = size >= pagesize ? pagesize : CACHELINESIZE;
+  if (posix_memalign(&buffer, align, size)) {
+    serial_seterror(handle, ERRMSG_OUTOFMEMORY);
+    errno = ENOMEM;
+    return NULL;
+  }
+  return buffer;
+}
+
+void bufferfree(char *buffer, size_t size)
+{
+  if (buffer == NULL) return;
+
+  size_t mapalign = mapsizealign();
+  if (size >= mapalign) {
+    size_t mapsize = (size + mapalign - 1) & ~(mapalign - 1);
+    munmap(buffer, mapsize);
+    return;
+  }
+  free(buffer);
+}
+
+int tmpbufferalloc(struct serialhandle *handle)
+{
+  if (handle->tmpbuffer) return 0;
+
+  handle->tmpbuffer = bufferalloc(handle, handle->buffersize);
+  if (handle->tmpbuffer == NULL) return -1;
+  handle->tmpstart = 0;
+  handle->tmplength = 0;
+  handle->tmpread = FALSE;
+  return 0;
+}
+
+NSERIAL_EXPORT int WINAPI serial_setbuffersize(struct serialhandle *handle, size_t size)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  if (handle->fd != -1) {
+    serial_seterror(handle, ERRMSG_SERIALPORTALREADYOPEN);
+    errno = EIO;
+    return -1;
+  }
+
+  if (size < SERIALBUFFERMIN || size > SERIALBUFFERMAX) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+
+  // The buffer is allocated again when it's next used.
+  bufferfree(handle->tmpbuffer, handle->buffersize);
+  handle->tmpbuffer = NULL;
+  untilfree(handle);
+  handle->buffersize = size;
+  return 0;
+}
+
+NSERIAL_EXPORT int WINAPI serial_getbuffersize(struct serialhandle *handle, size_t *size)
+{
+  if (handle == NULL || size == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  *size = handle->buffersize;
+  return 0;
+}
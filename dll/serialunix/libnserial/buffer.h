@@ -0,0 +1,37 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : buffer.h
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Internal methods to allocate the buffers of the library.
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifndef NSERIAL_BUFFER_H
+#define NSERIAL_BUFFER_H
+
+#include <sys/types.h>
+
+#include "nserial.h"
+
+// The smallest and largest buffer that can be set with serial_setbuffersize().
+#define SERIALBUFFERMIN 64
+#define SERIALBUFFERMAX (1 << 30)
+
+// Allocates a buffer of size bytes. The buffer is aligned to a cache line, and
+// to a page if it's at least a page. Large buffers are backed by huge pages if
+// possible. Returns NULL and sets the error if out of memory.
+char *bufferalloc(struct serialhandle *handle, size_t size);
+
+// Frees a buffer allocated with bufferalloc() of the same size.
+void bufferfree(char *buffer, size_t size);
+
+// Allocates the temporary buffer for filtering data read, if not yet
+// allocated. Returns -1 if out of memory.
+int tmpbufferalloc(struct serialhandle *handle);
+
+#endif
@@ -0,0 +1,208 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : coalesce.c
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Coalesces small writes, to reduce the number of system calls.
+//
+// Applications that write many small messages need a write() for each. When
+// enabled, writes smaller than the threshold are buffered, until the buffered
+// data reaches the threshold or the delay after the first buffered byte
+// expires. The buffered data is written together with the write that reaches
+// the threshold with a single writev().
+//
+// Without a thread, the delay is only checked when the application calls the
+// library. waitevent() wakes up when the delay expires to write the data, so
+// that an application waiting for events never has to flush.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#define NSERIAL_EXPORTS
+#include "nserial.h"
+#include "serialhandle.h"
+#include "errmsg.h"
+#include "events.h"
+#include "buffer.h"
+#include "coalesce.h"
+#include "timeutil.h"
+
+// The longest vector written together with the buffered data.
+#define COALESCEIOVMAX 16
+
+// Removes length bytes from the start of the buffer.
+static void coalesceconsume(struct serialhandle *handle, size_t length)
+{
+  handle->coalescelength -= length;
+  if (handle->coalescelength) {
+    memmove(handle->coalescebuffer, handle->coalescebuffer + length,
+            handle->coalescelength);
+  }
+}
+
+int coalescepending(struct serialhandle *handle)
+{
+  return handle->coalescelength > 0;
+}
+
+int coalesceuntil(struct serialhandle *handle, struct timespec *remaining)
+{
+  return timeuntil(&(handle->coalescedeadline), remaining);
+}
+
+ssize_t coalesceflush(struct serialhandle *handle)
+{
+  if (!coalescepending(handle)) return 0;
+
+  ssize_t writebytes =
+    writedata(handle, handle->coalescebuffer, handle->coalescelength);
+  if (writebytes == -1) return -1;
+  coalesceconsume(handle, writebytes);
+  return handle->coalescelength;
+}
+
+ssize_t coalescewrite(struct serialhandle *handle, const char *buffer, size_t length)
+{
+  if (!handle->coalescedelay) return writedata(handle, buffer, length);
+  if (length == 0) return 0;
+
+  // Data reaching the threshold is written after the data already buffered,
+  // with a single system call.
+  size_t buffered = handle->coalescelength;
+  if (buffered + length >= handle->coalescethreshold) {
+    struct iovec iov;
+    iov.iov_base = (void *)buffer;
+    iov.iov_len = length;
+    return coalescewritev(handle, &iov, 1);
+  }
+
+  if (handle->coalescebuffer == NULL) {
+    handle->coalescebuffer = bufferalloc(handle, handle->coalescethreshold);
+    if (handle->coalescebuffer == NULL) return -1;
+  }
+
+  if (!buffered) {
+    struct timespec delay;
+    delay.tv_sec = handle->coalescedelay / 1000000;
+    delay.tv_nsec = (long)(handle->coalescedelay % 1000000) * 1000;
+    monotonictime(&(handle->coalescedeadline));
+    addtimespec(&(handle->coalescedeadline), &delay);
+  }
+  memcpy(handle->coalescebuffer + buffered, buffer, length);
+  handle->coalescelength += length;
+
+  // Applications writing continuously still write within the delay.
+  struct timespec remaining;
+  if (coalesceuntil(handle, &remaining) && coalesceflush(handle) == -1) {
+    return -1;
+  }
+  return length;
+}
+
+ssize_t coalescewritev(struct serialhandle *handle, const struct iovec *iov, int iovcnt)
+{
+  size_t buffered = handle->coalescelength;
+  if (!buffered) return writedatav(handle, iov, iovcnt);
+
+  // The vector is written after the buffered data. If the vector is too long,
+  // the buffered data is first written by itself.
+  if (iovcnt >= COALESCEIOVMAX) {
+    ssize_t pending = coalesceflush(handle);
+    if (pending == -1) return -1;
+    if (pending) return 0;
+    return writedatav(handle, iov, iovcnt);
+  }
+
+  struct iovec vec[COALESCEIOVMAX];
+  vec[0].iov_base = handle->coalescebuffer;
+  vec[0].iov_len = buffered;
+  memcpy(vec + 1, iov, iovcnt * sizeof(struct iovec));
+  ssize_t writebytes = writedatav(handle, vec, iovcnt + 1);
+  if (writebytes == -1) return -1;
+  if ((size_t)writebytes < buffered) {
+    coalesceconsume(handle, writebytes);
+    return 0;
+  }
+  handle->coalescelength = 0;
+  return writebytes - buffered;
+}
+
+void coalescediscard(struct serialhandle *handle)
+{
+  handle->coalescelength = 0;
+}
+
+void coalescefree(struct serialhandle *handle)
+{
+  bufferfree(handle->coalescebuffer, handle->coalescethreshold);
+  handle->coalescebuffer = NULL;
+  handle->coalescelength = 0;
+}
+
+NSERIAL_EXPORT int WINAPI serial_setwritecoalesce(struct serialhandle *handle, int delay, size_t threshold)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  if (delay < 0 || (delay > 0 && (threshold < 2 || threshold > SERIALBUFFERMAX))) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+
+  // Data already buffered is written first, so it's never lost.
+  if (coalescepending(handle)) {
+    ssize_t pending = coalesceflush(handle);
+    if (pending == -1) return -1;
+    if (pending) {
+      serial_seterror(handle, ERRMSG_SERIALWRITE);
+      errno = EAGAIN;
+      return -1;
+    }
+  }
+
+  coalescefree(handle);
+  handle->coalescedelay = delay;
+  handle->coalescethreshold = delay ? threshold : 0;
+  return 0;
+}
+
+NSERIAL_EXPORT int WINAPI serial_getwritecoalesce(struct serialhandle *handle, int *delay, size_t *threshold)
+{
+  if (handle == NULL || delay == NULL || threshold == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  *delay = handle->coalescedelay;
+  *threshold = handle->coalescethreshold;
+  return 0;
+}
+
+NSERIAL_EXPORT ssize_t WINAPI serial_flushwrite(struct serialhandle *handle)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  if (checkopen(handle)) return -1;
+  return coalesceflush(handle);
+}
@@ -0,0 +1,49 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : coalesce.h
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Internal methods to coalesce small writes.
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifndef NSERIAL_COALESCE_H
+#define NSERIAL_COALESCE_H
+
+#include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "nserial.h"
+
+// Writes to an open serial port like writedata(). If coalescing is enabled,
+// small writes are buffered and written together. Returns the number of bytes
+// accepted, which is 0 if the data can't be written without blocking.
+ssize_t coalescewrite(struct serialhandle *handle, const char *buffer, size_t length);
+
+// Writes the vector to an open serial port like writedatav(), after the data
+// that is buffered. Returns 0 if the data can't be written without blocking.
+ssize_t coalescewritev(struct serialhandle *handle, const struct iovec *iov, int iovcnt);
+
+// Returns non-zero if there is buffered data that isn't written yet.
+int coalescepending(struct serialhandle *handle);
+
+// Sets remaining to the time until the buffered data must be written. Returns
+// non-zero if the delay has expired.
+int coalesceuntil(struct serialhandle *handle, struct timespec *remaining);
+
+// Writes the buffered data. Returns the number of bytes still buffered, or -1
+// on error.
+ssize_t coalesceflush(struct serialhandle *handle);
+
+// Discards the buffered data.
+void coalescediscard(struct serialhandle *handle);
+
+// Frees the buffer for coalescing writes.
+void coalescefree(struct serialhandle *handle);
+
+#endif
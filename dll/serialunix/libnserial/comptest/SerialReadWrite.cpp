@@ -52,9 +52,8 @@ int SerialReadWrite::DoTransfer(Buffer *sendBuffer)
   serial_reset(m_readhandle);
 
   // Do the transfer. Normally, each serial port would run on it's own thread,
-  // or you would use your own select routine for managing both serial ports
-  // simultaneously. The libnserial implementation doesn't support waiting for
-  // events from multiple serial ports or other FD's.
+  // or you would use serial_eventloop_wait() for managing both serial ports
+  // simultaneously. This test polls each serial port in turn instead.
   writefinished = false;
   readfinished = false;
   while (!(readfinished)) {
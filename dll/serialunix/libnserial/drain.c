@@ -0,0 +1,123 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : drain.c
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Waits until all data written is sent, with a timeout.
+//
+// tcdrain() can't be given a timeout, so instead we sleep for the time the
+// data in the output queue needs at the baud rate, and check the queue again
+// with TIOCOUTQ. When the queue is empty, the driver may still be sending the
+// last character, which is checked with TIOCSERGETLSR if the driver supports
+// it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#define NSERIAL_EXPORTS
+#include "nserial.h"
+#include "serialhandle.h"
+#include "errmsg.h"
+#include "baudrate.h"
+#include "coalesce.h"
+#include "drain.h"
+#include "events.h"
+#include "timeutil.h"
+
+// The shortest time to sleep between checking the output queue, in
+// nanoseconds.
+#define DRAINSLEEPMIN 100000L
+
+int drainpending(struct serialhandle *handle)
+{
+#ifdef HAVE_TERMIOS_TIOCOUTQ
+  int queue;
+  if (ioctl(handle->fd, TIOCOUTQ, &queue) < 0) {
+    serial_seterror(handle, ERRMSG_IOCTL);
+    return -1;
+  }
+  queue += handle->coalescelength;
+
+#ifdef HAVE_TERMIOS_TIOCSERGETLSR
+  // Not all drivers have a line status register, e.g. USB serial adapters
+  // and pseudo terminals. Then the empty queue is all we know.
+  unsigned int lsr;
+  if (queue == 0 && ioctl(handle->fd, TIOCSERGETLSR, &lsr) == 0 &&
+      !(lsr & TIOCSER_TEMT)) {
+    queue = 1;
+  }
+#endif
+  return queue;
+#else
+  serial_seterror(handle, ERRMSG_NOSYS);
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+void draintime(struct serialhandle *handle, int pending, struct timespec *ts)
+{
+  long long ns = (long long)pending * chartime(handle);
+  if (ns < DRAINSLEEPMIN) ns = DRAINSLEEPMIN;
+  ts->tv_sec = ns / NSEC_PER_SEC;
+  ts->tv_nsec = ns % NSEC_PER_SEC;
+}
+
+int drainuntil(struct serialhandle *handle, const struct timespec *deadline)
+{
+  while (TRUE) {
+    if (coalescepending(handle) && coalesceflush(handle) == -1) return -1;
+
+    int pending = drainpending(handle);
+    if (pending <= 0) return pending;
+
+    // Sleep for the time to send the data still queued. Data written by other
+    // threads, or flow control, may need longer, so we check again.
+    struct timespec sleepts;
+    draintime(handle, pending, &sleepts);
+
+    if (deadline) {
+      struct timespec remaining;
+      if (timeuntil(deadline, &remaining)) return pending;
+      if (remaining.tv_sec < sleepts.tv_sec ||
+          (remaining.tv_sec == sleepts.tv_sec &&
+           remaining.tv_nsec < sleepts.tv_nsec)) {
+        sleepts = remaining;
+      }
+    }
+
+    // If interrupted by a signal, the queue is just checked earlier.
+    clock_nanosleep(CLOCK_MONOTONIC, 0, &sleepts, NULL);
+  }
+}
+
+NSERIAL_EXPORT int WINAPI serial_drain(struct serialhandle *handle, int timeout)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  if (checkopen(handle)) return -1;
+
+  if (timeout < 0) return drainuntil(handle, NULL);
+
+  struct timespec deadline;
+  struct timespec ts;
+  monotonictime(&deadline);
+  addtimespec(&deadline, mstotimespec(timeout, &ts));
+  return drainuntil(handle, &deadline);
+}
@@ -0,0 +1,35 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : drain.h
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Internal methods to check if all data written is sent.
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifndef NSERIAL_DRAIN_H
+#define NSERIAL_DRAIN_H
+
+#include <time.h>
+
+#include "nserial.h"
+
+// Gets the number of bytes written that aren't sent yet, including data
+// buffered by coalescing. A byte in the transmitter is counted as one if the
+// driver has a line status register. Returns -1 on error.
+int drainpending(struct serialhandle *handle);
+
+// Gets the time to send pending bytes at the baud rate, which is the time to
+// wait before checking the output queue again.
+void draintime(struct serialhandle *handle, int pending, struct timespec *ts);
+
+// Waits until all data written is sent, or the absolute deadline of
+// CLOCK_MONOTONIC. A NULL deadline waits forever. Returns the number of bytes
+// not yet sent, 0 if all data was sent, or -1 on error.
+int drainuntil(struct serialhandle *handle, const struct timespec *deadline);
+
+#endif
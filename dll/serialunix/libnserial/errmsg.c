@@ -56,9 +56,9 @@ const char *serial_geterrorstring(serialerrmsg_t errmsg)
   case ERRMSG_CANTOPENSERIALPORT:
     return "Can't open serial port";
   case ERRMSG_CANTOPENANONPIPE:
-    return "Can't open internal anonymous pipes";
+    return "Can't open internal abort file descriptor";
   case ERRMSG_CANTCONFIGUREANONPIPE:
-    return "Can't configure internal anonymous pipes";
+    return "Can't configure internal abort file descriptor";
   case ERRMSG_SERIALPORTALREADYOPEN:
     return "Serial port already open";
   case ERRMSG_SERIALPORTNOTOPEN:
@@ -85,8 +85,8 @@ const char *serial_geterrorstring(serialerrmsg_t errmsg)
     return "Unexpected baudrate returned after set";
   case ERRMSG_OUTOFMEMORY:
     return "Out of memory";
-  case ERRMSG_SELECT:
-    return "Select error";
+  case ERRMSG_POLL:
+    return "Poll error";
   case ERRMSG_SERIALREAD:
     return "Read error";
   case ERRMSG_SERIALREADEOF:
@@ -94,7 +94,7 @@ const char *serial_geterrorstring(serialerrmsg_t errmsg)
   case ERRMSG_SERIALWRITE:
     return "Write error";
   case ERRMSG_PIPEWRITE:
-    return "Write error to internal anonymous pipe";
+    return "Write error to internal abort file descriptor";
   case ERRMSG_IOCTL:
     return "ioctl error";
   case ERRMSG_IOCTL_ICOUNTER:
@@ -115,6 +115,16 @@ const char *serial_geterrorstring(serialerrmsg_t errmsg)
     return "Error cancelling posix thread";
   case ERRMSG_SEMINIT:
     return "Error initializing semaphore";
+  case ERRMSG_EPOLL:
+    return "Error registering with epoll";
+  case ERRMSG_EVENTLOOPREGISTERED:
+    return "Serial port already registered with another event loop";
+  case ERRMSG_EVENTLOOPNOTREGISTERED:
+    return "Serial port not registered with this event loop";
+  case ERRMSG_IOQUEUEFULL:
+    return "I/O queue is full";
+  case ERRMSG_RINGNOTALLOCATED:
+    return "Ring not allocated with serial_ring_init";
 
   default:
     return "Unknown error";
@@ -40,7 +40,7 @@ typedef enum serialerrmsg {
   ERRMSG_SERIALREADEOF,
   ERRMSG_SERIALWRITE,
   ERRMSG_PIPEWRITE,
-  ERRMSG_SELECT,
+  ERRMSG_POLL,
   ERRMSG_IOCTL,
   ERRMSG_IOCTL_ICOUNTER,
   ERRMSG_NOSYS,
@@ -50,7 +50,12 @@ typedef enum serialerrmsg {
   ERRMSG_PTHREADCREATE,
   ERRMSG_PTHREADJOIN,
   ERRMSG_PTHREADCANCEL,
-  ERRMSG_SEMINIT
+  ERRMSG_SEMINIT,
+  ERRMSG_EPOLL,
+  ERRMSG_EVENTLOOPREGISTERED,
+  ERRMSG_EVENTLOOPNOTREGISTERED,
+  ERRMSG_IOQUEUEFULL,
+  ERRMSG_RINGNOTALLOCATED
 } serialerrmsg_t;
 
 int serial_seterror(struct serialhandle *handle, serialerrmsg_t error);
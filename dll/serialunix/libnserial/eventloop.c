@@ -0,0 +1,444 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : eventloop.c
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Waits for events on many serial ports at once, so that a
+// single thread can service all serial ports of an application.
+//
+// Each serial handle registers two file descriptors with epoll. The serial
+// port itself, for the read and write events requested, and the read end of
+// the file descriptor used by serial_abortwaitforevent(). If waiting for
+// MODEMCHANGEEVENT, the file descriptor of the thread monitoring the modem
+// signals is registered as well. The epoll user data contains the index of the
+// entry in the loop, and the lowest two bits indicate which of the file
+// descriptors the event is for.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+#define NSERIAL_EXPORTS
+#include "nserial.h"
+#include "serialhandle.h"
+#include "errmsg.h"
+#include "events.h"
+#include "eventloop.h"
+#include "modem.h"
+#include "log.h"
+
+#ifdef HAVE_SYS_EPOLL_H
+// Number of entries to grow the loop by when it is full.
+#define EVENTLOOPGROW 16
+
+// The file descriptors registered for every handle, in the epoll user data.
+#define EVENTLOOPFDS   3
+#define EVENTFD_SERIAL 0
+#define EVENTFD_ABORT  1
+#define EVENTFD_MODEM  2
+#define EVENTFD_MASK   3
+
+struct eventloopentry {
+  struct serialhandle *handle;          // Handle, NULL if the entry is free
+  serialevent_t        event;           // Events registered for the handle
+  int                  serialfd;        // Non-zero if the serial fd is added
+  int                  modemfd;         // Modem monitor fd, -1 if not added
+  int                  waitgen;         // Generation of the wait for result
+  int                  result;          // Index in results if waitgen matches
+};
+
+struct serialeventloop {
+  int                    epfd;          // The epoll file descriptor
+  struct eventloopentry *entries;       // Registered handles
+  int                    nentries;      // Number of allocated entries
+  int                    count;         // Number of registered handles
+  struct epoll_event    *events;        // Buffer for epoll_wait()
+  int                    waitgen;       // Incremented on every wait
+};
+
+static uint32_t getepollevents(serialevent_t event)
+{
+  uint32_t events = 0;
+  if (event & READEVENT) events |= EPOLLIN;
+  if (event & WRITEEVENT) events |= EPOLLOUT;
+  return events;
+}
+
+static int growloop(struct serialeventloop *loop)
+{
+  int nentries = loop->nentries + EVENTLOOPGROW;
+
+  struct eventloopentry *entries;
+  entries = realloc(loop->entries, nentries * sizeof(struct eventloopentry));
+  if (entries == NULL) return -1;
+  memset(entries + loop->nentries, 0,
+         EVENTLOOPGROW * sizeof(struct eventloopentry));
+  loop->entries = entries;
+
+  struct epoll_event *events;
+  events = realloc(loop->events,
+                   nentries * EVENTLOOPFDS * sizeof(struct epoll_event));
+  if (events == NULL) return -1;
+  loop->events = events;
+
+  loop->nentries = nentries;
+  return 0;
+}
+
+static uint64_t getepolldata(int index, int fd)
+{
+  return ((uint64_t)index << 2) | fd;
+}
+
+// Registers, changes or removes the serial file descriptor. Like pollevent(),
+// it's only added if the entry waits for the serial port, else a hangup is
+// reported by epoll_wait() that nobody waits for.
+static int setserialfd(struct serialeventloop *loop, int index,
+                       struct serialhandle *handle, serialevent_t event)
+{
+  struct eventloopentry *entry = &(loop->entries[index]);
+
+  if (!(event & (READWRITEEVENT | ERROREVENT))) {
+    if (entry->serialfd) {
+      epoll_ctl(loop->epfd, EPOLL_CTL_DEL, handle->fd, NULL);
+      entry->serialfd = FALSE;
+    }
+    return 0;
+  }
+
+  struct epoll_event epevent = {0, };
+  epevent.events = getepollevents(event);
+  epevent.data.u64 = getepolldata(index, EVENTFD_SERIAL);
+  if (epoll_ctl(loop->epfd, entry->serialfd ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+                handle->fd, &epevent) == -1) {
+    serial_seterror(handle, ERRMSG_EPOLL);
+    return -1;
+  }
+  entry->serialfd = TRUE;
+  return 0;
+}
+
+// Registers or removes the file descriptor of the modem monitor, depending on
+// if the entry waits for MODEMCHANGEEVENT.
+static int setmodemfd(struct serialeventloop *loop, int index,
+                      struct serialhandle *handle, serialevent_t event)
+{
+  struct eventloopentry *entry = &(loop->entries[index]);
+
+  if (!(event & MODEMCHANGEEVENT)) {
+    if (entry->modemfd != -1) {
+      epoll_ctl(loop->epfd, EPOLL_CTL_DEL, entry->modemfd, NULL);
+      entry->modemfd = -1;
+    }
+    return 0;
+  }
+
+  if (entry->modemfd != -1) return 0;
+
+  int modemfd = modemmonitorfd(handle);
+  if (modemfd == -1) return -1;
+
+  struct epoll_event epevent = {0, };
+  epevent.events = EPOLLIN;
+  epevent.data.u64 = getepolldata(index, EVENTFD_MODEM);
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, modemfd, &epevent) == -1) {
+    serial_seterror(handle, ERRMSG_EPOLL);
+    return -1;
+  }
+  entry->modemfd = modemfd;
+  return 0;
+}
+
+// Adds a result for the handle in entry, merging the event if the handle was
+// already reported in this wait. Returns -1 if there is no space for another
+// result.
+static int addresult(struct serialeventloop *loop, int index,
+                     struct serialeventresult *results, int maxresults,
+                     int *nresults, serialevent_t event)
+{
+  struct eventloopentry *entry = &(loop->entries[index]);
+
+  if (entry->waitgen == loop->waitgen) {
+    results[entry->result].event |= event;
+    return 0;
+  }
+
+  if (*nresults >= maxresults) return -1;
+  entry->waitgen = loop->waitgen;
+  entry->result = *nresults;
+  results[*nresults].handle = entry->handle;
+  results[*nresults].event = event;
+  (*nresults)++;
+  return 0;
+}
+#endif
+
+NSERIAL_EXPORT struct serialeventloop *WINAPI serial_eventloop_init()
+{
+#ifdef HAVE_SYS_EPOLL_H
+  struct serialeventloop *loop;
+
+  loop = malloc(sizeof(struct serialeventloop));
+  if (loop == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  memset(loop, 0, sizeof(struct serialeventloop));
+  loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (loop->epfd == -1) {
+    free(loop);
+    return NULL;
+  }
+  return loop;
+#else
+  errno = ENOSYS;
+  return NULL;
+#endif
+}
+
+NSERIAL_EXPORT void WINAPI serial_eventloop_terminate(struct serialeventloop *loop)
+{
+#ifdef HAVE_SYS_EPOLL_H
+  if (loop == NULL) return;
+
+  for (int i = 0; i < loop->nentries; i++) {
+    if (loop->entries[i].handle) {
+      loop->entries[i].handle->eventloop = NULL;
+      loop->entries[i].handle->eventloopindex = -1;
+    }
+  }
+
+  close(loop->epfd);
+  if (loop->entries) free(loop->entries);
+  if (loop->events) free(loop->events);
+  free(loop);
+#endif
+}
+
+NSERIAL_EXPORT int WINAPI serial_eventloop_add(struct serialeventloop *loop, struct serialhandle *handle, serialevent_t event)
+{
+  if (loop == NULL || handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+#ifdef HAVE_SYS_EPOLL_H
+  serial_seterror(handle, ERRMSG_OK);
+
+  // The transmitter being empty isn't signalled by a file descriptor.
+  if (event & TXEMPTYEVENT) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+
+  int isopen;
+  if (serial_isopen(handle, &isopen)) return -1;
+  if (!isopen) {
+    serial_seterror(handle, ERRMSG_SERIALPORTNOTOPEN);
+    errno = EIO;
+    return -1;
+  }
+
+  if (handle->eventloop != NULL && handle->eventloop != loop) {
+    serial_seterror(handle, ERRMSG_EVENTLOOPREGISTERED);
+    errno = EINVAL;
+    return -1;
+  }
+
+  struct epoll_event epevent = {0, };
+  int index = handle->eventloopindex;
+
+  if (handle->eventloop == loop) {
+    // Already registered, so only the events we wait for change.
+    if (setserialfd(loop, index, handle, event)) return -1;
+    if (setmodemfd(loop, index, handle, event)) return -1;
+    loop->entries[index].event = event;
+    return 0;
+  }
+
+  if (loop->count == loop->nentries) {
+    if (growloop(loop)) {
+      serial_seterror(handle, ERRMSG_OUTOFMEMORY);
+      errno = ENOMEM;
+      return -1;
+    }
+  }
+
+  index = 0;
+  while (loop->entries[index].handle != NULL) index++;
+
+  loop->entries[index].serialfd = FALSE;
+  loop->entries[index].modemfd = -1;
+  if (setserialfd(loop, index, handle, event)) return -1;
+
+  epevent.events = EPOLLIN;
+  epevent.data.u64 = getepolldata(index, EVENTFD_ABORT);
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, handle->abortfd.rfd, &epevent) == -1) {
+    int lerrno = errno;
+    setserialfd(loop, index, handle, NOEVENT);
+    serial_seterror(handle, ERRMSG_EPOLL);
+    errno = lerrno;
+    return -1;
+  }
+
+  if (setmodemfd(loop, index, handle, event)) {
+    int lerrno = errno;
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, handle->abortfd.rfd, NULL);
+    setserialfd(loop, index, handle, NOEVENT);
+    errno = lerrno;
+    return -1;
+  }
+
+  loop->entries[index].handle = handle;
+  loop->entries[index].event = event;
+  loop->entries[index].waitgen = loop->waitgen - 1;
+  loop->count++;
+  handle->eventloop = loop;
+  handle->eventloopindex = index;
+  return 0;
+#else
+  serial_seterror(handle, ERRMSG_NOSYS);
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+NSERIAL_EXPORT int WINAPI serial_eventloop_remove(struct serialeventloop *loop, struct serialhandle *handle)
+{
+  if (loop == NULL || handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+#ifdef HAVE_SYS_EPOLL_H
+  serial_seterror(handle, ERRMSG_OK);
+  if (handle->eventloop != loop) {
+    serial_seterror(handle, ERRMSG_EVENTLOOPNOTREGISTERED);
+    errno = EINVAL;
+    return -1;
+  }
+
+  eventloopremove(handle);
+  return 0;
+#else
+  serial_seterror(handle, ERRMSG_NOSYS);
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+void eventloopremove(struct serialhandle *handle)
+{
+#ifdef HAVE_SYS_EPOLL_H
+  struct serialeventloop *loop = handle->eventloop;
+  if (loop == NULL) return;
+
+  struct eventloopentry *entry = &(loop->entries[handle->eventloopindex]);
+  if (entry->serialfd &&
+      epoll_ctl(loop->epfd, EPOLL_CTL_DEL, handle->fd, NULL) == -1) {
+    nslog(handle, NSLOG_NOTICE,
+          "eventloop: remove serial fd failed: errno=%d", errno);
+  }
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_DEL, handle->abortfd.rfd, NULL) == -1) {
+    nslog(handle, NSLOG_NOTICE,
+          "eventloop: remove abort fd failed: errno=%d", errno);
+  }
+  setmodemfd(loop, handle->eventloopindex, handle, NOEVENT);
+
+  loop->entries[handle->eventloopindex].handle = NULL;
+  loop->count--;
+  handle->eventloop = NULL;
+  handle->eventloopindex = -1;
+#endif
+}
+
+NSERIAL_EXPORT int WINAPI serial_eventloop_wait(struct serialeventloop *loop, struct serialeventresult *results, int maxresults, int timeout)
+{
+  if (loop == NULL || results == NULL || maxresults <= 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+#ifdef HAVE_SYS_EPOLL_H
+  int nresults = 0;
+  loop->waitgen++;
+
+  // Data that is cached by the library and modem signal changes that were
+  // not consumed are not seen by epoll, so we return immediately with the
+  // other events that are already pending.
+  for (int i = 0; i < loop->nentries && nresults < maxresults; i++) {
+    struct eventloopentry *entry = &(loop->entries[i]);
+    if (entry->handle == NULL) continue;
+
+    serialevent_t event = NOEVENT;
+    if ((entry->event & READEVENT) && hasreaddata(entry->handle))
+      event |= READEVENT;
+    if (entry->event & MODEMCHANGEEVENT)
+      event |= modemmonitorpending(entry->handle) & entry->event;
+    if (event != NOEVENT)
+      addresult(loop, i, results, maxresults, &nresults, event);
+  }
+
+  if (loop->count == 0) return nresults;
+
+  int n = epoll_wait(loop->epfd, loop->events, loop->count * EVENTLOOPFDS,
+                     nresults ? 0 : timeout);
+  if (n < 0) {
+    if (errno == EINTR) return nresults;
+    return -1;
+  }
+
+  for (int i = 0; i < n; i++) {
+    int index = (int)(loop->events[i].data.u64 >> 2);
+    int fd = (int)(loop->events[i].data.u64 & EVENTFD_MASK);
+    struct eventloopentry *entry = &(loop->entries[index]);
+    if (entry->handle == NULL) continue;
+
+    if (fd == EVENTFD_ABORT) {
+      // The abort is only cleared when it can be reported, else the user
+      // might miss that new data is available to write. As the fd remains
+      // readable, it will be reported again on the next wait.
+      if (addresult(loop, index, results, maxresults, &nresults, NOEVENT) == 0)
+        clearabort(entry->handle);
+    } else if (fd == EVENTFD_MODEM) {
+      modemmonitorclear(entry->handle);
+      serialevent_t event = modemmonitorpending(entry->handle) & entry->event;
+      if (event != NOEVENT)
+        addresult(loop, index, results, maxresults, &nresults, event);
+    } else {
+      serialevent_t event = NOEVENT;
+      uint32_t epevents = loop->events[i].events;
+      if ((entry->event & READEVENT) && (epevents & EPOLLIN))
+        event |= READEVENT;
+      if ((entry->event & WRITEEVENT) && (epevents & EPOLLOUT))
+        event |= WRITEEVENT;
+      // Like pollevent(), an error or hangup is reported as the events we're
+      // waiting for, so that the next read or write returns the error.
+      if (epevents & (EPOLLERR | EPOLLHUP))
+        event |= entry->event & (READWRITEEVENT | ERROREVENT);
+      if (event != NOEVENT)
+        addresult(loop, index, results, maxresults, &nresults, event);
+    }
+  }
+
+  return nresults;
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
@@ -0,0 +1,23 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : eventloop.h
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Internal methods for the multi-port event loop.
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifndef NSERIAL_EVENTLOOP_H
+#define NSERIAL_EVENTLOOP_H
+
+#include "nserial.h"
+
+// Remove the handle from the event loop it is registered with. Must be called
+// before the file descriptors of the handle are closed.
+void eventloopremove(struct serialhandle *handle);
+
+#endif
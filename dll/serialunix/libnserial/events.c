@@ -14,12 +14,16 @@
 //
 ////////////////////////////////////////////////////////////////////////////////
 
+// For ppoll()
+#define _GNU_SOURCE
 #include "config.h"
 
 #include <stdlib.h>
-#include <sys/time.h>
+#include <string.h>
+#include <limits.h>
 #include <sys/types.h>
-#include <sys/select.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -28,20 +32,26 @@
 #include "serialhandle.h"
 #include "errmsg.h"
 #include "openserial.h"
+#include "events.h"
+#include "filter.h"
+#include "buffer.h"
+#include "coalesce.h"
+#include "drain.h"
+#include "readuntil.h"
+#include "modem.h"
+#include "log.h"
+#include "timeutil.h"
+#include "wakeup.h"
 
 static ssize_t internal_read(struct serialhandle *handle, char *buf, size_t count);
+static ssize_t internal_readv(struct serialhandle *handle, const struct iovec *iov, int iovcnt);
 
-NSERIAL_EXPORT serialevent_t WINAPI serial_waitforevent(struct serialhandle *handle, serialevent_t event, int timeout)
-{
-  if (handle == NULL) {
-    errno = EINVAL;
-    return -1;
-  }
-
-  if (event == NOEVENT) return NOEVENT;
-
-  serial_seterror(handle, ERRMSG_OK);
+// Below this length, filtered data is read into the temporary ring instead of
+// the users buffer, to avoid many small reads.
+#define FILTERINPLACEMIN 256
 
+int checkopen(struct serialhandle *handle)
+{
   int isopen;
   if (serial_isopen(handle, &isopen)) return -1;
   if (!isopen) {
@@ -49,92 +59,302 @@ NSERIAL_EXPORT serialevent_t WINAPI serial_waitforevent(struct serialhandle *han
     errno = EIO;
     return -1;
   }
+  return 0;
+}
+
+// Returns the events that are already pending without waiting for the serial
+// port. If until is not set, the data left over by serial_readuntil() is
+// ignored.
+static serialevent_t pendingevents(struct serialhandle *handle, serialevent_t event, int until)
+{
+  serialevent_t resultevent = NOEVENT;
 
   // Check if we have any data still cached.
-  if (event & READEVENT) {
-    if (handle->tmpbuffer && handle->tmplength) {
-      return READEVENT;
-    }
+  if ((event & READEVENT) &&
+      (until ? hasreaddata(handle) : (handle->tmpbuffer && handle->tmpread))) {
+    resultevent |= READEVENT;
+  }
+
+  // Modem signal changes are reported until they are consumed. An error of
+  // the modem monitor is only reported if the modem signals are waited for.
+  if (event & MODEMCHANGEEVENT) {
+    resultevent |= modemmonitorpending(handle) & event;
+  }
+  return resultevent;
+}
+
+// Waits once with poll() for the events. If flush is set, also waits until
+// the serial port can be written. Sets aborted if woken up by
+// serial_abortwaitforevent().
+static serialevent_t pollevent(struct serialhandle *handle, serialevent_t event, const struct timespec *timeout, int flush, int until, int *aborted)
+{
+  // The modem signals are monitored by a separate thread, which signals its
+  // own file descriptor, so we can wait for it together with the serial port.
+  int modemfd = -1;
+  if (event & MODEMCHANGEEVENT) {
+    modemfd = modemmonitorfd(handle);
+    if (modemfd == -1) return -1;
   }
 
-  int maxfd = -1;
-  fd_set serreadfds;
-  fd_set serwritefds;
-  FD_ZERO(&serreadfds);
-  FD_ZERO(&serwritefds);
-  if (event & READEVENT) {
-    FD_SET(handle->fd, &serreadfds);
-    if (maxfd < handle->fd) maxfd = handle->fd;
-  }
-  if (event & WRITEEVENT) {
-    FD_SET(handle->fd, &serwritefds);
-    if (maxfd < handle->fd) maxfd = handle->fd;
-  }
-  FD_SET(handle->prfd, &serreadfds);
-  if (maxfd < handle->prfd) maxfd = handle->prfd;
-
-  struct timeval *ptval;
-  struct timeval  tval;
-  if (timeout >= 0) {
-    tval.tv_sec = timeout / 1000;
-    tval.tv_usec = (timeout % 1000) * 1000;
-    ptval = &tval;
-  } else {
-    ptval = NULL;
-  }
-
-  int r = select(maxfd + 1,
-                 &serreadfds,
-                 (event & WRITEEVENT) ? &serwritefds : NULL,
-                 NULL, ptval);
+  // If events are already pending, we still poll without waiting, so that
+  // events from the serial port are reported together with them.
+  struct timespec zero = {0, 0};
+  serialevent_t resultevent = pendingevents(handle, event, until);
+  if (resultevent != NOEVENT) timeout = &zero;
+
+  // We use poll() and not select(), as select() can't handle file
+  // descriptors greater or equal to FD_SETSIZE, which happens quickly in
+  // processes that have many sockets or serial ports open. If we're not
+  // waiting for the serial port, a negative fd is ignored by poll(), else a
+  // hangup would wake us up immediately.
+  struct pollfd fds[3];
+  fds[0].fd = (flush || (event & (READWRITEEVENT | ERROREVENT))) ? handle->fd : -1;
+  fds[0].events = 0;
+  fds[0].revents = 0;
+  if (event & READEVENT) fds[0].events |= POLLIN;
+  if (flush || (event & WRITEEVENT)) fds[0].events |= POLLOUT;
+  fds[1].fd = handle->abortfd.rfd;
+  fds[1].events = POLLIN;
+  fds[1].revents = 0;
+  fds[2].fd = modemfd;
+  fds[2].events = POLLIN;
+  fds[2].revents = 0;
+
+#ifdef HAVE_PPOLL
+  int r = ppoll(fds, 3, timeout, NULL);
+#else
+  int r = poll(fds, 3, timespectoms(timeout));
+#endif
   if (r < 0) {
     if (errno != EINTR) {
-      serial_seterror(handle, ERRMSG_SELECT);
+      serial_seterror(handle, ERRMSG_POLL);
       return -1;
     }
   } else if (r > 0) {
-    serialevent_t resultevent = NOEVENT;
+    if ((fds[0].revents | fds[1].revents | fds[2].revents) & POLLNVAL) {
+      serial_seterror(handle, ERRMSG_POLL);
+      errno = EBADF;
+      return -1;
+    }
+
     if ((event & READEVENT) &&
-        FD_ISSET(handle->fd, &serreadfds)) resultevent |= READEVENT;
+        (fds[0].revents & POLLIN)) resultevent |= READEVENT;
     if ((event & WRITEEVENT) &&
-        FD_ISSET(handle->fd, &serwritefds)) resultevent |= WRITEEVENT;
-    if (FD_ISSET(handle->prfd, &serreadfds)) {
-      // We clear the buffer, while we're doing it, serialise access for
-      // the next abort method.
-      pthread_mutex_lock(&(handle->abortmutex));
-      // Something wrote to the pipe to abort the select()
-      char buffer[128];
-      while (read(handle->prfd, buffer, SIZEOF_ARRAY(buffer)) > 0) { }
-      errno = 0;
-      handle->abortpending = FALSE;
-      pthread_mutex_unlock(&(handle->abortmutex));
+        (fds[0].revents & POLLOUT)) resultevent |= WRITEEVENT;
+    if (fds[0].revents & (POLLERR | POLLHUP)) {
+      // Like select(), an error or hangup is reported as the events we're
+      // waiting for, so that the next read or write returns the error.
+      resultevent |= event & (READWRITEEVENT | ERROREVENT);
+    }
+    if (fds[1].revents & POLLIN) {
+      // serial_abortwaitforevent() was called to abort the poll()
+      clearabort(handle);
+      *aborted = TRUE;
+    }
+    if (fds[2].revents & POLLIN) {
+      modemmonitorclear(handle);
+      resultevent |= modemmonitorpending(handle) & event;
     }
-    return resultevent;
   }
-  return NOEVENT;
+  return resultevent;
 }
 
-NSERIAL_EXPORT int WINAPI serial_abortwaitforevent(struct serialhandle *handle)
+// Shortens the timeout to ts, if ts is shorter.
+static void mintimeout(struct timespec **timeout, struct timespec *ts)
+{
+  if (*timeout == NULL || ts->tv_sec < (*timeout)->tv_sec ||
+      (ts->tv_sec == (*timeout)->tv_sec && ts->tv_nsec < (*timeout)->tv_nsec)) {
+    *timeout = ts;
+  }
+}
+
+// Waits like waitevent(). If until is not set, the data left over by
+// serial_readuntil() is ignored.
+static serialevent_t waitevents(struct serialhandle *handle, serialevent_t event, const struct timespec *timeout, int until)
+{
+  int aborted = FALSE;
+  if (!coalescepending(handle) && !(event & TXEMPTYEVENT)) {
+    return pollevent(handle, event, timeout, FALSE, until, &aborted);
+  }
+
+  // Writes that are buffered are written when their delay expires, and the
+  // output queue is checked when the data queued should be sent, without
+  // ending the wait early.
+  struct timespec deadline;
+  if (timeout) {
+    monotonictime(&deadline);
+    addtimespec(&deadline, timeout);
+  }
+  while (TRUE) {
+    struct timespec remaining;
+    struct timespec *polltimeout = NULL;
+    if (timeout) {
+      timeuntil(&deadline, &remaining);
+      polltimeout = &remaining;
+    }
+
+    // After the delay, we wait until the buffered writes can be written.
+    struct timespec delay;
+    int flush = FALSE;
+    if (coalescepending(handle)) {
+      flush = coalesceuntil(handle, &delay);
+      if (!flush) mintimeout(&polltimeout, &delay);
+    }
+
+    // The transmitter being empty can't be polled for, so it's checked when
+    // the data queued should be sent.
+    struct timespec zero = {0, 0};
+    struct timespec txtime;
+    serialevent_t txevent = NOEVENT;
+    if (event & TXEMPTYEVENT) {
+      int pending = drainpending(handle);
+      if (pending == -1) return -1;
+      if (pending == 0) {
+        txevent = TXEMPTYEVENT;
+        polltimeout = &zero;
+      } else {
+        draintime(handle, pending, &txtime);
+        mintimeout(&polltimeout, &txtime);
+      }
+    }
+
+    serialevent_t resultevent =
+      pollevent(handle, event, polltimeout, flush, until, &aborted);
+    if ((int)resultevent == -1) return -1;
+    resultevent |= txevent;
+
+    struct timespec expired;
+    if (coalescepending(handle) && coalesceuntil(handle, &expired) &&
+        coalesceflush(handle) == -1) return -1;
+    if (resultevent != NOEVENT || aborted) return resultevent;
+    if (timeout && timeuntil(&deadline, &remaining)) return NOEVENT;
+  }
+}
+
+serialevent_t waitevent(struct serialhandle *handle, serialevent_t event, const struct timespec *timeout)
+{
+  return waitevents(handle, event, timeout, TRUE);
+}
+
+serialevent_t waitport(struct serialhandle *handle, serialevent_t event, const struct timespec *timeout)
+{
+  return waitevents(handle, event, timeout, FALSE);
+}
+
+NSERIAL_EXPORT serialevent_t WINAPI serial_waitforevent(struct serialhandle *handle, serialevent_t event, int timeout)
 {
   if (handle == NULL) {
     errno = EINVAL;
     return -1;
   }
 
-  pthread_mutex_lock(&(handle->abortmutex));
-  if (handle->abortpending) {
-    // We've already signalled an abort.
-    pthread_mutex_unlock(&(handle->abortmutex));
-    return 0;
+  if (event == NOEVENT) return NOEVENT;
+
+  serial_seterror(handle, ERRMSG_OK);
+  if (checkopen(handle)) return -1;
+
+  struct timespec ts;
+  return waitevent(handle, event, mstotimespec(timeout, &ts));
+}
+
+NSERIAL_EXPORT serialevent_t WINAPI serial_timedwaitforevent(struct serialhandle *handle, serialevent_t event, const struct timespec *timeout, serialtimeoutmode_t mode, struct timespec *remaining)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
   }
-  char pabort = 'X';
-  if (write(handle->pwfd, &pabort, 1) == -1) {
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  if ((timeout != NULL && !timespecvalid(timeout)) ||
+      (mode != TIMEOUT_RELATIVE && mode != TIMEOUT_ABSOLUTE)) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (checkopen(handle)) return -1;
+
+  // A relative timeout is converted to a deadline, so that the remaining time
+  // can be calculated after the wait.
+  struct timespec deadline;
+  struct timespec reltimeout;
+  if (timeout != NULL) {
+    if (mode == TIMEOUT_ABSOLUTE) {
+      deadline = *timeout;
+    } else {
+      monotonictime(&deadline);
+      if (timeout->tv_sec >= 0) addtimespec(&deadline, timeout);
+    }
+    timeuntil(&deadline, &reltimeout);
+  }
+
+  serialevent_t result =
+    waitevent(handle, event, timeout != NULL ? &reltimeout : NULL);
+
+  if (remaining != NULL) {
+    if (timeout != NULL) {
+      timeuntil(&deadline, remaining);
+    } else {
+      remaining->tv_sec = 0;
+      remaining->tv_nsec = 0;
+    }
+  }
+  return result;
+}
+
+int hasreaddata(struct serialhandle *handle)
+{
+  return (handle->tmpbuffer && handle->tmpread) || untilpending(handle);
+}
+
+int isfiltered(struct serialhandle *handle)
+{
+  return handle->parityrepactive || handle->discardnull;
+}
+
+int openabort(struct serialhandle *handle)
+{
+  atomic_init(&(handle->abortpending), FALSE);
+  return wakeupopen(handle, &(handle->abortfd));
+}
+
+void closeabort(struct serialhandle *handle)
+{
+  wakeupclose(&(handle->abortfd));
+}
+
+void clearabort(struct serialhandle *handle)
+{
+  // The file descriptor must be emptied before the flag is reset. An abort
+  // that comes in between sees the flag still set and doesn't signal, which
+  // is fine as we're about to return to the user anyway. Resetting the flag
+  // first would allow us to consume a new signal, leaving the flag set with
+  // nothing to wake up the next wait.
+  wakeupclear(&(handle->abortfd));
+
+  // The exchange synchronises with the thread that signalled the abort, so
+  // that its writes before the abort are visible to the caller.
+  atomic_exchange(&(handle->abortpending), FALSE);
+}
+
+NSERIAL_EXPORT int WINAPI serial_abortwaitforevent(struct serialhandle *handle)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  // Only the first abort signals the file descriptor. Further aborts are
+  // coalesced until the waiting thread has cleared it. So the pipe can never
+  // fill up and the eventfd counter can't overflow.
+  if (atomic_exchange(&(handle->abortpending), TRUE)) return 0;
+
+  if (wakeupsignal(&(handle->abortfd)) == -1) {
     serial_seterror(handle, ERRMSG_PIPEWRITE);
-    pthread_mutex_unlock(&(handle->abortmutex));
+    atomic_store(&(handle->abortpending), FALSE);
     return -1;
   }
-  handle->abortpending = TRUE;
-  pthread_mutex_unlock(&(handle->abortmutex));
   return 0;
 }
 
@@ -153,124 +373,280 @@ NSERIAL_EXPORT ssize_t WINAPI serial_read(struct serialhandle *handle, char *buf
     return -1;
   }
 
-  int isopen;
-  if (serial_isopen(handle, &isopen)) return -1;
-  if (!isopen) {
-    serial_seterror(handle, ERRMSG_SERIALPORTNOTOPEN);
-    errno = EIO;
+  if (checkopen(handle)) return -1;
+  return readdata(handle, buffer, length);
+}
+
+// Checks the vector given by the user.
+static int checkiovec(struct serialhandle *handle, const struct iovec *iov, int iovcnt)
+{
+  if ((iov == NULL && iovcnt > 0) || iovcnt < 0 || iovcnt > IOV_MAX) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
     return -1;
   }
+  for (int i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_base == NULL && iov[i].iov_len > 0) {
+      serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+      errno = EINVAL;
+      return -1;
+    }
+  }
+  return 0;
+}
 
-  if (length == 0) return 0;
+NSERIAL_EXPORT ssize_t WINAPI serial_readv(struct serialhandle *handle, const struct iovec *iov, int iovcnt)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  if (checkiovec(handle, iov, iovcnt)) return -1;
+  if (checkopen(handle)) return -1;
+  return readdatav(handle, iov, iovcnt);
+}
+
+ssize_t readdata(struct serialhandle *handle, char *buffer, size_t length)
+{
+  struct iovec iov;
+  iov.iov_base = buffer;
+  iov.iov_len = length;
+  return readdatav(handle, &iov, 1);
+}
+
+// The temporary buffer is a ring of the data read from the serial port that
+// isn't yet filtered. The data starts at tmpstart and is tmplength bytes.
+
+// Gets the data in the temporary ring, which may wrap, as two segments.
+static void tmpdata(struct serialhandle *handle, struct iovec *iov)
+{
+  size_t first = handle->buffersize - handle->tmpstart;
+  if (first > (size_t)handle->tmplength) first = handle->tmplength;
+  iov[0].iov_base = handle->tmpbuffer + handle->tmpstart;
+  iov[0].iov_len = first;
+  iov[1].iov_base = handle->tmpbuffer;
+  iov[1].iov_len = handle->tmplength - first;
+}
 
-  if (!(handle->parityrepactive || handle->discardnull)) {
-    return internal_read(handle, buffer, length);
+// Gets the free space in the temporary ring, which may wrap, as two segments.
+static void tmpfree(struct serialhandle *handle, struct iovec *iov)
+{
+  size_t end = (handle->tmpstart + handle->tmplength) % handle->buffersize;
+  size_t free = handle->buffersize - handle->tmplength;
+  size_t first = handle->buffersize - end;
+  if (first > free) first = free;
+  iov[0].iov_base = handle->tmpbuffer + end;
+  iov[0].iov_len = first;
+  iov[1].iov_base = handle->tmpbuffer;
+  iov[1].iov_len = free - first;
+}
+
+// Removes data that was filtered from the temporary ring.
+static void tmpconsume(struct serialhandle *handle, size_t length)
+{
+  handle->tmpstart = (handle->tmpstart + length) % handle->buffersize;
+  handle->tmplength -= length;
+  if (handle->tmplength == 0) handle->tmpstart = 0;
+  arrivalconsume(&(handle->tmparrival), handle->tmplength);
+}
+
+// Adds data to the end of the temporary ring, which must fit.
+static void tmpappend(struct serialhandle *handle, const char *buffer, size_t length)
+{
+  for (size_t i = 0; i < length; i++) {
+    size_t end = (handle->tmpstart + handle->tmplength) % handle->buffersize;
+    handle->tmpbuffer[end] = buffer[i];
+    handle->tmplength++;
   }
+}
 
-  // Read into a temporary buffer and then Post process the data for one of
-  // the options:
+// Reads from an open serial port into the vector, applying the filters. If
+// errors isn't NULL, their positions are recorded instead of replacing them.
+// If ts isn't NULL, it's set to when the first byte returned was read.
+static ssize_t readfiltered(struct serialhandle *handle, const struct iovec *iov, int iovcnt, struct filtererrors *errors, struct timespec *ts)
+{
+  // The data must be post processed for one of the options:
   // * parityreplace
   // * discardnull
+  //
+  // If tmpread is set, the temporary ring has data that can be processed
+  // without reading, else it's empty or only the start of a parity error
+  // sequence. When the users buffer is large enough, the data is read into it
+  // and filtered in place, as the filtered data is never longer. Only an
+  // incomplete parity error sequence at the end is kept in the ring.
 
-  if (handle->tmpbuffer == NULL) {
-    serial_seterror(handle, ERRMSG_OUTOFMEMORY);
-    errno = ENOMEM;
-    return -1;
-  }
+  if (tmpbufferalloc(handle)) return -1;
 
-  ssize_t readbytes;
-  char   *buff;
+  ssize_t total = 0;
+  int k = 0;
+  size_t koffset = 0;
+  size_t consumed;
+  struct iovec in[3];
+
+  struct timespec now;
 
   if (handle->tmpread) {
-    // Just simulate the read, because we read more data than the user
-    // wanted last time.
-    buff = handle->tmpbuffer + handle->tmpstart;
-    readbytes = handle->tmplength;
-  } else {
-    // Last call to this function required that we need to read more data to
-    // process further. The previous call made sure that relevant data is at
-    // the beginning of the buffer, so we don't have to implement a circular
-    // queue.
-    buff = handle->tmpbuffer;
-    readbytes = internal_read(handle,
-                              handle->tmpbuffer + handle->tmplength,
-                              SERIALBUFFERSIZE - handle->tmplength);
-    if (readbytes <= 0) return readbytes;
-    readbytes += handle->tmplength;
-  }
-
-  int i = 0, j = 0;
-  while (i < readbytes && j < length) {
-    // Handle parity replacement. The spec has in simplest form:
-    // * 0xFF 0x00 0xNN => handle->parityreplace
-    // * 0xFF 0xFF      => 0xFF
-    //
-    // We don't actually have to check if ISTRIP is active or not, because if
-    // it's active, we know we can never get 0xFF 0xFF in the stream (unless
-    // there's a bug in the kernel driver).
-    if (handle->parityrepactive != PARMODE_INACTIVE) {
-      if (buff[i] == (char)0xFF) {
-        if ((i + 1) >= readbytes) {
-          // Not enough data in the buffer. Store it for when new data
-          // arrives.
-          handle->tmpread = FALSE;
-          handle->tmpbuffer[0] = 0xFF;
-          handle->tmplength = 1;
-          i = readbytes;
-          continue;
-        }
-
-        // Bytes 0xFF 0xFF indicate a single byte 0xFF in the output buffer.
-        if (buff[i + 1] == (char)0xFF) {
-          buff[j++] = 0xFF;
-          i += 2;
-          continue;
-        }
-
-        if ((i + 2) >= readbytes) {
-          // Not enough data in the buffer. Store it for when new data
-          // arrives.
-          handle->tmpread = FALSE;
-          handle->tmpbuffer[0] = 0xFF;
-          handle->tmpbuffer[1] = 0x00;
-          handle->tmplength = 2;
-          i = readbytes;
-          continue;
-        }
-
-        buffer[j++] = handle->parityreplace;
-        i += 3;
-        continue;
-      }
-    }
+    tmpdata(handle, in);
+    total += filtervector(handle, in, 2, &consumed, iov, iovcnt,
+                          &k, &koffset, errors);
+    if (ts && total) *ts = handle->tmparrival.first;
+    tmpconsume(handle, consumed);
+    if (k == iovcnt || (errors && errors->full)) return total;
+
+    // There wasn't enough data to fill the vector.
+    handle->tmpread = FALSE;
+  }
 
-    // Handle discardnull. Parity errors will be removed due to this flag.
-    if (!handle->discardnull || buff[i]) {
-      buffer[j++] = buff[i];
+  while (k < iovcnt && koffset == iov[k].iov_len) {
+    k++;
+    koffset = 0;
+  }
+  if (k == iovcnt) return total;
+
+  // Only a single read for every call, like serial_read(). Reading the
+  // errors may stop early, so the data is then always read into the ring.
+  size_t space = iov[k].iov_len - koffset;
+  if (space >= FILTERINPLACEMIN && errors == NULL) {
+    char *buffer = (char *)iov[k].iov_base + koffset;
+    ssize_t readbytes = internal_read(handle, buffer, space);
+    if (readbytes < 0) return total ? total : -1;
+    if (readbytes == 0) return total;
+    monotonictime(&now);
+
+    // The start of a parity error sequence in the ring comes first, and keeps
+    // the time it was read.
+    size_t carry = handle->tmplength;
+    if (ts && !total) *ts = carry ? handle->tmparrival.first : now;
+    tmpdata(handle, in);
+    in[2].iov_base = buffer;
+    in[2].iov_len = readbytes;
+    total += filtervector(handle, in, 3, &consumed, iov, iovcnt,
+                          &k, &koffset, NULL);
+    if (consumed < carry) {
+      tmpconsume(handle, consumed);
+      consumed = 0;
+    } else {
+      tmpconsume(handle, carry);
+      consumed -= carry;
     }
-    i++;
+    arrivaladd(&(handle->tmparrival), handle->tmplength,
+               readbytes - consumed, &now);
+    tmpappend(handle, buffer + consumed, readbytes - consumed);
+    return total;
   }
 
-  if (i < readbytes) {
-    // If we didn't copy all of the internal data into the user supplied
-    // buffer, remember where we got to and resume on the next read call.
-    handle->tmpread = TRUE;
-    handle->tmpstart += i;
-    handle->tmplength -= i;
-  } else {
-    handle->tmpread = FALSE;
-    handle->tmpstart = 0;
-    handle->tmplength = 0;
+  // The users buffer is small, so read as much as possible into the ring and
+  // keep what doesn't fit for the next call.
+  tmpfree(handle, in);
+  ssize_t readbytes = internal_readv(handle, in, in[1].iov_len ? 2 : 1);
+  if (readbytes < 0) return total ? total : -1;
+  if (readbytes == 0) return total;
+  monotonictime(&now);
+  arrivaladd(&(handle->tmparrival), handle->tmplength, readbytes, &now);
+  handle->tmplength += readbytes;
+  handle->tmpread = TRUE;
+
+  tmpdata(handle, in);
+  size_t outbytes = filtervector(handle, in, 2, &consumed, iov, iovcnt,
+                                 &k, &koffset, errors);
+  if (ts && !total && outbytes) *ts = handle->tmparrival.first;
+  total += outbytes;
+  tmpconsume(handle, consumed);
+  if (k < iovcnt && !(errors && errors->full)) handle->tmpread = FALSE;
+  return total;
+}
+
+ssize_t readdatav(struct serialhandle *handle, const struct iovec *iov, int iovcnt)
+{
+  return readdatavts(handle, iov, iovcnt, NULL);
+}
+
+ssize_t readdatavts(struct serialhandle *handle, const struct iovec *iov, int iovcnt, struct timespec *ts)
+{
+  // Data read ahead by serial_readuntil() comes first.
+  if (untilpending(handle)) return untilcopy(handle, iov, iovcnt, ts);
+  return readport(handle, iov, iovcnt, ts);
+}
+
+ssize_t readport(struct serialhandle *handle, const struct iovec *iov, int iovcnt, struct timespec *ts)
+{
+  if (!isfiltered(handle)) {
+    ssize_t readbytes = internal_readv(handle, iov, iovcnt);
+    if (readbytes > 0 && ts) monotonictime(ts);
+    return readbytes;
   }
+  return readfiltered(handle, iov, iovcnt, NULL, ts);
+}
 
-  readbytes = j;
-  return readbytes;
+NSERIAL_EXPORT ssize_t WINAPI serial_read_ts(struct serialhandle *handle, char *buffer, size_t length, struct timespec *ts)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  if (buffer == NULL || ts == NULL) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (checkopen(handle)) return -1;
+
+  struct iovec iov;
+  iov.iov_base = buffer;
+  iov.iov_len = length;
+  return readdatavts(handle, &iov, 1, ts);
+}
+
+NSERIAL_EXPORT ssize_t WINAPI serial_readerrors(struct serialhandle *handle, char *buffer, size_t length, struct serialrxerrorinfo *errors, int maxerrors, int *errorcount)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  if (buffer == NULL || errors == NULL || errorcount == NULL ||
+      maxerrors <= 0) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (checkopen(handle)) return -1;
+
+  *errorcount = 0;
+  struct iovec iov;
+  iov.iov_base = buffer;
+  iov.iov_len = length;
+  if (untilpending(handle)) return untilcopy(handle, &iov, 1, NULL);
+  if (!isfiltered(handle)) return internal_readv(handle, &iov, 1);
+
+  struct filtererrors filtererrors;
+  filtererrors.errors = errors;
+  filtererrors.maxerrors = maxerrors;
+  filtererrors.count = 0;
+  filtererrors.offset = 0;
+  filtererrors.full = FALSE;
+  ssize_t result = readfiltered(handle, &iov, 1, &filtererrors, NULL);
+  *errorcount = filtererrors.count;
+  return result;
 }
 
 static ssize_t internal_read(struct serialhandle *handle, char *buf, size_t count)
 {
   ssize_t readbytes;
 
+  if (count == 0) return 0;
+
+  handle->readcalls++;
   readbytes = read(handle->fd, buf, count);
   if (readbytes == 0) {
     serial_seterror(handle, ERRMSG_SERIALREADEOF);
@@ -287,6 +663,34 @@ static ssize_t internal_read(struct serialhandle *handle, char *buf, size_t coun
   return readbytes;
 }
 
+static ssize_t internal_readv(struct serialhandle *handle, const struct iovec *iov, int iovcnt)
+{
+  ssize_t readbytes;
+
+  if (iovcnt == 1) return internal_read(handle, iov[0].iov_base, iov[0].iov_len);
+
+  // A read of zero bytes would be interpreted as end of file.
+  size_t length = 0;
+  for (int i = 0; i < iovcnt; i++) length += iov[i].iov_len;
+  if (length == 0) return 0;
+
+  handle->readcalls++;
+  readbytes = readv(handle->fd, iov, iovcnt);
+  if (readbytes == 0) {
+    serial_seterror(handle, ERRMSG_SERIALREADEOF);
+    errno = EIO;
+    return -1;
+  } else if (readbytes < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return 0;
+    }
+    serial_seterror(handle, ERRMSG_SERIALREAD);
+    return -1;
+  }
+
+  return readbytes;
+}
+
 NSERIAL_EXPORT ssize_t WINAPI serial_write(struct serialhandle *handle, const char *buffer, size_t length)
 {
   if (handle == NULL) {
@@ -302,14 +706,26 @@ NSERIAL_EXPORT ssize_t WINAPI serial_write(struct serialhandle *handle, const ch
     return -1;
   }
 
-  int isopen;
-  if (serial_isopen(handle, &isopen)) return -1;
-  if (!isopen) {
-    serial_seterror(handle, ERRMSG_SERIALPORTNOTOPEN);
-    errno = EIO;
+  if (checkopen(handle)) return -1;
+  return coalescewrite(handle, buffer, length);
+}
+
+NSERIAL_EXPORT ssize_t WINAPI serial_writev(struct serialhandle *handle, const struct iovec *iov, int iovcnt)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
     return -1;
   }
 
+  serial_seterror(handle, ERRMSG_OK);
+
+  if (checkiovec(handle, iov, iovcnt)) return -1;
+  if (checkopen(handle)) return -1;
+  return coalescewritev(handle, iov, iovcnt);
+}
+
+ssize_t writedata(struct serialhandle *handle, const char *buffer, size_t length)
+{
   if (length == 0) return 0;
 
   ssize_t writebytes;
@@ -324,3 +740,67 @@ NSERIAL_EXPORT ssize_t WINAPI serial_write(struct serialhandle *handle, const ch
 
   return writebytes;
 }
+
+ssize_t writedatav(struct serialhandle *handle, const struct iovec *iov, int iovcnt)
+{
+  if (iovcnt == 0) return 0;
+
+  ssize_t writebytes;
+  writebytes = writev(handle->fd, iov, iovcnt);
+  if (writebytes < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return 0;
+    }
+    serial_seterror(handle, ERRMSG_SERIALWRITE);
+    return -1;
+  }
+
+  return writebytes;
+}
+
+NSERIAL_EXPORT int WINAPI serial_service(struct serialhandle *handle, char *readbuffer, size_t readlength, const char *writebuffer, size_t writelength, int timeout, struct serialserviceresult *result)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  if (result == NULL ||
+      (readbuffer == NULL && readlength > 0) ||
+      (writebuffer == NULL && writelength > 0)) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+
+  result->event = NOEVENT;
+  result->readbytes = 0;
+  result->writebytes = 0;
+
+  if (checkopen(handle)) return -1;
+
+  serialevent_t event = NOEVENT;
+  if (readlength > 0) event |= READEVENT;
+  if (writelength > 0) event |= WRITEEVENT;
+
+  struct timespec ts;
+  serialevent_t gotevent = waitevent(handle, event, mstotimespec(timeout, &ts));
+  if ((int)gotevent == -1) return -1;
+  result->event = gotevent;
+
+  if (gotevent & READEVENT) {
+    ssize_t readbytes = readdata(handle, readbuffer, readlength);
+    if (readbytes == -1) return -1;
+    result->readbytes = readbytes;
+  }
+
+  if (gotevent & WRITEEVENT) {
+    ssize_t writebytes = coalescewrite(handle, writebuffer, writelength);
+    if (writebytes == -1) return -1;
+    result->writebytes = writebytes;
+  }
+
+  return 0;
+}
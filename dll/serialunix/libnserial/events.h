@@ -0,0 +1,78 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : events.h
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Internal methods shared by the event handling functions.
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifndef NSERIAL_EVENTS_H
+#define NSERIAL_EVENTS_H
+
+#include <time.h>
+#include <sys/uio.h>
+
+#include "nserial.h"
+
+// Checks that the serial port is open, setting the error if it isn't.
+int checkopen(struct serialhandle *handle);
+
+// Waits for the events on an open serial port. If event is NOEVENT, only
+// waits for serial_abortwaitforevent() or the timeout. The timeout is
+// relative, and NULL waits forever. Buffered writes are written when their
+// delay expires while waiting.
+serialevent_t waitevent(struct serialhandle *handle, serialevent_t event, const struct timespec *timeout);
+
+// Waits like waitevent(), but ignores the data left over by
+// serial_readuntil(), which is waiting for more data from the serial port.
+serialevent_t waitport(struct serialhandle *handle, serialevent_t event, const struct timespec *timeout);
+
+// Reads from an open serial port, applying the filters. The data left over by
+// serial_readuntil() is returned first. Returns 0 if there is no data.
+ssize_t readdata(struct serialhandle *handle, char *buffer, size_t length);
+
+// Reads from an open serial port into the vector, applying the filters.
+// Returns 0 if there is no data.
+ssize_t readdatav(struct serialhandle *handle, const struct iovec *iov, int iovcnt);
+
+// Reads like readdatav(). If ts isn't NULL and data is returned, it's set to
+// the time CLOCK_MONOTONIC the first byte returned was read.
+ssize_t readdatavts(struct serialhandle *handle, const struct iovec *iov, int iovcnt, struct timespec *ts);
+
+// Reads like readdatavts(), but only from the serial port and the data not
+// yet filtered, ignoring the data left over by serial_readuntil().
+ssize_t readport(struct serialhandle *handle, const struct iovec *iov, int iovcnt, struct timespec *ts);
+
+// Writes to an open serial port, without coalescing. Returns 0 if the data
+// can't be written without blocking.
+ssize_t writedata(struct serialhandle *handle, const char *buffer, size_t length);
+
+// Writes the vector to an open serial port, without coalescing. Returns 0 if
+// the data can't be written without blocking.
+ssize_t writedatav(struct serialhandle *handle, const struct iovec *iov, int iovcnt);
+
+// Returns non-zero if data is cached by the library that can be read without
+// waiting for the serial port.
+int hasreaddata(struct serialhandle *handle);
+
+// Returns non-zero if serial_read() must post process the data read from the
+// serial port, so it can't be read directly into the users buffer.
+int isfiltered(struct serialhandle *handle);
+
+// Opens the file descriptors used by serial_abortwaitforevent(). An eventfd if
+// available, else an anonymous pipe.
+int openabort(struct serialhandle *handle);
+
+// Closes the file descriptors opened by openabort().
+void closeabort(struct serialhandle *handle);
+
+// Clears a pending abort, that was signalled by serial_abortwaitforevent() and
+// woke up the waiting thread.
+void clearabort(struct serialhandle *handle);
+
+#endif
@@ -0,0 +1,271 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : filter.c
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Post processes the data read for parity replacement and
+// discarding null bytes.
+//
+// Most data read has no bytes to filter. Instead of testing every byte, the
+// data is scanned for the first 0xFF or 0x00 with SIMD instructions and
+// everything before it is copied with memcpy(). The instructions are chosen
+// once when first used, depending on what the CPU supports.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__SSE2__) || defined(HAVE_AVX2_TARGET)
+#include <immintrin.h>
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#define NSERIAL_EXPORTS
+#include "nserial.h"
+#include "serialhandle.h"
+#include "filter.h"
+
+// Returns the offset of the first byte in buffer that is a or b, or length if
+// there is none.
+typedef size_t (*scanfunc_t)(const char *buffer, size_t length, char a, char b);
+
+static size_t scanscalar(const char *buffer, size_t length, char a, char b)
+{
+  for (size_t i = 0; i < length; i++) {
+    if (buffer[i] == a || buffer[i] == b) return i;
+  }
+  return length;
+}
+
+#ifdef __SSE2__
+static size_t scansse2(const char *buffer, size_t length, char a, char b)
+{
+  __m128i va = _mm_set1_epi8(a);
+  __m128i vb = _mm_set1_epi8(b);
+  size_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(buffer + i));
+    __m128i eq = _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb));
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(eq);
+    if (mask) return i + __builtin_ctz(mask);
+  }
+  return i + scanscalar(buffer + i, length - i, a, b);
+}
+#endif
+
+#ifdef HAVE_AVX2_TARGET
+__attribute__((target("avx2")))
+static size_t scanavx2(const char *buffer, size_t length, char a, char b)
+{
+  __m256i va = _mm256_set1_epi8(a);
+  __m256i vb = _mm256_set1_epi8(b);
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(buffer + i));
+    __m256i eq =
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb));
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(eq);
+    if (mask) return i + __builtin_ctz(mask);
+  }
+  return i + scanscalar(buffer + i, length - i, a, b);
+}
+#endif
+
+#ifdef __ARM_NEON
+static size_t scanneon(const char *buffer, size_t length, char a, char b)
+{
+  uint8x16_t va = vdupq_n_u8((uint8_t)a);
+  uint8x16_t vb = vdupq_n_u8((uint8_t)b);
+  size_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    uint8x16_t v = vld1q_u8((const uint8_t *)(buffer + i));
+    uint8x16_t eq = vorrq_u8(vceqq_u8(v, va), vceqq_u8(v, vb));
+
+    // Narrowing gives four bits for every byte compared.
+    uint8x8_t narrow = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+    uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(narrow), 0);
+    if (mask) return i + (__builtin_ctzll(mask) >> 2);
+  }
+  return i + scanscalar(buffer + i, length - i, a, b);
+}
+#endif
+
+static pthread_once_t scaninit = PTHREAD_ONCE_INIT;
+static scanfunc_t scan = scanscalar;
+
+static void selectscan(void)
+{
+#ifdef HAVE_AVX2_TARGET
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    scan = scanavx2;
+    return;
+  }
+#endif
+#if defined(__SSE2__)
+  scan = scansse2;
+#elif defined(__ARM_NEON)
+  scan = scanneon;
+#endif
+}
+
+size_t filterdata(struct serialhandle *handle,
+                  const char *in, size_t inlen, size_t *consumed,
+                  char *out, size_t outlen, struct filtererrors *errors)
+{
+  pthread_once(&scaninit, selectscan);
+
+  // The bytes that need special handling. If only one filter is active, the
+  // same byte is searched for twice.
+  int parityrep = handle->parityrepactive != PARMODE_INACTIVE;
+  char a = parityrep ? (char)0xFF : 0x00;
+  char b = handle->discardnull ? 0x00 : a;
+
+  size_t i = 0, j = 0;
+  while (i < inlen && j < outlen) {
+    size_t length = inlen - i;
+    if (length > outlen - j) length = outlen - j;
+
+    // The output may overlap the input when filtering in place.
+    size_t run = scan(in + i, length, a, b);
+    if (run) {
+      memmove(out + j, in + i, run);
+      i += run;
+      j += run;
+      continue;
+    }
+
+    // Handle parity replacement. The spec has in simplest form:
+    // * 0xFF 0x00 0xNN => handle->parityreplace
+    // * 0xFF 0xFF      => 0xFF
+    //
+    // We don't actually have to check if ISTRIP is active or not, because if
+    // it's active, we know we can never get 0xFF 0xFF in the stream (unless
+    // there's a bug in the kernel driver).
+    if (parityrep && in[i] == (char)0xFF) {
+      // Not enough data to decide. It's kept for when new data arrives.
+      if (i + 1 >= inlen) break;
+
+      // Bytes 0xFF 0xFF indicate a single byte 0xFF in the output buffer.
+      if (in[i + 1] == (char)0xFF) {
+        out[j++] = 0xFF;
+        i += 2;
+        continue;
+      }
+
+      if (i + 2 >= inlen) break;
+      if (errors == NULL) {
+        out[j++] = handle->parityreplace;
+        i += 3;
+        continue;
+      }
+
+      // A break is marked as a null byte with an error. The terminal doesn't
+      // tell a parity error from a framing error.
+      if (errors->count == errors->maxerrors) {
+        errors->full = TRUE;
+        break;
+      }
+      struct serialrxerrorinfo *error = &(errors->errors[errors->count++]);
+      error->offset = errors->offset + j;
+      error->error = in[i + 2] ? RXERROR_PARITY : RXERROR_BREAK;
+      out[j++] = in[i + 2];
+      i += 3;
+      continue;
+    }
+
+    // Handle discardnull. Parity errors will be removed due to this flag.
+    if (!handle->discardnull || in[i]) {
+      out[j++] = in[i];
+    }
+    i++;
+  }
+
+  *consumed = i;
+  return j;
+}
+
+size_t filtervector(struct serialhandle *handle,
+                    const struct iovec *in, int incnt, size_t *consumed,
+                    const struct iovec *out, int outcnt,
+                    int *k, size_t *koffset, struct filtererrors *errors)
+{
+  size_t total = 0;
+  size_t used = 0;
+  int i = 0;
+  size_t ioffset = 0;
+  while (i < incnt && *k < outcnt) {
+    if (ioffset == in[i].iov_len) {
+      i++;
+      ioffset = 0;
+      continue;
+    }
+    if (*koffset == out[*k].iov_len) {
+      (*k)++;
+      *koffset = 0;
+      continue;
+    }
+
+    char *dst = (char *)out[*k].iov_base + *koffset;
+    size_t dstlen = out[*k].iov_len - *koffset;
+    size_t c;
+    size_t n = filterdata(handle,
+                          (const char *)in[i].iov_base + ioffset,
+                          in[i].iov_len - ioffset, &c, dst, dstlen, errors);
+    if (c == 0) {
+      // An escape sequence is split over the input segments. It's copied, so
+      // it can be filtered as a whole.
+      char seq[3];
+      size_t seqlen = 0;
+      int j = i;
+      size_t joffset = ioffset;
+      while (seqlen < sizeof(seq) && j < incnt) {
+        if (joffset == in[j].iov_len) {
+          j++;
+          joffset = 0;
+          continue;
+        }
+        seq[seqlen++] = ((const char *)in[j].iov_base)[joffset++];
+      }
+      n = filterdata(handle, seq, seqlen, &c, dst, dstlen, errors);
+
+      // Incomplete at the end of the input, or no more errors can be recorded.
+      if (c == 0) break;
+    }
+
+    *koffset += n;
+    total += n;
+    if (errors) errors->offset += n;
+    used += c;
+    while (c > 0) {
+      if (ioffset == in[i].iov_len) {
+        i++;
+        ioffset = 0;
+        continue;
+      }
+      size_t step = in[i].iov_len - ioffset;
+      if (step > c) step = c;
+      ioffset += step;
+      c -= step;
+    }
+  }
+
+  while (*k < outcnt && *koffset == out[*k].iov_len) {
+    (*k)++;
+    *koffset = 0;
+  }
+
+  *consumed = used;
+  return total;
+}
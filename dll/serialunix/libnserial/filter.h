@@ -0,0 +1,53 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : filter.h
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Internal methods to post process the data read.
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifndef NSERIAL_FILTER_H
+#define NSERIAL_FILTER_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "nserial.h"
+
+// Collects the positions of the errors marked in the data, instead of
+// replacing them with handle->parityreplace.
+struct filtererrors {
+  struct serialrxerrorinfo *errors;     // Array of errors found
+  int                       maxerrors;  // Length of errors
+  int                       count;      // Errors found so far
+  size_t                    offset;     // Offset of the next byte output
+  int                       full;       // Stopped at an error not recorded
+};
+
+// Copies the data in to out, replacing parity errors and discarding null
+// bytes. Stops when out is full, all of in is consumed, or in ends with an
+// incomplete parity error sequence. Returns the number of bytes written to
+// out, and the number of bytes of in that were processed in consumed. If
+// errors isn't NULL, the byte with the error is kept and its position is
+// recorded, stopping when errors is full.
+size_t filterdata(struct serialhandle *handle,
+                  const char *in, size_t inlen, size_t *consumed,
+                  char *out, size_t outlen, struct filtererrors *errors);
+
+// Filters the data of the input segments into the output vector, starting at
+// segment *k and offset *koffset, which are updated. An escape sequence may be
+// split over the input segments. The output may be the same memory as the
+// input, as the output never runs ahead of the input. Returns the number of
+// bytes written, and the number of bytes of input processed in consumed. When
+// the output vector is full, *k is outcnt. See filterdata() for errors.
+size_t filtervector(struct serialhandle *handle,
+                    const struct iovec *in, int incnt, size_t *consumed,
+                    const struct iovec *out, int outcnt,
+                    int *k, size_t *koffset, struct filtererrors *errors);
+
+#endif
@@ -25,6 +25,7 @@
 #include "serialhandle.h"
 #include "errmsg.h"
 #include "flush.h"
+#include "coalesce.h"
 
 NSERIAL_EXPORT int WINAPI serial_reset(struct serialhandle *handle)
 {
@@ -51,4 +52,8 @@ void flushbuffer(struct serialhandle *handle)
   handle->tmpstart = 0;
   handle->tmplength = 0;
   handle->tmpread = FALSE;
+  handle->untilstart = 0;
+  handle->untillength = 0;
+  handle->untilsearched = 0;
+  coalescediscard(handle);
 }
@@ -0,0 +1,757 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : ioqueue.c
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Queues read and write requests for many serial ports, that
+// are submitted and completed in batches.
+//
+// On Linux, io_uring is used if the kernel supports it. Every request is a
+// POLL_ADD linked with a READ or WRITE, so the kernel waits for the serial
+// port and transfers the data without returning to user space (the serial
+// port is opened nonblocking, so a READ alone would return EAGAIN). Reads
+// where serial_read() must filter the data only poll in the kernel, and the
+// data is read with serial_read() on completion.
+//
+// Without io_uring, the requests are polled with poll() and completed with
+// serial_read() and serial_write(), the same as the application would do.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef HAVE_IO_URING
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#define NSERIAL_EXPORTS
+#include "nserial.h"
+#include "serialhandle.h"
+#include "errmsg.h"
+#include "events.h"
+#include "coalesce.h"
+#include "timeutil.h"
+
+// Maximum number of requests in a queue.
+#define IOQUEUEMAXDEPTH 4096
+
+// User data of io_uring entries that cancel a request.
+#define URINGCANCEL ((uint64_t)-1)
+
+typedef enum ioreqstate {
+  IOREQ_FREE = 0,                       // Slot is not used
+  IOREQ_QUEUED,                         // Queued, not yet submitted
+  IOREQ_SUBMITTED,                      // Waiting for the serial port
+  IOREQ_DONE                            // Waiting to be returned to the user
+} ioreqstate_t;
+
+struct ioqueuerequest {
+  struct serialhandle *handle;
+  serialiotype_t       type;
+  char                *buffer;
+  size_t               length;
+  void                *userdata;
+  ioreqstate_t         state;
+  ssize_t              result;          // Result when IOREQ_DONE
+  int                  error;           // errno when result is -1
+#ifdef HAVE_IO_URING
+  int                  pollonly;        // Kernel only polls, we read
+  int                  cqes;            // Completions still outstanding
+  int                  pollres;         // Result of POLL_ADD
+  int                  opres;           // Result of READ or WRITE
+#endif
+};
+
+#ifdef HAVE_IO_URING
+struct ioqueueuring {
+  int                  fd;
+  void                *sqring;
+  size_t               sqringsize;
+  void                *cqring;
+  size_t               cqringsize;
+  struct io_uring_sqe *sqes;
+  size_t               sqessize;
+  unsigned            *sqhead;
+  unsigned            *sqtail;
+  unsigned             sqlocal;       // Tail of entries not yet published
+  unsigned            *sqmask;
+  unsigned            *sqarray;
+  unsigned            *cqhead;
+  unsigned            *cqtail;
+  unsigned            *cqmask;
+  struct io_uring_cqe *cqes;
+};
+#endif
+
+struct serialioqueue {
+  int                    depth;         // Number of requests
+  struct ioqueuerequest *requests;      // Slots for requests
+  int                   *queued;        // Requests to submit, in order
+  int                    nqueued;       // Number of entries in queued
+  int                   *done;          // Circular buffer of done requests
+  int                    donehead;      // First entry in done
+  int                    donecount;     // Number of entries in done
+  int                    inflight;      // Number of submitted requests
+  struct pollfd         *fds;           // Buffer for poll()
+  int                   *fdrequest;     // Request index for each of fds
+  int                    uring;         // Non-zero if using io_uring
+#ifdef HAVE_IO_URING
+  struct ioqueueuring    ring;
+#endif
+};
+
+static void setdone(struct serialioqueue *queue, int index,
+                    ssize_t result, int error)
+{
+  struct ioqueuerequest *req = &(queue->requests[index]);
+
+  if (req->state == IOREQ_SUBMITTED) queue->inflight--;
+  req->state = IOREQ_DONE;
+  req->result = result;
+  req->error = error;
+  queue->done[(queue->donehead + queue->donecount) % queue->depth] = index;
+  queue->donecount++;
+}
+
+static void requeue(struct serialioqueue *queue, int index)
+{
+  struct ioqueuerequest *req = &(queue->requests[index]);
+
+  if (req->state == IOREQ_SUBMITTED) queue->inflight--;
+  req->state = IOREQ_QUEUED;
+  queue->queued[queue->nqueued++] = index;
+}
+
+// Does the read or write in user space. Returns zero if the request couldn't
+// transfer any data, and should wait for the serial port again.
+static int doio(struct serialioqueue *queue, int index)
+{
+  struct ioqueuerequest *req = &(queue->requests[index]);
+  ssize_t result;
+
+  if (req->type == IOQUEUE_READ) {
+    result = serial_read(req->handle, req->buffer, req->length);
+  } else {
+    result = serial_write(req->handle, req->buffer, req->length);
+  }
+  if (result == 0) return 0;
+
+  setdone(queue, index, result, result < 0 ? errno : 0);
+  return 1;
+}
+
+// Copies done requests to the completions given by the user and frees their
+// slots.
+static int takedone(struct serialioqueue *queue,
+                    struct serialiocompletion *completions, int maxcompletions)
+{
+  int n = 0;
+  while (queue->donecount > 0 && n < maxcompletions) {
+    int index = queue->done[queue->donehead];
+    struct ioqueuerequest *req = &(queue->requests[index]);
+
+    completions[n].handle = req->handle;
+    completions[n].type = req->type;
+    completions[n].buffer = req->buffer;
+    completions[n].userdata = req->userdata;
+    completions[n].result = req->result;
+    completions[n].error = req->error;
+    n++;
+
+    req->state = IOREQ_FREE;
+    req->handle = NULL;
+    queue->donehead = (queue->donehead + 1) % queue->depth;
+    queue->donecount--;
+  }
+  return n;
+}
+
+// Returns the milliseconds until the deadline, or -1 if there is no deadline.
+static int remaining(int timeout, const struct timespec *deadline)
+{
+  if (timeout < 0) return -1;
+
+  struct timespec ts;
+  timeuntil(deadline, &ts);
+  return timespectoms(&ts);
+}
+
+static int pollsubmit(struct serialioqueue *queue)
+{
+  int submitted = queue->nqueued;
+  for (int i = 0; i < queue->nqueued; i++) {
+    queue->requests[queue->queued[i]].state = IOREQ_SUBMITTED;
+    queue->inflight++;
+  }
+  queue->nqueued = 0;
+  return submitted;
+}
+
+static int pollcomplete(struct serialioqueue *queue,
+                        struct serialiocompletion *completions,
+                        int maxcompletions, int timeout,
+                        const struct timespec *deadline)
+{
+  pollsubmit(queue);
+
+  while (1) {
+    int nfds = 0;
+    for (int i = 0; i < queue->depth; i++) {
+      struct ioqueuerequest *req = &(queue->requests[i]);
+      if (req->state != IOREQ_SUBMITTED) continue;
+
+      // Data cached by serial_read() isn't seen by poll().
+      if (req->type == IOQUEUE_READ && hasreaddata(req->handle)) {
+        if (doio(queue, i)) continue;
+      }
+
+      queue->fds[nfds].fd = req->handle->fd;
+      queue->fds[nfds].events = req->type == IOQUEUE_READ ? POLLIN : POLLOUT;
+      queue->fds[nfds].revents = 0;
+      queue->fdrequest[nfds] = i;
+      nfds++;
+    }
+
+    if (queue->donecount > 0 || nfds == 0) break;
+
+    int r = poll(queue->fds, nfds, remaining(timeout, deadline));
+    if (r < 0) {
+      if (errno == EINTR) break;
+      return -1;
+    }
+    if (r == 0) break;
+
+    for (int i = 0; i < nfds; i++) {
+      if (queue->fds[i].revents == 0) continue;
+      if (queue->fds[i].revents & POLLNVAL) {
+        setdone(queue, queue->fdrequest[i], -1, EBADF);
+        continue;
+      }
+      // An error or hangup is returned by the read or write.
+      doio(queue, queue->fdrequest[i]);
+    }
+    if (queue->donecount > 0 || remaining(timeout, deadline) == 0) break;
+  }
+
+  return takedone(queue, completions, maxcompletions);
+}
+
+#ifdef HAVE_IO_URING
+static int io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                          unsigned flags, void *arg, size_t argsz)
+{
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                      flags, arg, argsz);
+}
+
+static void uringunmap(struct ioqueueuring *ring)
+{
+  if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+    munmap(ring->sqes, ring->sqessize);
+  if (ring->cqring != NULL && ring->cqring != MAP_FAILED &&
+      ring->cqring != ring->sqring)
+    munmap(ring->cqring, ring->cqringsize);
+  if (ring->sqring != NULL && ring->sqring != MAP_FAILED)
+    munmap(ring->sqring, ring->sqringsize);
+}
+
+// Sets up the io_uring. Returns -1 if io_uring can't be used, and the queue
+// should fall back to poll().
+static int uringinit(struct ioqueueuring *ring, int depth)
+{
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  memset(ring, 0, sizeof(struct ioqueueuring));
+
+  // Every request needs at most two submission entries.
+  ring->fd = io_uring_setup(depth * 2, &p);
+  if (ring->fd == -1) return -1;
+
+  // We need to wait with a timeout, and must not lose completions.
+  if (!(p.features & IORING_FEAT_EXT_ARG) ||
+      !(p.features & IORING_FEAT_NODROP)) {
+    close(ring->fd);
+    return -1;
+  }
+
+  ring->sqringsize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cqringsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cqringsize > ring->sqringsize)
+      ring->sqringsize = ring->cqringsize;
+    ring->cqringsize = ring->sqringsize;
+  }
+
+  ring->sqring = mmap(NULL, ring->sqringsize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sqring == MAP_FAILED) goto fail;
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cqring = ring->sqring;
+  } else {
+    ring->cqring = mmap(NULL, ring->cqringsize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cqring == MAP_FAILED) goto fail;
+  }
+
+  ring->sqessize = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqessize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) goto fail;
+
+  ring->sqhead = (unsigned *)((char *)ring->sqring + p.sq_off.head);
+  ring->sqtail = (unsigned *)((char *)ring->sqring + p.sq_off.tail);
+  ring->sqmask = (unsigned *)((char *)ring->sqring + p.sq_off.ring_mask);
+  ring->sqarray = (unsigned *)((char *)ring->sqring + p.sq_off.array);
+  ring->cqhead = (unsigned *)((char *)ring->cqring + p.cq_off.head);
+  ring->cqtail = (unsigned *)((char *)ring->cqring + p.cq_off.tail);
+  ring->cqmask = (unsigned *)((char *)ring->cqring + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)((char *)ring->cqring + p.cq_off.cqes);
+  ring->sqlocal = *ring->sqtail;
+  return 0;
+
+fail:
+  uringunmap(ring);
+  close(ring->fd);
+  return -1;
+}
+
+// Gets the next submission entry. The kernel doesn't see it until the
+// caller has filled it, and the tail is published with uringsqpublish().
+static struct io_uring_sqe *uringgetsqe(struct ioqueueuring *ring)
+{
+  unsigned index = ring->sqlocal & *ring->sqmask;
+  struct io_uring_sqe *sqe = &(ring->sqes[index]);
+
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  ring->sqarray[index] = index;
+  ring->sqlocal++;
+  return sqe;
+}
+
+// Number of entries, published or not, the kernel hasn't consumed yet.
+static unsigned uringsqpending(struct ioqueueuring *ring)
+{
+  return ring->sqlocal - __atomic_load_n(ring->sqhead, __ATOMIC_ACQUIRE);
+}
+
+// Publishes the filled entries to the kernel, before io_uring_enter(). The
+// release store orders the writes to the entries before the tail. The ring
+// isn't set up with IORING_SETUP_SQPOLL, so the kernel only reads the queue
+// in io_uring_enter(), but the entries are never visible half written.
+// Returns the number of entries to submit.
+static unsigned uringsqpublish(struct ioqueueuring *ring)
+{
+  __atomic_store_n(ring->sqtail, ring->sqlocal, __ATOMIC_RELEASE);
+  return uringsqpending(ring);
+}
+
+static void uringprepcancel(struct io_uring_sqe *sqe, uint64_t user_data)
+{
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = user_data;
+  sqe->user_data = URINGCANCEL;
+}
+
+// Cancels all requests in the kernel, and waits until the kernel has
+// completed them, so that it no longer accesses the buffers of the caller.
+static void uringcancel(struct serialioqueue *queue)
+{
+  struct ioqueueuring *ring = &(queue->ring);
+  unsigned entries = *ring->sqmask + 1;
+  int index = 0;
+
+  while (queue->inflight > 0) {
+    // Each request needs up to two entries to cancel, added as the kernel
+    // consumes the submission queue.
+    while (index < queue->depth && uringsqpending(ring) + 2 <= entries) {
+      struct ioqueuerequest *req = &(queue->requests[index]);
+      if (req->state == IOREQ_SUBMITTED) {
+        uringprepcancel(uringgetsqe(ring), ((uint64_t)index << 1) | 1);
+        if (!req->pollonly) {
+          uringprepcancel(uringgetsqe(ring), (uint64_t)index << 1);
+        }
+      }
+      index++;
+    }
+
+    if (io_uring_enter(ring->fd, uringsqpublish(ring), 1,
+                       IORING_ENTER_GETEVENTS, NULL, 0) == -1) {
+      if (errno != EAGAIN && errno != EBUSY && errno != EINTR) return;
+    }
+
+    // The results are dropped, the requests are never returned.
+    unsigned head = *ring->cqhead;
+    unsigned tail = __atomic_load_n(ring->cqtail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      struct io_uring_cqe *cqe = &(ring->cqes[head & *ring->cqmask]);
+      if (cqe->user_data != URINGCANCEL) {
+        struct ioqueuerequest *req = &(queue->requests[cqe->user_data >> 1]);
+        if (--req->cqes == 0) {
+          req->state = IOREQ_FREE;
+          queue->inflight--;
+        }
+      }
+      head++;
+    }
+    __atomic_store_n(ring->cqhead, head, __ATOMIC_RELEASE);
+  }
+}
+
+static void uringterminate(struct serialioqueue *queue)
+{
+  uringcancel(queue);
+  uringunmap(&(queue->ring));
+  close(queue->ring.fd);
+}
+
+static void uringpreppoll(struct io_uring_sqe *sqe, int fd, unsigned events)
+{
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+#if __BYTE_ORDER == __BIG_ENDIAN
+  events = (events << 16) | (events >> 16);
+#endif
+  sqe->poll32_events = events;
+}
+
+static int uringsubmit(struct serialioqueue *queue)
+{
+  struct ioqueueuring *ring = &(queue->ring);
+  int submitted = 0;
+
+  for (int i = 0; i < queue->nqueued; i++) {
+    int index = queue->queued[i];
+    struct ioqueuerequest *req = &(queue->requests[index]);
+
+    req->state = IOREQ_SUBMITTED;
+    queue->inflight++;
+    submitted++;
+
+    // Data cached by serial_read() isn't seen by the kernel.
+    if (req->type == IOQUEUE_READ && hasreaddata(req->handle)) {
+      if (doio(queue, index)) continue;
+    }
+
+    // Data buffered by serial_setwritecoalesce() is written first. If it
+    // can't all be written, the kernel only polls until it can be written.
+    ssize_t coalesced = 0;
+    if (req->type == IOQUEUE_WRITE && coalescepending(req->handle)) {
+      coalesced = coalesceflush(req->handle);
+      if (coalesced == -1) {
+        setdone(queue, index, -1, errno);
+        continue;
+      }
+    }
+
+    req->pollonly = coalesced > 0 ||
+      (req->type == IOQUEUE_READ && isfiltered(req->handle));
+    req->pollres = 0;
+    req->opres = 0;
+
+    struct io_uring_sqe *sqe = uringgetsqe(ring);
+    uringpreppoll(sqe, req->handle->fd,
+                  req->type == IOQUEUE_READ ? POLLIN : POLLOUT);
+    sqe->user_data = ((uint64_t)index << 1) | 1;
+    if (req->pollonly) {
+      req->cqes = 1;
+      continue;
+    }
+
+    req->cqes = 2;
+    sqe->flags |= IOSQE_IO_LINK;
+    sqe = uringgetsqe(ring);
+    sqe->opcode = req->type == IOQUEUE_READ ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd = req->handle->fd;
+    sqe->addr = (uint64_t)(uintptr_t)req->buffer;
+    sqe->len = req->length > INT_MAX ? INT_MAX : (unsigned)req->length;
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = (uint64_t)index << 1;
+  }
+  queue->nqueued = 0;
+
+  // Entries not consumed by a previous call are submitted again.
+  unsigned pending = uringsqpublish(ring);
+  if (pending > 0) {
+    if (io_uring_enter(ring->fd, pending, 0, 0, NULL, 0) == -1) {
+      if (errno != EAGAIN && errno != EBUSY && errno != EINTR) return -1;
+    }
+  }
+  return submitted;
+}
+
+// A request gets all its completions from the kernel.
+static void uringfinish(struct serialioqueue *queue, int index)
+{
+  struct ioqueuerequest *req = &(queue->requests[index]);
+
+  if (req->pollonly) {
+    if (req->pollres < 0) {
+      setdone(queue, index, -1, -req->pollres);
+    } else if (req->type == IOQUEUE_WRITE || !doio(queue, index)) {
+      // Writes are submitted again, to first write the buffered data.
+      requeue(queue, index);
+    }
+    return;
+  }
+
+  if (req->opres > 0 || (req->opres == 0 && req->type == IOQUEUE_WRITE)) {
+    setdone(queue, index, req->opres, 0);
+  } else if (req->opres == 0) {
+    serial_seterror(req->handle, ERRMSG_SERIALREADEOF);
+    setdone(queue, index, -1, EIO);
+  } else if (req->opres == -EAGAIN || req->opres == -EINTR) {
+    requeue(queue, index);
+  } else if (req->opres == -ECANCELED && req->pollres < 0) {
+    setdone(queue, index, -1, -req->pollres);
+  } else {
+    serial_seterror(req->handle, req->type == IOQUEUE_READ ?
+                    ERRMSG_SERIALREAD : ERRMSG_SERIALWRITE);
+    setdone(queue, index, -1, -req->opres);
+  }
+}
+
+static void uringreap(struct serialioqueue *queue)
+{
+  struct ioqueueuring *ring = &(queue->ring);
+  unsigned head = *ring->cqhead;
+  unsigned tail = __atomic_load_n(ring->cqtail, __ATOMIC_ACQUIRE);
+
+  while (head != tail) {
+    struct io_uring_cqe *cqe = &(ring->cqes[head & *ring->cqmask]);
+    int index = (int)(cqe->user_data >> 1);
+    struct ioqueuerequest *req = &(queue->requests[index]);
+
+    if (cqe->user_data & 1) {
+      req->pollres = cqe->res;
+    } else {
+      req->opres = cqe->res;
+    }
+    if (--req->cqes == 0) uringfinish(queue, index);
+    head++;
+  }
+  __atomic_store_n(ring->cqhead, head, __ATOMIC_RELEASE);
+}
+
+static int uringcomplete(struct serialioqueue *queue,
+                         struct serialiocompletion *completions,
+                         int maxcompletions, int timeout,
+                         const struct timespec *deadline)
+{
+  struct ioqueueuring *ring = &(queue->ring);
+
+  while (1) {
+    if (uringsubmit(queue) == -1) return -1;
+    uringreap(queue);
+    if (queue->donecount > 0 || queue->nqueued > 0) {
+      // Requests that were requeued are submitted on the next iteration.
+      if (queue->donecount > 0) break;
+      continue;
+    }
+    if (queue->inflight == 0) break;
+
+    int ms = remaining(timeout, deadline);
+    if (ms == 0) break;
+
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (ms > 0) {
+      ts.tv_sec = ms / 1000;
+      ts.tv_nsec = (long)(ms % 1000) * NSEC_PER_MSEC;
+      arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+    if (io_uring_enter(ring->fd, 0, 1,
+                       IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                       &arg, sizeof(arg)) == -1) {
+      if (errno == EINTR) break;
+      if (errno != ETIME) return -1;
+    }
+  }
+
+  return takedone(queue, completions, maxcompletions);
+}
+#endif
+
+NSERIAL_EXPORT struct serialioqueue *WINAPI serial_ioqueue_init(int depth, serialioqueueflags_t flags)
+{
+  if (depth <= 0 || depth > IOQUEUEMAXDEPTH) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  struct serialioqueue *queue;
+  queue = malloc(sizeof(struct serialioqueue));
+  if (queue == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  memset(queue, 0, sizeof(struct serialioqueue));
+
+  queue->depth = depth;
+  queue->requests = calloc(depth, sizeof(struct ioqueuerequest));
+  queue->queued = calloc(depth, sizeof(int));
+  queue->done = calloc(depth, sizeof(int));
+  queue->fds = calloc(depth, sizeof(struct pollfd));
+  queue->fdrequest = calloc(depth, sizeof(int));
+  if (queue->requests == NULL || queue->queued == NULL ||
+      queue->done == NULL || queue->fds == NULL || queue->fdrequest == NULL) {
+    serial_ioqueue_terminate(queue);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+#ifdef HAVE_IO_URING
+  if (!(flags & IOQUEUE_NOURING)) {
+    queue->uring = uringinit(&(queue->ring), depth) == 0;
+  }
+#endif
+  return queue;
+}
+
+NSERIAL_EXPORT void WINAPI serial_ioqueue_terminate(struct serialioqueue *queue)
+{
+  if (queue == NULL) return;
+
+#ifdef HAVE_IO_URING
+  if (queue->uring) uringterminate(queue);
+#endif
+  if (queue->requests) free(queue->requests);
+  if (queue->queued) free(queue->queued);
+  if (queue->done) free(queue->done);
+  if (queue->fds) free(queue->fds);
+  if (queue->fdrequest) free(queue->fdrequest);
+  free(queue);
+}
+
+NSERIAL_EXPORT int WINAPI serial_ioqueue_isuring(struct serialioqueue *queue)
+{
+  if (queue == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  return queue->uring;
+}
+
+static int queuerequest(struct serialioqueue *queue, struct serialhandle *handle, serialiotype_t type, char *buffer, size_t length, void *userdata)
+{
+  if (queue == NULL || handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  if (buffer == NULL) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+
+  int isopen;
+  if (serial_isopen(handle, &isopen)) return -1;
+  if (!isopen) {
+    serial_seterror(handle, ERRMSG_SERIALPORTNOTOPEN);
+    errno = EIO;
+    return -1;
+  }
+
+  int index = 0;
+  while (index < queue->depth && queue->requests[index].state != IOREQ_FREE)
+    index++;
+  if (index == queue->depth) {
+    serial_seterror(handle, ERRMSG_IOQUEUEFULL);
+    errno = EAGAIN;
+    return -1;
+  }
+
+  struct ioqueuerequest *req = &(queue->requests[index]);
+  memset(req, 0, sizeof(struct ioqueuerequest));
+  req->handle = handle;
+  req->type = type;
+  req->buffer = buffer;
+  req->length = length;
+  req->userdata = userdata;
+
+  if (length == 0) {
+    // Like serial_read() and serial_write(), there's nothing to wait for.
+    setdone(queue, index, 0, 0);
+    return 0;
+  }
+
+  req->state = IOREQ_QUEUED;
+  queue->queued[queue->nqueued++] = index;
+  return 0;
+}
+
+NSERIAL_EXPORT int WINAPI serial_ioqueue_read(struct serialioqueue *queue, struct serialhandle *handle, char *buffer, size_t length, void *userdata)
+{
+  return queuerequest(queue, handle, IOQUEUE_READ, buffer, length, userdata);
+}
+
+NSERIAL_EXPORT int WINAPI serial_ioqueue_write(struct serialioqueue *queue, struct serialhandle *handle, const char *buffer, size_t length, void *userdata)
+{
+  return queuerequest(queue, handle, IOQUEUE_WRITE, (char *)buffer, length,
+                      userdata);
+}
+
+NSERIAL_EXPORT int WINAPI serial_ioqueue_submit(struct serialioqueue *queue)
+{
+  if (queue == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+#ifdef HAVE_IO_URING
+  if (queue->uring) return uringsubmit(queue);
+#endif
+  return pollsubmit(queue);
+}
+
+NSERIAL_EXPORT int WINAPI serial_ioqueue_complete(struct serialioqueue *queue, struct serialiocompletion *completions, int maxcompletions, int timeout)
+{
+  if (queue == NULL || completions == NULL || maxcompletions <= 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  // Requests completed by an earlier call are returned without waiting.
+  if (queue->donecount > 0) {
+    return takedone(queue, completions, maxcompletions);
+  }
+
+  struct timespec deadline;
+  struct timespec ts;
+  monotonictime(&deadline);
+  if (timeout > 0) addtimespec(&deadline, mstotimespec(timeout, &ts));
+
+#ifdef HAVE_IO_URING
+  if (queue->uring) {
+    return uringcomplete(queue, completions, maxcompletions, timeout,
+                         &deadline);
+  }
+#endif
+  return pollcomplete(queue, completions, maxcompletions, timeout, &deadline);
+}
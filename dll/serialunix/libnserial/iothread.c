@@ -0,0 +1,237 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : iothread.c
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : A thread owned by the library that services the serial port
+// and invokes the callbacks of the application.
+//
+// Every binding otherwise implements the same loop around
+// serial_waitforevent(), serial_read() and serial_write(). If callbacks are
+// set with serial_setcallbacks(), serial_open() starts a thread running this
+// loop. The data received is given to the application directly from the
+// buffer the data was read into, or if a receive ring is allocated, it's read
+// into the ring (see ring.c). Data to send is taken from the transmit ring,
+// which wakes up this thread when data is added.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define NSERIAL_EXPORTS
+#include "nserial.h"
+#include "serialhandle.h"
+#include "errmsg.h"
+#include "events.h"
+#include "iothread.h"
+#include "openserial.h"
+#include "ring.h"
+#include "buffer.h"
+#include "log.h"
+
+#define MODEMEVENT_ALL \
+  (MODEMEVENT_DCD | MODEMEVENT_RI | MODEMEVENT_DSR | MODEMEVENT_CTS)
+
+struct iothread {
+  struct serialhandle   *handle;
+  pthread_t              thread;
+  atomic_int             stop;          // The thread should stop
+  int                    detached;      // Closed by a callback, free on exit
+  char                  *buffer;        // Data is read into this buffer,
+                                        // NULL if read into the receive ring
+  size_t                 size;          // Size of the buffer
+};
+
+// Reports an error to the application. The error message is set for this
+// thread, so the callback can get it with serial_error().
+static void ioerror(struct serialhandle *handle, int posixerrno)
+{
+  if (handle->callbacks.error) {
+    handle->callbacks.error(handle, posixerrno, handle->callbackdata);
+  }
+}
+
+static void *iothreadmain(void *ptr)
+{
+  struct iothread *io = (struct iothread *)ptr;
+  struct serialhandle *handle = io->handle;
+  struct serialcallbacks *callbacks = &(handle->callbacks);
+  void *userdata = handle->callbackdata;
+
+  // If the modem signals can't be monitored, the error is reported once and
+  // we continue to service the data.
+  int watchmodem = callbacks->pinchanged != NULL;
+
+  while (!atomic_load(&(io->stop))) {
+    // A full receive ring is woken up by serial_ring_readcommit().
+    serialevent_t event = NOEVENT;
+    if (handle->rxring == NULL || ringspace(handle->rxring)) event |= READEVENT;
+    if (ringpending(handle->txring)) event |= WRITEEVENT;
+    if (watchmodem) event |= MODEMCHANGEEVENT | ERROREVENT;
+
+    serialevent_t gotevent = waitevent(handle, event, NULL);
+    if (atomic_load(&(io->stop))) break;
+    if ((int)gotevent == -1) {
+      nslog(handle, NSLOG_ERR, "iothread: wait failed: errno=%d", errno);
+      ioerror(handle, errno);
+      break;
+    }
+
+    if (gotevent & READEVENT) {
+      ssize_t readbytes = handle->rxring ?
+        ringfill(handle, handle->rxring) :
+        readdata(handle, io->buffer, io->size);
+      if (readbytes == -1) {
+        ioerror(handle, errno);
+        break;
+      }
+      if (readbytes > 0 && callbacks->datareceived) {
+        callbacks->datareceived(handle, io->buffer, readbytes, userdata);
+        if (atomic_load(&(io->stop))) break;
+      }
+    }
+
+    if (gotevent & WRITEEVENT) {
+      ssize_t writebytes = ringdrain(handle, handle->txring);
+      if (writebytes == -1) {
+        ioerror(handle, errno);
+        break;
+      }
+      if (writebytes > 0 && !ringpending(handle->txring) &&
+          callbacks->writedrained) {
+        callbacks->writedrained(handle, userdata);
+        if (atomic_load(&(io->stop))) break;
+      }
+    }
+
+    if (gotevent & (MODEMCHANGEEVENT | ERROREVENT)) {
+      serialmodemevent_t modemevent =
+        serial_timedwaitformodemevent(handle, MODEMEVENT_ALL, 0);
+      if (modemevent == MODEMEVENT_ERROR) {
+        nslog(handle, NSLOG_WARNING,
+              "iothread: modem signals not monitored: errno=%d", errno);
+        ioerror(handle, errno);
+        watchmodem = FALSE;
+      } else if (modemevent != MODEMEVENT_NONE) {
+        callbacks->pinchanged(handle, modemevent, userdata);
+      }
+    }
+  }
+
+  if (io->detached) {
+    bufferfree(io->buffer, io->size);
+    free(io);
+  }
+  return NULL;
+}
+
+int iothreadstart(struct serialhandle *handle)
+{
+  if (!handle->hascallbacks) return 0;
+
+  struct iothread *io = malloc(sizeof(struct iothread));
+  if (io == NULL) {
+    serial_seterror(handle, ERRMSG_OUTOFMEMORY);
+    errno = ENOMEM;
+    return -1;
+  }
+  io->handle = handle;
+  atomic_init(&(io->stop), FALSE);
+  io->detached = FALSE;
+  io->size = handle->buffersize;
+  io->buffer = NULL;
+  if (handle->rxring == NULL) {
+    io->buffer = bufferalloc(handle, io->size);
+    if (io->buffer == NULL) {
+      free(io);
+      return -1;
+    }
+  }
+
+  // The properties may enable filtering while the thread is already reading,
+  // so the temporary buffer is needed in any case. It's allocated before the
+  // thread starts, so it isn't allocated while another thread flushes it.
+  if (tmpbufferalloc(handle)) {
+    bufferfree(io->buffer, io->size);
+    free(io);
+    return -1;
+  }
+
+  int result = pthread_create(&(io->thread), NULL, iothreadmain, io);
+  if (result) {
+    nslog(handle, NSLOG_CRIT, "iothread: pthread_create: errno=%d", result);
+    bufferfree(io->buffer, io->size);
+    free(io);
+    serial_seterror(handle, ERRMSG_PTHREADCREATE);
+    errno = result;
+    return -1;
+  }
+
+  handle->iothread = io;
+  return 0;
+}
+
+void iothreadstop(struct serialhandle *handle)
+{
+  struct iothread *io = handle->iothread;
+  if (io == NULL) return;
+  handle->iothread = NULL;
+
+  atomic_store(&(io->stop), TRUE);
+  serial_abortwaitforevent(handle);
+
+  // When closing from a callback, we can't wait for ourselves. The thread
+  // stops when the callback returns, without accessing the serial port, and
+  // frees its resources.
+  if (pthread_equal(pthread_self(), io->thread)) {
+    io->detached = TRUE;
+    pthread_detach(io->thread);
+    return;
+  }
+
+  int result = pthread_join(io->thread, NULL);
+  if (result) {
+    nslog(handle, NSLOG_CRIT, "iothread: pthread_join: errno=%d", result);
+  }
+  bufferfree(io->buffer, io->size);
+  free(io);
+}
+
+NSERIAL_EXPORT int WINAPI serial_setcallbacks(struct serialhandle *handle, const struct serialcallbacks *callbacks, void *userdata)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  if (handle->fd != -1) {
+    serial_seterror(handle, ERRMSG_SERIALPORTALREADYOPEN);
+    errno = EIO;
+    return -1;
+  }
+
+  if (callbacks == NULL) {
+    memset(&(handle->callbacks), 0, sizeof(struct serialcallbacks));
+    handle->callbackdata = NULL;
+    handle->hascallbacks = FALSE;
+    return 0;
+  }
+
+  handle->callbacks = *callbacks;
+  handle->callbackdata = userdata;
+  handle->hascallbacks = TRUE;
+  return 0;
+}
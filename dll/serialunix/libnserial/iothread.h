@@ -0,0 +1,27 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : iothread.h
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Internal methods for the I/O thread owned by the library.
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifndef NSERIAL_IOTHREAD_H
+#define NSERIAL_IOTHREAD_H
+
+#include "nserial.h"
+
+// Starts the I/O thread if callbacks are set. Called when the serial port is
+// opened. Returns -1 on error.
+int iothreadstart(struct serialhandle *handle);
+
+// Stops the I/O thread, if it is running. Must be called before the file
+// descriptors of the handle are closed.
+void iothreadstop(struct serialhandle *handle);
+
+#endif
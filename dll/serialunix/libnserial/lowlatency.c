@@ -0,0 +1,205 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : lowlatency.c
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Reduces the latency of the driver before data is received.
+//
+// Drivers buffer received data before passing it on to the terminal. For a
+// UART, the flag ASYNC_LOW_LATENCY set with TIOCSSERIAL passes on the data
+// immediately. USB serial adapters (e.g. FTDI) wait for the latency timer,
+// which is 16ms by default, and is set in sysfs at
+// '/sys/dev/char/<major>:<minor>/device/latency_timer'.
+//
+// These settings remain after the serial port is closed, so the original
+// settings are restored when closing.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_SYSMACROS_H
+#include <sys/sysmacros.h>
+#endif
+#ifdef HAVE_TIOCSSERIAL
+#include <linux/serial.h>
+#endif
+
+#define NSERIAL_EXPORTS
+#include "nserial.h"
+#include "serialhandle.h"
+#include "errmsg.h"
+#include "lowlatency.h"
+#include "log.h"
+
+// The latency timer in milliseconds when low latency is enabled.
+#define LATENCYTIMERLOW 1
+
+#ifdef HAVE_TIOCSSERIAL
+// Sets or clears ASYNC_LOW_LATENCY. Returns -1 on error.
+static int setasynclowlatency(struct serialhandle *handle, int lowlatency)
+{
+  struct serial_struct serial;
+  if (ioctl(handle->fd, TIOCGSERIAL, &serial) < 0) return -1;
+
+  if (lowlatency) {
+    serial.flags |= ASYNC_LOW_LATENCY;
+  } else {
+    serial.flags &= ~ASYNC_LOW_LATENCY;
+  }
+  return ioctl(handle->fd, TIOCSSERIAL, &serial);
+}
+
+// Gets if ASYNC_LOW_LATENCY is set. Returns -1 on error.
+static int getasynclowlatency(struct serialhandle *handle)
+{
+  struct serial_struct serial;
+  if (ioctl(handle->fd, TIOCGSERIAL, &serial) < 0) return -1;
+  return (serial.flags & ASYNC_LOW_LATENCY) != 0;
+}
+#endif
+
+#ifdef HAVE_SYS_SYSMACROS_H
+// Gets the path of the latency timer of the driver in sysfs.
+static int latencytimerpath(struct serialhandle *handle, char *path, size_t length)
+{
+  struct stat sb;
+  if (fstat(handle->fd, &sb) < 0 || !S_ISCHR(sb.st_mode)) return -1;
+
+  int len = snprintf(path, length, "/sys/dev/char/%u:%u/device/latency_timer",
+                     major(sb.st_rdev), minor(sb.st_rdev));
+  if (len < 0 || (size_t)len >= length) return -1;
+  return 0;
+}
+#else
+// There is no sysfs latency timer without major() and minor().
+static int latencytimerpath(struct serialhandle *handle, char *path, size_t length)
+{
+  return -1;
+}
+#endif
+
+// Reads the latency timer in milliseconds. Returns -1 on error.
+static int getlatencytimer(const char *path)
+{
+  FILE *file = fopen(path, "r");
+  if (file == NULL) return -1;
+
+  int timer;
+  int result = fscanf(file, "%d", &timer);
+  fclose(file);
+  return result == 1 ? timer : -1;
+}
+
+// Writes the latency timer in milliseconds. Returns -1 on error.
+static int setlatencytimer(const char *path, int timer)
+{
+  int fd = open(path, O_WRONLY);
+  if (fd == -1) return -1;
+
+  char value[16];
+  int len = snprintf(value, sizeof(value), "%d\n", timer);
+  int result = write(fd, value, len) == len ? 0 : -1;
+  close(fd);
+  return result;
+}
+
+void lowlatencyapply(struct serialhandle *handle)
+{
+  if (!handle->lowlatency) {
+    lowlatencyrestore(handle);
+    return;
+  }
+
+#ifdef HAVE_TIOCSSERIAL
+  if (!(handle->lowlatencyapplied & LOWLATENCY_ASYNC)) {
+    int async = getasynclowlatency(handle);
+    if (async != -1 && setasynclowlatency(handle, TRUE) == 0) {
+      handle->lowlatencyasync = async;
+      handle->lowlatencyapplied |= LOWLATENCY_ASYNC;
+    } else {
+      nslog(handle, NSLOG_INFO,
+            "lowlatency: ASYNC_LOW_LATENCY not set: errno=%d", errno);
+    }
+  }
+#endif
+
+  char path[PATH_MAX];
+  if (!(handle->lowlatencyapplied & LOWLATENCY_TIMER) &&
+      latencytimerpath(handle, path, sizeof(path)) == 0) {
+    int timer = getlatencytimer(path);
+    if (timer != -1 &&
+        (timer <= LATENCYTIMERLOW ||
+         setlatencytimer(path, LATENCYTIMERLOW) == 0)) {
+      handle->lowlatencytimer = timer;
+      handle->lowlatencyapplied |= LOWLATENCY_TIMER;
+    } else {
+      nslog(handle, NSLOG_INFO,
+            "lowlatency: latency timer not set: %s: errno=%d", path, errno);
+    }
+  }
+}
+
+void lowlatencyrestore(struct serialhandle *handle)
+{
+#ifdef HAVE_TIOCSSERIAL
+  if (handle->lowlatencyapplied & LOWLATENCY_ASYNC) {
+    if (!handle->lowlatencyasync) setasynclowlatency(handle, FALSE);
+  }
+#endif
+
+  char path[PATH_MAX];
+  if ((handle->lowlatencyapplied & LOWLATENCY_TIMER) &&
+      handle->lowlatencytimer > LATENCYTIMERLOW &&
+      latencytimerpath(handle, path, sizeof(path)) == 0) {
+    setlatencytimer(path, handle->lowlatencytimer);
+  }
+
+  handle->lowlatencyapplied = LOWLATENCY_NONE;
+}
+
+NSERIAL_EXPORT int WINAPI serial_setlowlatency(struct serialhandle *handle, int lowlatency)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  handle->lowlatency = lowlatency ? TRUE : FALSE;
+  return 0;
+}
+
+NSERIAL_EXPORT int WINAPI serial_getlowlatency(struct serialhandle *handle, int *lowlatency)
+{
+  if (handle == NULL || lowlatency == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  *lowlatency = handle->lowlatency;
+  return 0;
+}
+
+NSERIAL_EXPORT int WINAPI serial_getlowlatencyapplied(struct serialhandle *handle, seriallowlatency_t *applied)
+{
+  if (handle == NULL || applied == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  *applied = handle->lowlatencyapplied;
+  return 0;
+}
@@ -0,0 +1,28 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : lowlatency.h
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Internal methods to reduce the latency of the driver.
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifndef NSERIAL_LOWLATENCY_H
+#define NSERIAL_LOWLATENCY_H
+
+#include "nserial.h"
+
+// Enables or disables the low latency settings of the driver, as set by
+// serial_setlowlatency(). Called when the properties are set. Settings that
+// can't be applied are ignored.
+void lowlatencyapply(struct serialhandle *handle);
+
+// Restores the settings of the driver changed by lowlatencyapply(). Called
+// before the serial port is closed.
+void lowlatencyrestore(struct serialhandle *handle);
+
+#endif
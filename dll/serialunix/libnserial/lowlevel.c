@@ -17,6 +17,9 @@
 #include <termios.h>
 #include <sys/ioctl.h>
 #include <errno.h>
+#ifdef HAVE_LINUX_SERIAL_ICOUNTER_STRUCT
+#include <linux/serial.h>
+#endif
 
 #define NSERIAL_EXPORTS
 #include "nserial.h"
@@ -85,6 +88,83 @@ NSERIAL_EXPORT int WINAPI serial_getwritebytes(struct serialhandle *handle, int
 #endif
 }
 
+NSERIAL_EXPORT int WINAPI serial_geticount(struct serialhandle *handle, struct serialicount *icount)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (icount == NULL) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+
+#if defined(HAVE_LINUX_SERIAL_ICOUNTER_STRUCT) && defined(HAVE_TERMIOS_TIOCGICOUNT)
+  if (handle->fd == -1) {
+    serial_seterror(handle, ERRMSG_SERIALPORTNOTOPEN);
+    errno = EBADF;
+    return -1;
+  }
+
+  struct serial_icounter_struct counter = {0, };
+  if (ioctl(handle->fd, TIOCGICOUNT, &counter) < 0) {
+    serial_seterror(handle, ERRMSG_IOCTL_ICOUNTER);
+    return -1;
+  }
+
+  icount->cts = counter.cts;
+  icount->dsr = counter.dsr;
+  icount->rng = counter.rng;
+  icount->dcd = counter.dcd;
+  icount->rx = counter.rx;
+  icount->tx = counter.tx;
+  icount->frame = counter.frame;
+  icount->overrun = counter.overrun;
+  icount->parity = counter.parity;
+  icount->brk = counter.brk;
+  icount->bufoverrun = counter.buf_overrun;
+  return 0;
+#else
+  serial_seterror(handle, ERRMSG_NOSYS);
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+NSERIAL_EXPORT int WINAPI serial_geticountdelta(struct serialhandle *handle, struct serialicount *last, struct serialicount *delta)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (last == NULL || delta == NULL) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+
+  struct serialicount icount;
+  if (serial_geticount(handle, &icount)) return -1;
+
+  // Unsigned arithmetic gives the correct difference if a counter wraps.
+  delta->cts = icount.cts - last->cts;
+  delta->dsr = icount.dsr - last->dsr;
+  delta->rng = icount.rng - last->rng;
+  delta->dcd = icount.dcd - last->dcd;
+  delta->rx = icount.rx - last->rx;
+  delta->tx = icount.tx - last->tx;
+  delta->frame = icount.frame - last->frame;
+  delta->overrun = icount.overrun - last->overrun;
+  delta->parity = icount.parity - last->parity;
+  delta->brk = icount.brk - last->brk;
+  delta->bufoverrun = icount.bufoverrun - last->bufoverrun;
+  *last = icount;
+  return 0;
+}
+
 static int serial_discardbuffer(struct serialhandle *handle, int inout)
 {
   if (handle == NULL) {
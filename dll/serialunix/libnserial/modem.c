@@ -14,9 +14,13 @@
 
 #include "config.h"
 
+#include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
-#include <semaphore.h>
+#include <stdatomic.h>
 #include <termios.h>
+#include <poll.h>
+#include <unistd.h>
 #include <sys/ioctl.h>
 #include <errno.h>
 #ifdef HAVE_LINUX_SERIAL_ICOUNTER_STRUCT
@@ -29,6 +33,8 @@
 #include "log.h"
 #include "serialhandle.h"
 #include "modem.h"
+#include "timeutil.h"
+#include "wakeup.h"
 
 static int getmodemsignal(int fd, int signal, int *outsignal)
 {
@@ -256,173 +262,351 @@ NSERIAL_EXPORT int WINAPI serial_getrts(struct serialhandle *handle, int *rts)
   return 0;
 }
 
-#ifdef HAVE_LINUX_SERIAL_ICOUNTER_STRUCT
-// Please note, that this method by be aborted at any time with
-// "pthread_cancel" and the thread is set to be PTHREAD_CANCEL_ASYNCHRONOUS.
-// This means, it must by async cancel safe. You cannot allocate heap, or
-// call functions that are not async cancel safe.
-//
-// The only exception is "ioctl" as it appears that this is not implemented
-// to be a cancellation point in Linux.
-static serialmodemevent_t waitformodemevent(struct modemstate *mstate)
+static int entercritsection(struct serialhandle *handle)
 {
-  int icount;
-  int signals = 0;
-  if (mstate->waitevent & MODEMEVENT_DCD) signals |= TIOCM_CAR;
-  if (mstate->waitevent & MODEMEVENT_RI) signals |= TIOCM_RI;
-  if (mstate->waitevent & MODEMEVENT_DSR) signals |= TIOCM_DSR;
-  if (mstate->waitevent & MODEMEVENT_CTS) signals |= TIOCM_CTS;
-
-  struct serial_icounter_struct icounter = {0, };
-  if (ioctl(mstate->handle->fd, TIOCGICOUNT, &icounter) < 0) {
-    // Not all serial port drivers support TIOCGICOUNT.
-    //
-    // If we get an error here, we assume that it's not supported and
-    // we check the signals, which is a little less reliable.
-
-    icount = FALSE;
-  } else {
-    icount = TRUE;
-  }
-
-  int ctssignal = -1;
-  int dsrsignal = -1;
-  int risignal = -1;
-  int dcdsignal = -1;
-  if ((mstate->waitevent & MODEMEVENT_CTS) &&
-      getmodemsignal(mstate->handle->fd, TIOCM_CTS, &ctssignal) == -1)
-    ctssignal = -1;
-  if ((mstate->waitevent & MODEMEVENT_DSR) &&
-      getmodemsignal(mstate->handle->fd, TIOCM_DSR, &dsrsignal) == -1)
-    dsrsignal = -1;
-  if ((mstate->waitevent & MODEMEVENT_DCD) &&
-      getmodemsignal(mstate->handle->fd, TIOCM_CAR, &dcdsignal) == -1)
-    dcdsignal = -1;
-  if ((mstate->waitevent & MODEMEVENT_RI) &&
-      getmodemsignal(mstate->handle->fd, TIOCM_RI, &risignal) == -1)
-    risignal = -1;
-
-  if (ioctl(mstate->handle->fd, TIOCMIWAIT, signals) < 0) {
-    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
-      return MODEMEVENT_NONE;
-    }
+  int result;
+  result = pthread_mutex_lock(&(handle->modemmutex));
+  if (result) {
+    nslog(handle, NSLOG_CRIT,
+	  "modem: lock mutex failed: errno=%d", result);
+    errno = result;
+    serial_seterror(handle, ERRMSG_MUTEXLOCK);
+    return -1;
+  }
+  return 0;
+}
 
-    // Some USB drivers don't support modem signals.
-    mstate->serialerror = ERRMSG_IOCTL;
-    mstate->posixerrno = errno;
-    return MODEMEVENT_ERROR;
+static int exitcritsection(struct serialhandle *handle)
+{
+  int result;
+  result = pthread_mutex_unlock(&(handle->modemmutex));
+  if (result) {
+    nslog(handle, NSLOG_CRIT,
+	  "modem: unlock mutex failed: errno=%d", result);
+    errno = result;
+    serial_seterror(handle, ERRMSG_MUTEXUNLOCK);
+    return -1;
   }
+  return 0;
+}
 
-  struct serial_icounter_struct ocounter = {0, };
-  if (icount && ioctl(mstate->handle->fd, TIOCGICOUNT, &ocounter) < 0) {
-    icount = FALSE;
+#ifdef HAVE_TIOCMIWAIT
+// Number of transitions queued by the monitor thread. Must be a power of 2.
+#define MODEMRINGSIZE 64
+
+#define MODEMEVENT_ALL \
+  (MODEMEVENT_DCD | MODEMEVENT_RI | MODEMEVENT_DSR | MODEMEVENT_CTS)
+
+struct modemtransition {
+  serialmodemevent_t event;             // Lines that changed
+};
+
+// The monitor thread is the only producer of the ring, and the thread in
+// serial_timedwaitformodemevent() the only consumer. The head and tail are
+// on their own cache lines, so the two threads don't contend.
+struct modemmonitor {
+  struct serialhandle   *handle;
+  int                    fd;            // The serial port being monitored
+  pthread_t              thread;        // The monitor thread
+  struct wakeupfd        wakeup;        // Signalled for transitions or abort
+  atomic_int             signalled;     // wakeup is signalled, not cleared
+  atomic_int             waiting;       // A thread is waiting for events
+  pthread_cond_t         idle;          // Signalled when waiting is cleared
+  atomic_int             abort;         // Abort the waiting thread
+  atomic_int             overflow;      // Events not queued, ring was full
+  atomic_int             stopped;       // Thread stopped due to an error
+  atomic_int             reported;      // The error was returned by a wait
+  serialerrmsg_t         serialerror;   // Error when stopped
+  int                    posixerrno;    // errno when stopped
+  int                    held;          // Events consumed, but not waited for
+  _Alignas(64) atomic_uint head;        // Next transition to consume
+  _Alignas(64) atomic_uint tail;        // Next transition to produce
+  struct modemtransition ring[MODEMRINGSIZE];
+};
+
+static serialmodemevent_t getmodemevents(int serial)
+{
+  int events = MODEMEVENT_NONE;
+  if (serial & TIOCM_CAR) events |= MODEMEVENT_DCD;
+  if (serial & TIOCM_RI) events |= MODEMEVENT_RI;
+  if (serial & TIOCM_DSR) events |= MODEMEVENT_DSR;
+  if (serial & TIOCM_CTS) events |= MODEMEVENT_CTS;
+  return (serialmodemevent_t)events;
+}
+
+// Wakes up the waiting thread. Like serial_abortwaitforevent(), only the
+// first notification signals the file descriptor until the waiting thread
+// clears it.
+static void modemnotify(struct modemmonitor *monitor)
+{
+  if (atomic_exchange(&(monitor->signalled), TRUE)) return;
+  if (wakeupsignal(&(monitor->wakeup)) == -1) {
+    atomic_store(&(monitor->signalled), FALSE);
   }
+}
 
-  // TODO: Do we just raise an event in case on from zero to one?
-  //  CTS 0->1 and 1->0.
-  //  DSR 0->1 and 1->0.
-  //  DCD 0->1 and 1->0.
-  //  RI  0->1 only.
-  int rsignals = MODEMEVENT_NONE;
-  if (icount) {
-    if (ocounter.cts != icounter.cts) rsignals |= MODEMEVENT_CTS;
-    if (ocounter.dsr != icounter.dsr) rsignals |= MODEMEVENT_DSR;
-    if (ocounter.rng != icounter.rng) rsignals |= MODEMEVENT_RI;
-    if (ocounter.dcd != icounter.dcd) rsignals |= MODEMEVENT_DCD;
+static void modempush(struct modemmonitor *monitor, serialmodemevent_t event)
+{
+  unsigned int tail =
+    atomic_load_explicit(&(monitor->tail), memory_order_relaxed);
+  unsigned int head =
+    atomic_load_explicit(&(monitor->head), memory_order_acquire);
+
+  if (tail - head == MODEMRINGSIZE) {
+    // The ring is full. Don't lose the event, it's returned with the next
+    // events that are consumed.
+    atomic_fetch_or(&(monitor->overflow), event);
   } else {
-    int rctssignal = -1;
-    int rdsrsignal = -1;
-    int rrisignal = -1;
-    int rdcdsignal = -1;
-    if (ctssignal != -1 &&
-	getmodemsignal(mstate->handle->fd, TIOCM_CTS, &rctssignal) == -1)
-      rctssignal = -1;
-    if (dsrsignal != -1 &&
-	getmodemsignal(mstate->handle->fd, TIOCM_DSR, &rdsrsignal) == -1)
-      rdsrsignal = -1;
-    if (dcdsignal != -1 &&
-	getmodemsignal(mstate->handle->fd, TIOCM_CAR, &rdcdsignal) == -1)
-      rdcdsignal = -1;
-    if (risignal != -1 &&
-	getmodemsignal(mstate->handle->fd, TIOCM_RI, &rrisignal) == -1)
-      rrisignal = -1;
-
-    if (rctssignal != -1 && ctssignal != -1)
-      rsignals |= (rctssignal != ctssignal) ? MODEMEVENT_CTS : MODEMEVENT_NONE;
-    if (rdsrsignal != -1 && dsrsignal != -1)
-      rsignals |= (rdsrsignal != dsrsignal) ? MODEMEVENT_DSR : MODEMEVENT_NONE;
-    if (rdcdsignal != -1 && dcdsignal != -1)
-      rsignals |= (rdcdsignal != dcdsignal) ? MODEMEVENT_DCD : MODEMEVENT_NONE;
-    if (rrisignal != -1 && risignal != -1)
-      rsignals |= (rrisignal != risignal) ? MODEMEVENT_RI : MODEMEVENT_NONE;
-  }
-
-  return (serialmodemevent_t)(rsignals & mstate->waitevent);
+    monitor->ring[tail & (MODEMRINGSIZE - 1)].event = event;
+    atomic_store_explicit(&(monitor->tail), tail + 1, memory_order_release);
+  }
+  modemnotify(monitor);
 }
 
-static void *modemeventthread(void *ptr)
+// Consumes all queued transitions, returning the events that are in mask.
+// Events for other lines are held, until a wait for them consumes them.
+static serialmodemevent_t modempop(struct modemmonitor *monitor,
+                                   serialmodemevent_t mask)
 {
-  struct modemstate *mstate = (struct modemstate *)ptr;
-  serialmodemevent_t result;
+  unsigned int head =
+    atomic_load_explicit(&(monitor->head), memory_order_relaxed);
+  unsigned int tail =
+    atomic_load_explicit(&(monitor->tail), memory_order_acquire);
 
-  // The IOCTL blocks until there is a change or a signal. There's no other
-  // way to get out if you don't want a signal! So we have to ensure that we
-  // can cancel the thread at any time and be careful about it.
-  int oldstate, oldtype;
-  pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &oldstate);
-  pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, &oldtype);
-
-  int wait = TRUE;
-  while (wait) {
-    result = waitformodemevent(mstate);
-    if (result == -1) {
-      // We have a serious issue. We stop the thread. The error
-      // was already set by waitformodemevent.
-      mstate->eventresult = MODEMEVENT_NONE;
-      wait = FALSE;
+  int events = monitor->held;
+  while (head != tail) {
+    events |= monitor->ring[head & (MODEMRINGSIZE - 1)].event;
+    head++;
+  }
+  atomic_store_explicit(&(monitor->head), head, memory_order_release);
+
+  events |= atomic_exchange(&(monitor->overflow), 0);
+  monitor->held = events & ~mask;
+  return (serialmodemevent_t)(events & mask);
+}
+
+// Runs from the first call to serial_timedwaitformodemevent() until the
+// serial port is closed, so that no transitions are lost between calls.
+static void *modemmonitorthread(void *ptr)
+{
+  struct modemmonitor *monitor = (struct modemmonitor *)ptr;
+  int fd = monitor->fd;
+
+  // Not all serial port drivers support TIOCGICOUNT. If we get an error
+  // here, we assume that it's not supported and we compare the signals,
+  // which is less reliable, as a pulse may be missed.
+  struct serial_icounter_struct lastcount = {0, };
+  int icount = ioctl(fd, TIOCGICOUNT, &lastcount) == 0;
+
+  int serial;
+  int laststate = 0;
+  if (ioctl(fd, TIOCMGET, &serial) == 0) laststate = serial;
+
+  while (TRUE) {
+    // The ioctl() blocks until there is a change or a signal. There's no
+    // other way to get out if you don't want a signal! So only while we're
+    // in the ioctl(), the thread can be cancelled at any time. The ioctl()
+    // is not a cancellation point in Linux.
+    int oldtype;
+    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, &oldtype);
+    int result = ioctl(fd, TIOCMIWAIT,
+                       TIOCM_CAR | TIOCM_RI | TIOCM_DSR | TIOCM_CTS);
+    pthread_setcanceltype(oldtype, &oldtype);
+
+    if (result < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        continue;
+      }
+
+      // Some USB drivers don't support modem signals.
+      monitor->serialerror = ERRMSG_IOCTL;
+      monitor->posixerrno = errno;
+      atomic_store(&(monitor->stopped), TRUE);
+      modemnotify(monitor);
+      return NULL;
     }
-    if (result != MODEMEVENT_NONE) {
-      mstate->eventresult = result;
-      wait = FALSE;
+
+    int state = laststate;
+    if (ioctl(fd, TIOCMGET, &serial) == 0) state = serial;
+
+    // TODO: Do we just raise an event in case on from zero to one?
+    //  CTS 0->1 and 1->0.
+    //  DSR 0->1 and 1->0.
+    //  DCD 0->1 and 1->0.
+    //  RI  0->1 only.
+    int events = MODEMEVENT_NONE;
+    struct serial_icounter_struct count = {0, };
+    if (icount && ioctl(fd, TIOCGICOUNT, &count) < 0) {
+      icount = FALSE;
+    }
+    if (icount) {
+      if (count.cts != lastcount.cts) events |= MODEMEVENT_CTS;
+      if (count.dsr != lastcount.dsr) events |= MODEMEVENT_DSR;
+      if (count.rng != lastcount.rng) events |= MODEMEVENT_RI;
+      if (count.dcd != lastcount.dcd) events |= MODEMEVENT_DCD;
+      lastcount = count;
+    } else {
+      events = getmodemevents(state ^ laststate);
     }
+    laststate = state;
 
-    // else we just keep polling.
+    if (events != MODEMEVENT_NONE) {
+      modempush(monitor, (serialmodemevent_t)events);
+    }
   }
-
-  sem_post(&(mstate->modemevent));
-  pthread_exit(NULL);
 }
-#endif
 
-static int entercritsection(struct serialhandle *handle)
+// Starts the monitor thread if it isn't already running. Must be called with
+// the modemmutex locked.
+static struct modemmonitor *modemmonitorstart(struct serialhandle *handle)
 {
-  int result;
-  result = pthread_mutex_lock(&(handle->modemmutex));
+  if (handle->modemmonitor) return handle->modemmonitor;
+
+  struct modemmonitor *monitor;
+  if (posix_memalign((void **)&monitor, 64, sizeof(struct modemmonitor))) {
+    serial_seterror(handle, ERRMSG_OUTOFMEMORY);
+    errno = ENOMEM;
+    return NULL;
+  }
+  memset(monitor, 0, sizeof(struct modemmonitor));
+  monitor->handle = handle;
+  monitor->fd = handle->fd;
+  atomic_init(&(monitor->signalled), FALSE);
+  atomic_init(&(monitor->waiting), FALSE);
+  atomic_init(&(monitor->abort), FALSE);
+  atomic_init(&(monitor->overflow), 0);
+  atomic_init(&(monitor->stopped), FALSE);
+  atomic_init(&(monitor->reported), FALSE);
+  atomic_init(&(monitor->head), 0);
+  atomic_init(&(monitor->tail), 0);
+
+  if (wakeupopen(handle, &(monitor->wakeup)) == -1) {
+    free(monitor);
+    return NULL;
+  }
+
+  int result = pthread_cond_init(&(monitor->idle), NULL);
+  if (result) {
+    wakeupclose(&(monitor->wakeup));
+    free(monitor);
+    serial_seterror(handle, ERRMSG_OUTOFMEMORY);
+    errno = result;
+    return NULL;
+  }
+
+  result = pthread_create(&(monitor->thread), NULL,
+                          modemmonitorthread, monitor);
   if (result) {
     nslog(handle, NSLOG_CRIT,
-	  "modem: lock mutex failed: errno=%d", result);
+          "waitformodemevent: pthread_create: errno=%d", result);
+    pthread_cond_destroy(&(monitor->idle));
+    wakeupclose(&(monitor->wakeup));
+    free(monitor);
+    serial_seterror(handle, ERRMSG_PTHREADCREATE);
     errno = result;
-    serial_seterror(handle, ERRMSG_MUTEXLOCK);
+    return NULL;
+  }
+
+  handle->modemmonitor = monitor;
+  return monitor;
+}
+#endif
+
+int modemmonitorfd(struct serialhandle *handle)
+{
+#ifdef HAVE_TIOCMIWAIT
+  if (entercritsection(handle)) return -1;
+  struct modemmonitor *monitor = modemmonitorstart(handle);
+  if (monitor == NULL) {
+    exitcritsection(handle);
     return -1;
   }
-  return 0;
+  if (exitcritsection(handle)) return -1;
+  return monitor->wakeup.rfd;
+#else
+  serial_seterror(handle, ERRMSG_NOSYS);
+  errno = ENOSYS;
+  return -1;
+#endif
 }
 
-static int exitcritsection(struct serialhandle *handle)
+serialevent_t modemmonitorpending(struct serialhandle *handle)
 {
-  int result;
-  result = pthread_mutex_unlock(&(handle->modemmutex));
+#ifdef HAVE_TIOCMIWAIT
+  struct modemmonitor *monitor = handle->modemmonitor;
+  if (monitor == NULL) return NOEVENT;
+
+  int event = NOEVENT;
+  if (atomic_load_explicit(&(monitor->tail), memory_order_acquire) !=
+      atomic_load_explicit(&(monitor->head), memory_order_relaxed) ||
+      atomic_load(&(monitor->overflow))) {
+    event |= MODEMCHANGEEVENT;
+  }
+  // The error of the monitor is reported until a wait for modem events
+  // returns it, else waiting for errors would never block again.
+  if (atomic_load(&(monitor->stopped)) && !atomic_load(&(monitor->reported)))
+    event |= ERROREVENT;
+  return (serialevent_t)event;
+#else
+  return NOEVENT;
+#endif
+}
+
+void modemmonitorclear(struct serialhandle *handle)
+{
+#ifdef HAVE_TIOCMIWAIT
+  struct modemmonitor *monitor = handle->modemmonitor;
+  if (monitor == NULL) return;
+
+  wakeupclear(&(monitor->wakeup));
+  atomic_exchange(&(monitor->signalled), FALSE);
+#endif
+}
+
+void modemmonitorstop(struct serialhandle *handle)
+{
+#ifdef HAVE_TIOCMIWAIT
+  if (entercritsection(handle)) return;
+
+  struct modemmonitor *monitor = handle->modemmonitor;
+  if (monitor == NULL) {
+    exitcritsection(handle);
+    return;
+  }
+  handle->modemmonitor = NULL;
+
+  // A thread still waiting must leave before the monitor is freed. It
+  // clears waiting with the mutex locked, which is released while we wait.
+  atomic_store(&(monitor->abort), TRUE);
+  modemnotify(monitor);
+  while (atomic_load(&(monitor->waiting))) {
+    pthread_cond_wait(&(monitor->idle), &(handle->modemmutex));
+  }
+
+  int result = pthread_cancel(monitor->thread);
+  if (result && result != ESRCH) {
+    nslog(handle, NSLOG_CRIT,
+          "modemmonitorstop: pthread_cancel: errno=%d", result);
+  }
+  result = pthread_join(monitor->thread, NULL);
   if (result) {
     nslog(handle, NSLOG_CRIT,
-	  "modem: unlock mutex failed: errno=%d", result);
-    errno = result;
-    serial_seterror(handle, ERRMSG_MUTEXUNLOCK);
-    return -1;
+          "modemmonitorstop: pthread_join: errno=%d", result);
   }
-  return 0;
+  exitcritsection(handle);
+
+  pthread_cond_destroy(&(monitor->idle));
+  wakeupclose(&(monitor->wakeup));
+  free(monitor);
+#endif
 }
 
 NSERIAL_EXPORT serialmodemevent_t WINAPI serial_waitformodemevent(struct serialhandle *handle, serialmodemevent_t event)
+{
+  return serial_timedwaitformodemevent(handle, event, -1);
+}
+
+NSERIAL_EXPORT serialmodemevent_t WINAPI serial_timedwaitformodemevent(struct serialhandle *handle, serialmodemevent_t event, int timeout)
 {
   if (handle == NULL) {
     errno = EINVAL;
@@ -430,119 +614,94 @@ NSERIAL_EXPORT serialmodemevent_t WINAPI serial_waitformodemevent(struct serialh
   }
 
 #ifdef HAVE_TIOCMIWAIT
+  serial_seterror(handle, ERRMSG_OK);
+
   if (handle->fd == -1) {
     serial_seterror(handle, ERRMSG_SERIALPORTNOTOPEN);
     errno = EBADF;
     return MODEMEVENT_ERROR;
   }
 
-  if (entercritsection(handle)) return MODEMEVENT_ERROR;
+  if ((event & MODEMEVENT_ALL) == 0) return MODEMEVENT_NONE;
 
-  if (handle->modemstate) {
+  if (entercritsection(handle)) return MODEMEVENT_ERROR;
+  struct modemmonitor *monitor = modemmonitorstart(handle);
+  if (monitor == NULL) {
     exitcritsection(handle);
-    nslog(handle, NSLOG_WARNING, "waitformodemevent: already running");
-    serial_seterror(handle, ERRMSG_MODEMEVENT_RUNNING);
-    errno = EINVAL;
     return MODEMEVENT_ERROR;
   }
 
-  if ((event &
-       (MODEMEVENT_DCD | MODEMEVENT_RI |
-	MODEMEVENT_DSR | MODEMEVENT_CTS)) == 0) {
-    if (exitcritsection(handle)) return MODEMEVENT_ERROR;
-    return MODEMEVENT_NONE;
-  }
-
-  int result;
-
-  struct modemstate mstate = {0, };
-  mstate.handle = handle;
-  mstate.waitevent = event;
-  if (sem_init(&(mstate.modemevent), 0, 0) == -1) {
-    nslog(handle, NSLOG_CRIT,
-	  "waitformodemevent: seminit(modemevent): errno=%d", errno);
+  if (atomic_exchange(&(monitor->waiting), TRUE)) {
     exitcritsection(handle);
-    serial_seterror(handle, ERRMSG_SEMINIT);
+    nslog(handle, NSLOG_WARNING, "waitformodemevent: already running");
+    serial_seterror(handle, ERRMSG_MODEMEVENT_RUNNING);
+    errno = EINVAL;
     return MODEMEVENT_ERROR;
   }
-  handle->modemstate = &mstate;
+  // An abort before we started waiting is ignored.
+  atomic_store(&(monitor->abort), FALSE);
   if (exitcritsection(handle)) {
-    handle->modemstate = NULL;
-    sem_destroy(&(mstate.modemevent));
+    atomic_store(&(monitor->waiting), FALSE);
     return MODEMEVENT_ERROR;
   }
 
-  // We create the thread to wait on it afterwards, as we can
-  // make that thread cancellable.
-  result = pthread_create(&(handle->modemthread), NULL,
-			  modemeventthread, &mstate);
-  if (result) {
-    nslog(handle, NSLOG_CRIT,
-	  "waitformodemevent: pthread_create: errno=%d", result);
-    errno = result;
-  }
+  struct timespec deadline;
+  struct timespec ts;
+  monotonictime(&deadline);
+  if (timeout > 0) addtimespec(&deadline, mstotimespec(timeout, &ts));
 
-  // Wait for an abort, or that the thread is closed
-  if (!result) {
-    int wait = TRUE;
-    int semresult;
-    while (wait) {
-      semresult = sem_wait(&(mstate.modemevent));
-      if (semresult) {
-	if (errno == EINTR) {
-	  // Just an interrupt, we continue the loop
-	  semresult = 0;
-	} else {
-	  nslog(handle, NSLOG_CRIT,
-		"waitformodemevent: sem_wait: errno=%d", errno);
-	  wait = FALSE;
-	  result = -1;
-	}
-      } else {
-	if (mstate.modemeventabort) {
-	  result = pthread_cancel(handle->modemthread);
-	}
-	wait = FALSE;
-      }
-    }
-  }
+  serialmodemevent_t result;
+  while (TRUE) {
+    // Clear the notification before consuming the transitions, so that a
+    // transition queued afterwards wakes up the poll().
+    wakeupclear(&(monitor->wakeup));
+    atomic_exchange(&(monitor->signalled), FALSE);
 
-  if (!result) {
-    result = pthread_join(handle->modemthread, NULL);
-    if (result) {
-      nslog(handle, NSLOG_CRIT,
-	    "waitformodemevent: pthread_join: errno=%d", result);
-      errno = result;
-    }
-  }
+    result = modempop(monitor, event);
+    if (result != MODEMEVENT_NONE) break;
 
-  if (!result) {
-    if (mstate.serialerror != 0) {
+    if (atomic_load(&(monitor->stopped))) {
       nslog(handle, NSLOG_CRIT,
-	    "waitformodemevent: error in modemeventthread: errno=%d",
-	    mstate.posixerrno);
-      errno = mstate.posixerrno;
-      serial_seterror(handle, mstate.serialerror);
-      result = -1;
+            "waitformodemevent: error in modem monitor: errno=%d",
+            monitor->posixerrno);
+      serial_seterror(handle, monitor->serialerror);
+      errno = monitor->posixerrno;
+      atomic_store(&(monitor->reported), TRUE);
+      result = MODEMEVENT_ERROR;
+      break;
     }
-  }
 
-  if (entercritsection(handle)) result = -1;
-  handle->modemstate = NULL;
-  if (exitcritsection(handle)) result = -1;
+    if (atomic_exchange(&(monitor->abort), FALSE)) break;
 
-  result = sem_destroy(&(mstate.modemevent));
-  if (!result) {
-    nslog(handle, NSLOG_CRIT,
-	  "waitformodemevent: sem_destroy: errno=%d",
-	  errno);
+    int waitms = -1;
+    if (timeout >= 0) {
+      timeuntil(&deadline, &ts);
+      waitms = timespectoms(&ts);
+    }
+
+    struct pollfd fds;
+    fds.fd = monitor->wakeup.rfd;
+    fds.events = POLLIN;
+    fds.revents = 0;
+    int r = poll(&fds, 1, waitms);
+    if (r == 0) break;
+    if (r < 0 && errno != EINTR) {
+      serial_seterror(handle, ERRMSG_POLL);
+      result = MODEMEVENT_ERROR;
+      break;
+    }
   }
 
-  if (!result) {
-    return mstate.eventresult & event;
-  } else {
-    return MODEMEVENT_ERROR;
+  // This must be the last access to the monitor, as serial_close() frees it
+  // once we're no longer waiting.
+  if (entercritsection(handle)) {
+    atomic_store(&(monitor->waiting), FALSE);
+    return result;
   }
+  atomic_store(&(monitor->waiting), FALSE);
+  pthread_cond_signal(&(monitor->idle));
+  exitcritsection(handle);
+  return result;
 #else
   serial_seterror(handle, ERRMSG_NOSYS);
   errno = ENOSYS;
@@ -563,24 +722,15 @@ NSERIAL_EXPORT int WINAPI serial_abortwaitformodemevent(struct serialhandle *han
     return -1;
   }
 
-  int result = 0;
+#ifdef HAVE_TIOCMIWAIT
+  // Only a thread that is currently waiting is aborted.
   if (entercritsection(handle)) return -1;
-  if (handle->modemstate != NULL) {
-    handle->modemstate->modemeventabort = TRUE;
-    result = sem_post(&(handle->modemstate->modemevent));
-    if (result == -1 && errno == EOVERFLOW) {
-      // The thread has already been closed and posted its event.
-      // Ignore it.
-      result = 0;
-      errno = 0;
-    } else {
-      nslog(handle, NSLOG_CRIT,
-	    "abortwaitformodemevent: sem_post: errno=%d",
-	    result);
-    }
+  struct modemmonitor *monitor = handle->modemmonitor;
+  if (monitor != NULL && atomic_load(&(monitor->waiting))) {
+    atomic_store(&(monitor->abort), TRUE);
+    modemnotify(monitor);
   }
-  if (exitcritsection(handle)) result = -1;
-
-  if (result) return -1;
+  if (exitcritsection(handle)) return -1;
+#endif
   return 0;
 }
@@ -19,4 +19,22 @@
 int serial_setdtrinternal(struct serialhandle *handle);
 int serial_setrtsinternal(struct serialhandle *handle);
 
+// Starts the thread monitoring the modem signals if it isn't running, and
+// returns a file descriptor that is readable when modem signals change or the
+// thread stops with an error. Returns -1 on error.
+int modemmonitorfd(struct serialhandle *handle);
+
+// Returns MODEMCHANGEEVENT if modem signal changes are queued that weren't
+// consumed by serial_timedwaitformodemevent() yet, and ERROREVENT if the
+// thread stopped with an error. Nothing is consumed.
+serialevent_t modemmonitorpending(struct serialhandle *handle);
+
+// Clears the file descriptor returned by modemmonitorfd() after it woke up a
+// wait. Call modemmonitorpending() afterwards, so no change is missed.
+void modemmonitorclear(struct serialhandle *handle);
+
+// Stops the thread monitoring the modem signals, started by
+// serial_timedwaitformodemevent(). Called when closing the serial port.
+void modemmonitorstop(struct serialhandle *handle);
+
 #endif
@@ -30,6 +30,11 @@
 #include "threaddata.h"
 #include "baudrate.h"
 #include "log.h"
+#include "ring.h"
+#include "buffer.h"
+#include "readuntil.h"
+#include "coalesce.h"
+#include "openserial.h"
 
 NSERIAL_EXPORT const char *WINAPI serial_version()
 {
@@ -48,20 +53,31 @@ static int initserialhandle(struct serialhandle *handle)
   handle->device = NULL;
   serial_setdefaultbaud(handle);
   handle->fd = -1;
-  handle->prfd = -1;
-  handle->pwfd = -1;
+  wakeupinit(&(handle->abortfd));
   handle->databits = 8;
   handle->parity = NOPARITY;
   handle->stopbits = ONE;
   handle->handshake = NOHANDSHAKE;
   handle->txcontinueonxoff = FALSE;
   handle->discardnull = FALSE;
+  handle->reportbreak = FALSE;
   handle->xonlimit = 2048;
   handle->xofflimit = 512;
   handle->parityreplace = 0;
-  pthread_mutex_init(&(handle->abortmutex), NULL);
+  handle->buffersize = SERIALBUFFERSIZE;
+  handle->lowlatency = FALSE;
+  handle->lowlatencyapplied = LOWLATENCY_NONE;
+  handle->lowlatencytimer = -1;
+  handle->coalescedelay = 0;
+  handle->coalescethreshold = 0;
   pthread_mutex_init(&(handle->modemmutex), NULL);
-  handle->modemstate = NULL;
+  handle->modemmonitor = NULL;
+  handle->hascallbacks = FALSE;
+  handle->iothread = NULL;
+  handle->rxring = NULL;
+  handle->txring = NULL;
+  handle->eventloop = NULL;
+  handle->eventloopindex = -1;
 
   threaddata_init();
   return 0;
@@ -102,14 +118,11 @@ NSERIAL_EXPORT void WINAPI serial_terminate(struct serialhandle *handle)
     free(handle->portbuffer);
   }
 
-  if (handle->tmpbuffer) {
-    free(handle->tmpbuffer);
-  }
+  bufferfree(handle->tmpbuffer, handle->buffersize);
+  untilfree(handle);
+  coalescefree(handle);
+  ringfree(handle);
 
-  if ((errno = pthread_mutex_destroy(&(handle->abortmutex)))) {
-    nslog(handle, NSLOG_CRIT,
-	  "modem: pthread_mutex_destroy(abortmutex): errno=%d", errno);
-  }
   if ((errno = pthread_mutex_destroy(&(handle->modemmutex)))) {
     nslog(handle, NSLOG_CRIT,
 	  "modem: pthread_mutex_destroy(modemmutex): errno=%d", errno);
@@ -7,6 +7,8 @@
 
 #include <stdlib.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -535,6 +537,35 @@ NSERIAL_EXPORT int WINAPI serial_setdiscardnull(struct serialhandle *handle, int
  */
 NSERIAL_EXPORT int WINAPI serial_getdiscardnull(struct serialhandle *handle, int *discardnull);
 
+/*! \brief Set the property ReportBreak
+ *
+ * Set the property ReportBreak. By default a break received is ignored. If
+ * set, and ParityReplace is active, a break is received as a null byte with
+ * an error. serial_readerrors() reports it as RXERROR_BREAK, and
+ * serial_read() replaces it with ParityReplace. The property is used by the
+ * next call to serial_setproperties().
+ *
+ * \param handle The handle returned by serial_init().
+ * \param reportbreak The boolean value to set for ReportBreak.
+ * \return 0 if the operation was successful.
+ * \return -1 if something went wrong.
+ * \exception EINVAL invalid handle was provided.
+ */
+NSERIAL_EXPORT int WINAPI serial_setreportbreak(struct serialhandle *handle, int reportbreak);
+
+/*! \brief Get the property ReportBreak
+ *
+ * Get the property ReportBreak.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param reportbreak On success, contains the value of the property
+ *    ReportBreak.
+ * \return 0 if the operation was successful.
+ * \return -1 if something went wrong.
+ * \exception EINVAL invalid handle was provided, or reportbreak was NULL.
+ */
+NSERIAL_EXPORT int WINAPI serial_getreportbreak(struct serialhandle *handle, int *reportbreak);
+
 /*! \brief Set the property XOnLimit
  *
  * Set the property XOnLimit. This property should be used rarely, if
@@ -641,6 +672,93 @@ NSERIAL_EXPORT int WINAPI serial_setparityreplace(struct serialhandle *handle, i
  */
 NSERIAL_EXPORT int WINAPI serial_getparityreplace(struct serialhandle *handle, int *parityreplace);
 
+/*! \brief Set the size of the internal buffers
+ *
+ * Set the size of the buffer that serial_read() uses when ParityReplace or
+ * DiscardNull are active, and of the buffer that the I/O thread reads into
+ * (see serial_setcallbacks()). This limits the data read from the serial port
+ * with one system call. The default is 8192 bytes.
+ *
+ * The buffers are allocated when first used, so an idle serial port needs no
+ * memory for them. They are aligned to a cache line, or to a page if they're
+ * at least a page. Buffers of at least a huge page (usually 2MB) use huge
+ * pages if the system has them reserved, else transparent huge pages are
+ * requested.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param size The size of the buffers in bytes, from 64 bytes to 1GB.
+ * \return 0 if the operation was successful.
+ * \return -1 if something went wrong.
+ * \exception EINVAL invalid handle was provided, or the size is out of range.
+ * \exception EIO the serial port is open.
+ */
+NSERIAL_EXPORT int WINAPI serial_setbuffersize(struct serialhandle *handle, size_t size);
+
+/*! \brief Get the size of the internal buffers
+ *
+ * Get the size of the internal buffers set with serial_setbuffersize().
+ *
+ * \param handle The handle returned by serial_init().
+ * \param size On success, the size of the buffers in bytes.
+ * \return 0 if the operation was successful.
+ * \return -1 if something went wrong.
+ * \exception EINVAL invalid handle was provided, or size was NULL.
+ */
+NSERIAL_EXPORT int WINAPI serial_getbuffersize(struct serialhandle *handle, size_t *size);
+
+/*! \brief The settings of the driver changed for low latency.
+ */
+typedef enum seriallowlatency {
+  LOWLATENCY_NONE = 0,   /*!< No settings were changed */
+  LOWLATENCY_ASYNC = 1,  /*!< ASYNC_LOW_LATENCY is set for the UART */
+  LOWLATENCY_TIMER = 2,  /*!< The latency timer of a USB adapter is 1ms */
+} seriallowlatency_t;
+
+/*! \brief Set the property LowLatency
+ *
+ * Set the property LowLatency, so that data received is passed on by the
+ * driver as soon as possible. This sets ASYNC_LOW_LATENCY for a UART, and the
+ * latency timer to 1ms for USB serial adapters that have one, such as FTDI.
+ * Writing the latency timer in sysfs may need permissions.
+ *
+ * The settings are applied by serial_setproperties(), and the original
+ * settings are restored when the serial port is closed. Use
+ * serial_getlowlatencyapplied() to get the settings that could be applied.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param lowlatency The boolean value to set for LowLatency.
+ * \return 0 if the operation was successful.
+ * \return -1 if something went wrong.
+ * \exception EINVAL invalid handle was provided.
+ */
+NSERIAL_EXPORT int WINAPI serial_setlowlatency(struct serialhandle *handle, int lowlatency);
+
+/*! \brief Get the property LowLatency
+ *
+ * Get the property LowLatency.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param lowlatency On success, contains the value of the property
+ *    LowLatency.
+ * \return 0 if the operation was successful.
+ * \return -1 if something went wrong.
+ * \exception EINVAL invalid handle was provided, or lowlatency was NULL.
+ */
+NSERIAL_EXPORT int WINAPI serial_getlowlatency(struct serialhandle *handle, int *lowlatency);
+
+/*! \brief Get the settings applied for LowLatency
+ *
+ * Get the settings of the driver that serial_setproperties() could change
+ * for the property LowLatency.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param applied On success, contains the settings changed.
+ * \return 0 if the operation was successful.
+ * \return -1 if something went wrong.
+ * \exception EINVAL invalid handle was provided, or applied was NULL.
+ */
+NSERIAL_EXPORT int WINAPI serial_getlowlatencyapplied(struct serialhandle *handle, seriallowlatency_t *applied);
+
 /*! \brief The kinds of events that we can wait for.
  *
  * The kinds of events to wait for when waiting, or the event that occurred.
@@ -649,7 +767,10 @@ typedef enum serialevent {
   NOEVENT = 0,            /*!< No event occurred */
   READEVENT = 1,          /*!< Wait for, or got a read event */
   WRITEEVENT = 2,         /*!< Wait for, or got a write event */
-  READWRITEEVENT = 3      /*!< Wait for either read/write */
+  READWRITEEVENT = 3,     /*!< Wait for either read/write */
+  MODEMCHANGEEVENT = 4,   /*!< Wait for, or got a modem signal change */
+  ERROREVENT = 8,         /*!< Wait for, or got an error or hangup */
+  TXEMPTYEVENT = 16       /*!< Wait for, or got all data written sent */
 } serialevent_t;
 
 /*! \brief Clear the input and output buffers immediately
@@ -665,15 +786,73 @@ NSERIAL_EXPORT int WINAPI serial_reset(struct serialhandle *handle);
  *
  * Wait for an event on the serial port, based on the type of events we expect.
  *
+ * Waiting for MODEMCHANGEEVENT starts the thread that monitors the modem
+ * signals, as described in serial_waitformodemevent(), so that one thread can
+ * wait for data and modem signal changes together. The event is returned as
+ * long as there are changes that were not consumed, so after it occurs, get
+ * the signals that changed with serial_timedwaitformodemevent() and a timeout
+ * of zero. Don't call serial_waitformodemevent() concurrently from another
+ * thread while waiting for MODEMCHANGEEVENT.
+ *
+ * ERROREVENT occurs if the serial port has an error or was hung up (e.g. a USB
+ * serial port was removed). The next read or write returns the error. When
+ * waiting also for MODEMCHANGEEVENT, ERROREVENT occurs if the modem signals
+ * can't be monitored. This is reported until serial_waitformodemevent()
+ * returns the error, and not again.
+ *
+ * TXEMPTYEVENT occurs when all data written was sent, e.g. to turn around a
+ * half duplex line. Unlike WRITEEVENT, which only means the driver has space,
+ * the output queue is empty (TIOCOUTQ), and if the driver has a line status
+ * register, also the transmitter (TIOCSERGETLSR). As the driver can't signal
+ * it, the output queue is checked when the data queued should be sent at the
+ * baud rate. It is returned as long as no new data is written.
+ *
  * \param handle The handle returned by serial_init().
  * \param event The events to wait for.
- * \param timeout The timeout before returning in milliseconds.
+ * \param timeout The timeout before returning in milliseconds. A negative
+ *   value waits forever.
  * \return -1 if there was an error. Use errno to get the error code.
  * \return The event that occurred. Note, that events will be returned as a
  *   bitmask if multiple events occur.
  */
 NSERIAL_EXPORT serialevent_t WINAPI serial_waitforevent(struct serialhandle *handle, serialevent_t event, int timeout);
 
+/*! \brief How the timeout of serial_timedwaitforevent() is interpreted.
+ */
+typedef enum serialtimeoutmode {
+  TIMEOUT_RELATIVE = 0,   /*!< The timeout is relative to the time of the call */
+  TIMEOUT_ABSOLUTE = 1    /*!< The timeout is a deadline of CLOCK_MONOTONIC */
+} serialtimeoutmode_t;
+
+/*! \brief Wait for an event on the serial port with a precise timeout.
+ *
+ * This function behaves the same as serial_waitforevent(), but the timeout
+ * has nanosecond resolution and can be an absolute deadline. Use a deadline
+ * when retrying a wait after it returns early (e.g. by an abort or a signal),
+ * so that the total time waited doesn't drift.
+ *
+ * Unlike serial_waitforevent(), an event of NOEVENT waits for
+ * serial_abortwaitforevent() or the timeout.
+ *
+ * The accuracy of the timeout depends on the timer slack of the operating
+ * system, which on Linux is usually 50us.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param event The events to wait for.
+ * \param timeout The timeout, or NULL to wait forever. A negative relative
+ *   timeout, or an absolute deadline in the past doesn't wait.
+ * \param mode If timeout is relative, or an absolute time of CLOCK_MONOTONIC
+ *   as returned by clock_gettime().
+ * \param remaining If not NULL, is set to the time remaining until the
+ *   timeout expires. It is zero if the timeout expired or is NULL.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \return The event that occurred. Note, that events will be returned as a
+ *   bitmask if multiple events occur.
+ * \exception EINVAL Invalid parameters, e.g. tv_nsec is out of range.
+ * \exception EIO The serial port is not open.
+ */
+NSERIAL_EXPORT serialevent_t WINAPI serial_timedwaitforevent(struct serialhandle *handle, serialevent_t event, const struct timespec *timeout, serialtimeoutmode_t mode, struct timespec *remaining);
+
 /*! \brief Trigger abort of the serial_waitforevent() function
  *
  * Cause an existing invocation of serial_waitforevent() to be aborted. It
@@ -681,8 +860,11 @@ NSERIAL_EXPORT serialevent_t WINAPI serial_waitforevent(struct serialhandle *han
  * we're currently in the serial_waitforevent() waiting for new data. This
  * allows to have an implementation with fewer threads.
  *
- * The internal implementation uses anonymous pipes to avoid triggering signal
- * handlers that might have other undesirable effects in the process.
+ * The internal implementation uses an eventfd (or anonymous pipes where not
+ * available) to avoid triggering signal handlers that might have other
+ * undesirable effects in the process. Calling this function many times before
+ * the wait returns results in a single abort. It doesn't block, so it is cheap
+ * to call after every write to a buffer.
  *
  * Note, that if this function is called before the serial_waitforevent(),
  * then the next invocation of serial_waitforevent() will abort
@@ -738,9 +920,10 @@ void onwritedataavailable(void)
  * serial_waitforevent() exits, so that it can process whatever data it has,
  * and reenter the loop with the flag modified to also write data.
  *
- * The serial_abortwaitforevent() uses mutexes internally to serialize data,
- * so it also behaves as a memory barrier, ensuring that variables (like event
- * in the above example) are correctly set. But you will still have to make
+ * The serial_abortwaitforevent() uses atomic operations internally, so it
+ * also behaves as a memory barrier, ensuring that variables (like event in
+ * the above example) written before the abort are visible when
+ * serial_waitforevent() returns. But you will still have to make
  * sure that you control race conditions in your own program. That is why we
  * don't modify the event flag in Thread 2. The methods GetData() and
  * IsDataAvailable() need to apply appropriate synchronisation.
@@ -778,8 +961,7 @@ NSERIAL_EXPORT int WINAPI serial_abortwaitforevent(struct serialhandle *handle);
  *   open.
  * \exception EINVAL Invalid parameters, check that handle and buffer is not
  *   NULL.
- * \exception ENOMEM A previous call to serial_setproperties() also failed with
- *   this exception.
+ * \exception ENOMEM The buffer to filter the data couldn't be allocated.
  * \exception - Other exceptions may be raised depending on the underlying
  *   system libc read() call.
  */
@@ -807,6 +989,772 @@ NSERIAL_EXPORT ssize_t WINAPI serial_read(struct serialhandle *handle, char *buf
  */
 NSERIAL_EXPORT ssize_t WINAPI serial_write(struct serialhandle *handle, const char *buffer, size_t length);
 
+/*! \brief Read data from the serial port into multiple buffers.
+ *
+ * Read data from the serial port, filling the buffers in the order given,
+ * with a single read from the serial port. This behaves the same as
+ * serial_read(), except the data is scattered over the buffers. Replacing
+ * parity errors and discarding null bytes applies to the data as a whole, so
+ * a buffer may end in the middle of a parity error sequence that was read.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param iov The buffers to read the data to.
+ * \param iovcnt The number of elements in iov, up to IOV_MAX.
+ * \return The number of bytes put into the buffers.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EIO End of file has been reached, or the serial port is not
+ *   open.
+ * \exception EINVAL Invalid parameters, check that handle and iov is not
+ *   NULL, and that iovcnt is in range.
+ * \exception ENOMEM The buffer to filter the data couldn't be allocated.
+ */
+NSERIAL_EXPORT ssize_t WINAPI serial_readv(struct serialhandle *handle, const struct iovec *iov, int iovcnt);
+
+/*! \brief The kind of error of a byte received.
+ */
+typedef enum serialrxerror {
+  RXERROR_PARITY = 1,  /*!< A parity or framing error */
+  RXERROR_BREAK = 2,   /*!< A break, or a null byte with an error */
+} serialrxerror_t;
+
+/*! \brief The position of a byte received with an error.
+ */
+struct serialrxerrorinfo {
+  size_t          offset;  /*!< Offset of the byte in the buffer read */
+  serialrxerror_t error;   /*!< The kind of error */
+};
+
+/*! \brief Read data from the serial port, and where errors were received.
+ *
+ * Read data from the serial port like serial_read(). Bytes received with an
+ * error are not replaced with ParityReplace, but are put in the buffer as
+ * received, with their offset and kind of error in errors. So a decoder can
+ * drop only the frame with the error. The terminal doesn't distinguish a
+ * parity error from a framing error.
+ *
+ * Errors are only detected if ParityReplace is set and the parity isn't
+ * NOPARITY, else no errors are returned. Breaks are only reported if
+ * ReportBreak is set. When errors is full, the read stops before the next
+ * byte with an error, which is returned by the next read.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param buffer The buffer to read the data to.
+ * \param length The length of buffer.
+ * \param errors The array to put the positions of the errors into.
+ * \param maxerrors The number of elements in errors, at least one.
+ * \param errorcount On return contains the number of errors in errors.
+ * \return The number of bytes put into the buffer.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EIO End of file has been reached, or the serial port is not
+ *   open.
+ * \exception EINVAL Invalid parameters, check that handle, buffer, errors and
+ *   errorcount are not NULL, and maxerrors is positive.
+ * \exception ENOMEM The buffer to filter the data couldn't be allocated.
+ */
+NSERIAL_EXPORT ssize_t WINAPI serial_readerrors(struct serialhandle *handle, char *buffer, size_t length, struct serialrxerrorinfo *errors, int maxerrors, int *errorcount);
+
+/*! \brief Read a record ending with a delimiter from the serial port.
+ *
+ * Read data from the serial port until the delimiter is received, which may
+ * be more than one byte, e.g. "\r\n". The record including the delimiter is
+ * put into the buffer. Data received after the delimiter is kept by the
+ * library for the next call, or is returned first by serial_read().
+ *
+ * If the record is longer than the buffer, or the size set with
+ * serial_setbuffersize(), the record is returned in parts without the
+ * delimiter. The data is filtered like serial_read().
+ *
+ * \param handle The handle returned by serial_init().
+ * \param buffer The buffer to read the record to.
+ * \param length The length of buffer.
+ * \param delim The delimiter that ends a record.
+ * \param delimlength The length of the delimiter.
+ * \param timeout The time to wait in milliseconds for a record. A negative
+ *   value waits forever.
+ * \return The number of bytes put into the buffer.
+ * \return 0 if the timeout expired or serial_abortwaitforevent() was called
+ *   before a record was received. The data received so far is kept, and is
+ *   returned first by the next call or by serial_read().
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EIO End of file has been reached, or the serial port is not
+ *   open.
+ * \exception EINVAL Invalid parameters, check that handle, buffer and delim
+ *   are not NULL, and length and delimlength are not zero.
+ * \exception ENOMEM The buffer for the record couldn't be allocated.
+ */
+NSERIAL_EXPORT ssize_t WINAPI serial_readuntil(struct serialhandle *handle, char *buffer, size_t length, const char *delim, size_t delimlength, int timeout);
+
+/*! \brief Read a frame that ends with silence on the line.
+ *
+ * Read data from the serial port until nothing is received for the gap, as
+ * used by Modbus RTU. The time data arrives is taken directly after it's
+ * read. The default gap is 3.5 character times, calculated from the baud
+ * rate, data bits, parity and stop bits.
+ *
+ * The frame is returned in parts if it's longer than the buffer. Frames can
+ * only be separated if this function is called again before the next frame
+ * is received, as data already received together can't be split.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param buffer The buffer to read the frame to.
+ * \param length The length of buffer.
+ * \param gap The silence that ends a frame in microseconds, or 0 for 3.5
+ *   character times.
+ * \param timeout The time to wait in milliseconds for the start of a frame.
+ *   A negative value waits forever.
+ * \return The number of bytes put into the buffer.
+ * \return 0 if the timeout expired or serial_abortwaitforevent() was called
+ *   before a frame was received.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EIO End of file has been reached, or the serial port is not
+ *   open.
+ * \exception EINVAL Invalid parameters, check that handle and buffer are not
+ *   NULL, length is not zero and gap is not negative.
+ */
+NSERIAL_EXPORT ssize_t WINAPI serial_readframe(struct serialhandle *handle, char *buffer, size_t length, int gap, int timeout);
+
+/*! \brief Read all data that is available, up to a budget.
+ *
+ * Read data from the serial port like serial_read(), but instead of
+ * returning after a single read, continue reading while the driver has more
+ * data (checked with TIOCINQ). At high baud rates, more data has often
+ * arrived by the time the first read returns, which saves waiting for
+ * another READEVENT.
+ *
+ * When the driver has no more data, it's waited for new data until the
+ * budget expires. A budget of 0 returns as soon as the driver is empty. The
+ * function returns when the buffer is full, or the budget has expired.
+ *
+ * Like serial_read(), it should be called after serial_waitforevent()
+ * returns READEVENT.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param buffer The buffer to read the data to.
+ * \param length The length of buffer.
+ * \param budget The time in microseconds to wait for more data, after the
+ *   first read.
+ * \param syscalls If not NULL, contains the number of system calls used to
+ *   read the data. This helps to tune the budget.
+ * \return The number of bytes put into the buffer. It may be 0 if no data
+ *   was available.
+ * \return -1 if there was an error before any data was read. Use errno to
+ *   get the error code.
+ * \exception EIO End of file has been reached, or the serial port is not
+ *   open.
+ * \exception EINVAL Invalid parameters, check that handle and buffer are not
+ *   NULL and budget is not negative.
+ */
+NSERIAL_EXPORT ssize_t WINAPI serial_readavailable(struct serialhandle *handle, char *buffer, size_t length, int budget, int *syscalls);
+
+/*! \brief Read data from the serial port, and when it was received.
+ *
+ * Read data from the serial port like serial_read(), and get the time of
+ * CLOCK_MONOTONIC when the first byte returned was read from the driver, not
+ * when the application gets it. Data that the library kept from an earlier
+ * read, e.g. when filtering parity errors, keeps the time it was read.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param buffer The buffer to read the data to.
+ * \param length The length of buffer.
+ * \param ts On return, if data was read, the time the data was read.
+ * \return The number of bytes put into the buffer.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EIO End of file has been reached, or the serial port is not
+ *   open.
+ * \exception EINVAL Invalid parameters, check that handle, buffer and ts are
+ *   not NULL.
+ * \exception ENOMEM The buffer to filter the data couldn't be allocated.
+ */
+NSERIAL_EXPORT ssize_t WINAPI serial_read_ts(struct serialhandle *handle, char *buffer, size_t length, struct timespec *ts);
+
+/*! \brief Write data from multiple buffers to the serial port.
+ *
+ * Write the buffers in the order given with a single system call, so that
+ * a frame in separate buffers (e.g. a header, payload and checksum) needs
+ * neither a copy into one buffer, nor a call for every buffer. This behaves
+ * the same as serial_write(), so not all data might be written.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param iov The buffers containing the data to write.
+ * \param iovcnt The number of elements in iov, up to IOV_MAX.
+ * \return The number of bytes sent into the serial port buffer.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EIO The serial port is not open.
+ * \exception EINVAL Invalid parameters, check that handle and iov is not
+ *   NULL, and that iovcnt is in range.
+ */
+NSERIAL_EXPORT ssize_t WINAPI serial_writev(struct serialhandle *handle, const struct iovec *iov, int iovcnt);
+
+/*! \brief Coalesce small writes.
+ *
+ * Enable coalescing of small writes, so that many small messages are written
+ * with fewer system calls. Data given to serial_write() or serial_service()
+ * is buffered if the data already buffered and the new data together are
+ * shorter than the threshold, and the buffered data is written when:
+ * - a write reaches the threshold, together with the data of that write;
+ * - serial_writev() or serial_ring_service() writes, before their data;
+ * - the delay after the first byte buffered has expired, while waiting in
+ *   serial_waitforevent() and other functions that wait, or on the next
+ *   write;
+ * - serial_flushwrite() is called.
+ *
+ * The buffered data is discarded by serial_reset() and serial_close(). An
+ * application using serial_eventloop_wait() must call serial_flushwrite()
+ * itself.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param delay The maximum time in microseconds to buffer data, or 0 to
+ *   disable coalescing.
+ * \param threshold Writes are buffered while shorter than this many bytes.
+ *   Ignored if delay is 0.
+ * \return 0 if the operation was successful.
+ * \return -1 if something went wrong.
+ * \exception EINVAL invalid handle was provided, delay is negative, or
+ *   threshold is less than 2.
+ * \exception EAGAIN data buffered couldn't be written before changing the
+ *   settings.
+ */
+NSERIAL_EXPORT int WINAPI serial_setwritecoalesce(struct serialhandle *handle, int delay, size_t threshold);
+
+/*! \brief Get the settings for coalescing small writes.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param delay On success, the maximum time in microseconds to buffer data,
+ *   or 0 if coalescing is disabled.
+ * \param threshold On success, the threshold in bytes.
+ * \return 0 if the operation was successful.
+ * \return -1 if something went wrong.
+ * \exception EINVAL invalid handle was provided, or delay or threshold was
+ *   NULL.
+ */
+NSERIAL_EXPORT int WINAPI serial_getwritecoalesce(struct serialhandle *handle, int *delay, size_t *threshold);
+
+/*! \brief Write the data buffered by coalescing.
+ *
+ * Write the data buffered by serial_setwritecoalesce() without waiting for
+ * the delay. Like serial_write(), this doesn't block, so not all data might
+ * be written.
+ *
+ * \param handle The handle returned by serial_init().
+ * \return The number of bytes that are still buffered, 0 if all data was
+ *   written.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EIO The serial port is not open.
+ * \exception EINVAL invalid handle was provided.
+ */
+NSERIAL_EXPORT ssize_t WINAPI serial_flushwrite(struct serialhandle *handle);
+
+/*! \brief The pacing of data written by serial_writepaced().
+ *
+ * Devices with a small receive FIFO and no flow control are overrun if data
+ * is sent back to back. The data can be paced by limiting the rate, or by
+ * leaving the line idle between bytes or chunks. All fields set to 0 writes
+ * without pacing.
+ */
+struct serialpacing {
+  int rate;      /*!< Maximum bytes per second, or 0 for no limit */
+  int burst;     /*!< Bytes sent back to back, e.g. the size of the FIFO
+                  *   of the device. This is the size of a chunk, and the
+                  *   size of the token bucket for the rate. 0 is one byte
+                  *   for the rate, and no limit for chunks */
+  int bytegap;   /*!< Idle time in microseconds after every byte, or 0 */
+  int chunkgap;  /*!< Idle time in microseconds after every chunk, or 0 */
+};
+
+/*! \brief Set the pacing of serial_writepaced().
+ *
+ * Set how serial_writepaced() paces the data written. The pacing applies
+ * across calls, so that the gap or rate is kept between consecutive calls.
+ * Other functions that write aren't paced.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param pacing The pacing to use. NULL disables pacing.
+ * \return 0 if the operation was successful.
+ * \return -1 if something went wrong.
+ * \exception EINVAL invalid handle was provided, a field was negative, or
+ *   both bytegap and chunkgap were given.
+ */
+NSERIAL_EXPORT int WINAPI serial_setpacing(struct serialhandle *handle, const struct serialpacing *pacing);
+
+/*! \brief Get the pacing of serial_writepaced().
+ *
+ * \param handle The handle returned by serial_init().
+ * \param pacing On success, contains the pacing.
+ * \return 0 if the operation was successful.
+ * \return -1 if something went wrong.
+ * \exception EINVAL invalid handle was provided, or pacing was NULL.
+ */
+NSERIAL_EXPORT int WINAPI serial_getpacing(struct serialhandle *handle, struct serialpacing *pacing);
+
+/*! \brief Write data to the serial port, paced by serial_setpacing().
+ *
+ * Write all data to the serial port, sleeping as needed by the pacing given
+ * with serial_setpacing(). Unlike serial_write(), this function blocks until
+ * all data is given to the driver or the timeout expires. It can't be
+ * aborted with serial_abortwaitforevent().
+ *
+ * The output queue of the driver is checked with TIOCOUTQ, so that data the
+ * driver hasn't sent yet counts towards the burst, and gaps start when the
+ * data is sent.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param buffer The buffer containing the data to write.
+ * \param length The number of bytes to write.
+ * \param timeout The time to wait in milliseconds. A negative value waits
+ *   forever.
+ * \return The number of bytes sent into the serial port buffer, which is
+ *   less than length if the timeout expired.
+ * \return -1 if there was an error before any data was written. Use errno
+ *   to get the error code.
+ * \exception EIO The serial port is not open.
+ * \exception EINVAL Invalid parameters, check that handle and buffer is not
+ *   NULL.
+ */
+NSERIAL_EXPORT ssize_t WINAPI serial_writepaced(struct serialhandle *handle, const char *buffer, size_t length, int timeout);
+
+/*! \brief The result of serial_service().
+ */
+struct serialserviceresult {
+  serialevent_t event;          /*!< The events that occurred */
+  ssize_t       readbytes;      /*!< Number of bytes read */
+  ssize_t       writebytes;     /*!< Number of bytes written */
+};
+
+/*! \brief Wait for the serial port, then read and write in a single call.
+ *
+ * This function combines serial_waitforevent(), serial_read() and
+ * serial_write(). It waits for a READEVENT if readlength is not zero and for
+ * a WRITEEVENT if writelength is not zero. Then it reads and writes as much
+ * data as is possible without blocking. Applications that call the library
+ * through a foreign function interface (such as .NET P/Invoke) need only one
+ * call for every iteration of their I/O loop.
+ *
+ * If both lengths are zero, the function only waits for
+ * serial_abortwaitforevent() or the timeout. An abort returns immediately
+ * with the events that are already available, the same as
+ * serial_waitforevent().
+ *
+ * The data read and written behaves the same as serial_read() and
+ * serial_write(). So less data may be read and written than the length of
+ * the buffers.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param readbuffer The buffer to read data into. May be NULL if readlength
+ *   is zero.
+ * \param readlength The number of bytes available in readbuffer. Use zero if
+ *   no data should be read, e.g. when the application's buffer is full.
+ * \param writebuffer The data to write. May be NULL if writelength is zero.
+ * \param writelength The number of bytes to write. Use zero if there is no
+ *   data to write.
+ * \param timeout The timeout before returning in milliseconds. A negative
+ *   value waits forever.
+ * \param result Is set to the events that occurred, and the number of bytes
+ *   read and written. Zero bytes and NOEVENT indicates a timeout or abort.
+ * \return 0 on success.
+ * \return -1 if there was an error. Use errno to get the error code. The
+ *   result contains the data that was transferred before the error.
+ * \exception EINVAL Invalid parameters.
+ * \exception EIO The serial port is not open, or was closed.
+ */
+NSERIAL_EXPORT int WINAPI serial_service(struct serialhandle *handle, char *readbuffer, size_t readlength, const char *writebuffer, size_t writelength, int timeout, struct serialserviceresult *result);
+
+/*! \struct serialeventloop
+ * \brief An anonymous handle for waiting on events from many serial ports.
+ *
+ * The event loop is provided by serial_eventloop_init() and allows a single
+ * thread to wait for events of many serial ports at once, instead of needing
+ * a thread per serial port that calls serial_waitforevent().
+ */
+struct serialeventloop;
+
+/*! \brief An event that occurred for a serial port in an event loop.
+ *
+ * This structure is filled by serial_eventloop_wait() for every serial port
+ * that has an event.
+ */
+struct serialeventresult {
+  struct serialhandle *handle;  /*!< The serial port that has an event */
+  serialevent_t        event;   /*!< The events that occurred */
+};
+
+/*! \brief Create an event loop for waiting on many serial ports.
+ *
+ * Create a new event loop. Serial ports are registered with
+ * serial_eventloop_add() and their events are obtained with
+ * serial_eventloop_wait(). Be sure to release the resources with
+ * serial_eventloop_terminate().
+ *
+ * The event loop is only supported on Operating Systems that provide epoll.
+ *
+ * \return A handle to the event loop, or NULL if there was an error. Use
+ *   errno to get the error code.
+ * \exception ENOMEM Not enough memory to allocate the event loop.
+ * \exception ENOSYS The event loop is not supported on this platform.
+ */
+NSERIAL_EXPORT struct serialeventloop *WINAPI serial_eventloop_init();
+
+/*! \brief Release the resources of an event loop.
+ *
+ * Free the event loop. Serial ports that are still registered are removed
+ * from the loop, but remain open.
+ *
+ * \param loop The event loop returned by serial_eventloop_init().
+ */
+NSERIAL_EXPORT void WINAPI serial_eventloop_terminate(struct serialeventloop *loop);
+
+/*! \brief Register a serial port with the event loop.
+ *
+ * Register an opened serial port, so that serial_eventloop_wait() returns
+ * the events given. If the serial port is already registered with this
+ * event loop, the events to wait for are updated. This is how a thread
+ * servicing the loop should start and stop waiting for WRITEEVENT, depending
+ * on if it has data to write.
+ *
+ * A serial port can only be registered with one event loop at a time. It is
+ * removed automatically from the event loop when the serial port is closed.
+ *
+ * The event loop is not thread safe. Registering, removing and waiting must
+ * be done by the same thread (usually the thread servicing the loop). Other
+ * threads may call serial_abortwaitforevent() at any time to wake the loop.
+ *
+ * The events MODEMCHANGEEVENT and ERROREVENT are reported the same way as by
+ * serial_waitforevent(). TXEMPTYEVENT is not supported.
+ *
+ * \param loop The event loop returned by serial_eventloop_init().
+ * \param handle The handle returned by serial_init() that is opened.
+ * \param event The events to wait for. Use NOEVENT to only wait for
+ *   serial_abortwaitforevent().
+ * \return 0 on success.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EINVAL Invalid parameters, TXEMPTYEVENT was given, or the
+ *   serial port is registered with another event loop.
+ * \exception EIO The serial port is not open.
+ * \exception ENOSYS The event loop is not supported on this platform.
+ */
+NSERIAL_EXPORT int WINAPI serial_eventloop_add(struct serialeventloop *loop, struct serialhandle *handle, serialevent_t event);
+
+/*! \brief Remove a serial port from the event loop.
+ *
+ * \param loop The event loop returned by serial_eventloop_init().
+ * \param handle The handle returned by serial_init() that was registered with
+ *   serial_eventloop_add().
+ * \return 0 on success.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EINVAL Invalid parameters, or the serial port is not registered
+ *   with this event loop.
+ * \exception ENOSYS The event loop is not supported on this platform.
+ */
+NSERIAL_EXPORT int WINAPI serial_eventloop_remove(struct serialeventloop *loop, struct serialhandle *handle);
+
+/*! \brief Wait for events on all serial ports registered with the event loop.
+ *
+ * Wait until at least one registered serial port has an event, or the timeout
+ * expires. The behaviour for each serial port is the same as if
+ * serial_waitforevent() were called for it. Every serial port that has an
+ * event results in exactly one entry in results, where the event is the
+ * bitmask of all events that occurred.
+ *
+ * If serial_abortwaitforevent() was called for a registered serial port, the
+ * serial port is returned, even if the event is NOEVENT. The thread servicing
+ * the loop should then check if there is new data to write for that serial
+ * port.
+ *
+ * If more serial ports have events than there is space in results, the
+ * remaining events are returned on the next call.
+ *
+ * \param loop The event loop returned by serial_eventloop_init().
+ * \param results An array that is filled with the serial ports that have
+ *   events.
+ * \param maxresults The number of elements in results.
+ * \param timeout The timeout before returning in milliseconds. A negative
+ *   value waits forever.
+ * \return The number of elements in results that were filled. Zero indicates
+ *   a timeout.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EINVAL Invalid parameters.
+ * \exception ENOSYS The event loop is not supported on this platform.
+ */
+NSERIAL_EXPORT int WINAPI serial_eventloop_wait(struct serialeventloop *loop, struct serialeventresult *results, int maxresults, int timeout);
+
+/*! \struct serialioqueue
+ * \brief An anonymous handle for queueing reads and writes to serial ports.
+ *
+ * Read and write requests for one or more serial ports are queued, then
+ * submitted and completed in batches. This reduces the number of system calls
+ * needed to transfer data, which is of benefit at high baud rates.
+ */
+struct serialioqueue;
+
+/*! \brief Options when creating an I/O queue.
+ */
+typedef enum serialioqueueflags {
+  IOQUEUE_DEFAULT = 0,    /*!< Use io_uring if the kernel supports it */
+  IOQUEUE_NOURING = 1     /*!< Always use the portable poll() implementation */
+} serialioqueueflags_t;
+
+/*! \brief The type of request in an I/O queue.
+ */
+typedef enum serialiotype {
+  IOQUEUE_READ = 1,       /*!< Read from the serial port */
+  IOQUEUE_WRITE = 2       /*!< Write to the serial port */
+} serialiotype_t;
+
+/*! \brief A completed request of an I/O queue.
+ *
+ * This structure is filled by serial_ioqueue_complete() for every request
+ * that has completed.
+ */
+struct serialiocompletion {
+  struct serialhandle *handle;  /*!< The serial port of the request */
+  serialiotype_t       type;    /*!< If the request was a read or write */
+  char                *buffer;  /*!< The buffer given with the request */
+  void                *userdata;/*!< The user data given with the request */
+  ssize_t              result;  /*!< Number of bytes transferred, or -1 */
+  int                  error;   /*!< The errno value if result is -1 */
+};
+
+/*! \brief Create a queue for reading and writing to serial ports.
+ *
+ * Create a new I/O queue, that can hold up to depth requests that are not yet
+ * returned by serial_ioqueue_complete(). Be sure to release the resources
+ * with serial_ioqueue_terminate().
+ *
+ * On Linux, the kernel io_uring interface is used, so that the kernel waits
+ * for the serial port and transfers the data for many requests with a single
+ * system call. If io_uring is not available at compile time or at run time,
+ * the queue falls back to poll() with serial_read() and serial_write(). The
+ * results are the same for both implementations.
+ *
+ * The I/O queue is not thread safe. Queueing, submitting and completing must
+ * be done by the same thread.
+ *
+ * \param depth The maximum number of requests in the queue.
+ * \param flags Options for the queue.
+ * \return A handle to the I/O queue, or NULL if there was an error. Use errno
+ *   to get the error code.
+ * \exception EINVAL The depth is out of range.
+ * \exception ENOMEM Not enough memory to allocate the queue.
+ */
+NSERIAL_EXPORT struct serialioqueue *WINAPI serial_ioqueue_init(int depth, serialioqueueflags_t flags);
+
+/*! \brief Release the resources of an I/O queue.
+ *
+ * Free the I/O queue. Requests that are still pending are cancelled and not
+ * returned. When this function returns, the buffers of the cancelled requests
+ * are no longer accessed.
+ *
+ * \param queue The I/O queue returned by serial_ioqueue_init().
+ */
+NSERIAL_EXPORT void WINAPI serial_ioqueue_terminate(struct serialioqueue *queue);
+
+/*! \brief Check if the I/O queue uses io_uring.
+ *
+ * \param queue The I/O queue returned by serial_ioqueue_init().
+ * \return 1 if the queue uses io_uring, 0 if it uses poll().
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EINVAL Invalid parameters.
+ */
+NSERIAL_EXPORT int WINAPI serial_ioqueue_isuring(struct serialioqueue *queue);
+
+/*! \brief Queue a read from the serial port.
+ *
+ * Queue a request to read into the buffer. The request is sent to the kernel
+ * with serial_ioqueue_submit() or serial_ioqueue_complete(). It completes
+ * when at least one byte is read, or there is an error. The data is the same
+ * as returned by serial_read(), including the replacement of parity errors
+ * and discarding of null bytes.
+ *
+ * The buffer must remain valid until the request is returned by
+ * serial_ioqueue_complete(). The serial port must not be closed while it has
+ * requests in the queue.
+ *
+ * \param queue The I/O queue returned by serial_ioqueue_init().
+ * \param handle The handle returned by serial_init() that is opened.
+ * \param buffer The buffer to read into.
+ * \param length The length of the buffer.
+ * \param userdata A value returned in the completion of the request.
+ * \return 0 on success.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EINVAL Invalid parameters.
+ * \exception EIO The serial port is not open.
+ * \exception EAGAIN The queue is full.
+ */
+NSERIAL_EXPORT int WINAPI serial_ioqueue_read(struct serialioqueue *queue, struct serialhandle *handle, char *buffer, size_t length, void *userdata);
+
+/*! \brief Queue a write to the serial port.
+ *
+ * Queue a request to write the buffer. The request completes when at least
+ * one byte is written, or there is an error. Like serial_write(), not all
+ * data in the buffer might be written. Check the result of the completion and
+ * queue the remaining data again.
+ *
+ * The buffer must remain valid until the request is returned by
+ * serial_ioqueue_complete(). The serial port must not be closed while it has
+ * requests in the queue.
+ *
+ * \param queue The I/O queue returned by serial_ioqueue_init().
+ * \param handle The handle returned by serial_init() that is opened.
+ * \param buffer The buffer to write.
+ * \param length The number of bytes in the buffer to write.
+ * \param userdata A value returned in the completion of the request.
+ * \return 0 on success.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EINVAL Invalid parameters.
+ * \exception EIO The serial port is not open.
+ * \exception EAGAIN The queue is full.
+ */
+NSERIAL_EXPORT int WINAPI serial_ioqueue_write(struct serialioqueue *queue, struct serialhandle *handle, const char *buffer, size_t length, void *userdata);
+
+/*! \brief Submit the queued requests.
+ *
+ * Send all queued requests to the kernel with a single system call, without
+ * waiting for them to complete. It is not necessary to call this function
+ * before serial_ioqueue_complete(), which also submits queued requests.
+ *
+ * \param queue The I/O queue returned by serial_ioqueue_init().
+ * \return The number of requests submitted.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EINVAL Invalid parameters.
+ */
+NSERIAL_EXPORT int WINAPI serial_ioqueue_submit(struct serialioqueue *queue);
+
+/*! \brief Wait for requests in the queue to complete.
+ *
+ * Submit the queued requests and wait until at least one request completes,
+ * or the timeout expires. Completed requests are removed from the queue. If
+ * more requests complete than there is space in completions, the remaining
+ * requests are returned on the next call without waiting.
+ *
+ * If there are no requests in the queue, this function returns 0
+ * immediately.
+ *
+ * \param queue The I/O queue returned by serial_ioqueue_init().
+ * \param completions An array that is filled with the completed requests.
+ * \param maxcompletions The number of elements in completions.
+ * \param timeout The timeout before returning in milliseconds. A negative
+ *   value waits forever.
+ * \return The number of elements in completions that were filled. Zero
+ *   indicates a timeout.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EINVAL Invalid parameters.
+ */
+NSERIAL_EXPORT int WINAPI serial_ioqueue_complete(struct serialioqueue *queue, struct serialiocompletion *completions, int maxcompletions, int timeout);
+
+/*! \brief Allocate receive and transmit rings owned by the library.
+ *
+ * Allocate a receive ring and a transmit ring for the serial port. The rings
+ * are single producer, single consumer queues with atomic indices, so they
+ * need no locks. One thread calls serial_ring_service(), which reads from the
+ * serial port directly into the receive ring and writes to the serial port
+ * directly from the transmit ring. If callbacks are set with
+ * serial_setcallbacks(), the I/O thread services the rings instead. The application consumes the receive ring
+ * with serial_ring_readpeek() and serial_ring_readcommit(), and produces the
+ * transmit ring with serial_ring_writereserve() and serial_ring_writecommit(),
+ * accessing the data in place without an extra copy.
+ *
+ * The sizes are rounded up to a power of two. The rings are emptied when the
+ * serial port is opened, and freed by serial_terminate().
+ *
+ * \param handle The handle returned by serial_init(), which is not open.
+ * \param rxsize The size of the receive ring in bytes, zero for no ring.
+ * \param txsize The size of the transmit ring in bytes, zero for no ring.
+ * \return 0 on success.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EINVAL Invalid parameters, or a size is too large.
+ * \exception EIO The serial port is open.
+ * \exception ENOMEM Not enough memory to allocate the rings.
+ */
+NSERIAL_EXPORT int WINAPI serial_ring_init(struct serialhandle *handle, size_t rxsize, size_t txsize);
+
+/*! \brief Get the data in the receive ring.
+ *
+ * Get a pointer to the oldest data in the receive ring. Only the data up to
+ * the end of the ring is returned. After committing it with
+ * serial_ring_readcommit(), call this function again to get the data that
+ * wrapped to the start of the ring.
+ *
+ * Only one thread may consume the receive ring.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param buffer On success, points to the data in the ring.
+ * \return The number of bytes that can be read from buffer.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EINVAL Invalid parameters, or there is no receive ring.
+ */
+NSERIAL_EXPORT ssize_t WINAPI serial_ring_readpeek(struct serialhandle *handle, const char **buffer);
+
+/*! \brief Remove data from the receive ring.
+ *
+ * Free the space of data that was obtained with serial_ring_readpeek(). If
+ * the ring was full, the thread in serial_ring_service() is woken so that it
+ * reads from the serial port again.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param length The number of bytes to remove.
+ * \return 0 on success.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EINVAL Invalid parameters, there is no receive ring, or length
+ *   is more than the data in the ring.
+ */
+NSERIAL_EXPORT int WINAPI serial_ring_readcommit(struct serialhandle *handle, size_t length);
+
+/*! \brief Get the free space in the transmit ring.
+ *
+ * Get a pointer to the free space in the transmit ring, where data to send
+ * can be written. Only the space up to the end of the ring is returned. After
+ * committing data with serial_ring_writecommit(), call this function again to
+ * get the space at the start of the ring.
+ *
+ * Only one thread may produce the transmit ring.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param buffer On success, points to the free space in the ring.
+ * \return The number of bytes that can be written to buffer.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EINVAL Invalid parameters, or there is no transmit ring.
+ */
+NSERIAL_EXPORT ssize_t WINAPI serial_ring_writereserve(struct serialhandle *handle, char **buffer);
+
+/*! \brief Add data to the transmit ring.
+ *
+ * Add data that was written to the space obtained with
+ * serial_ring_writereserve(). If the ring was empty, the thread in
+ * serial_ring_service() is woken so that it writes to the serial port.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param length The number of bytes to add.
+ * \return 0 on success.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EINVAL Invalid parameters, there is no transmit ring, or length
+ *   is more than the free space in the ring.
+ */
+NSERIAL_EXPORT int WINAPI serial_ring_writecommit(struct serialhandle *handle, size_t length);
+
+/*! \brief Transfer data between the serial port and the rings.
+ *
+ * Wait for READEVENT if the receive ring has space, and for WRITEEVENT if the
+ * transmit ring has data. Then read as much data as possible into the
+ * receive ring and write as much data as possible from the transmit ring.
+ * The data read is the same as returned by serial_read().
+ *
+ * Only one thread may service the rings. It usually calls this function in a
+ * loop until the serial port is closed. serial_abortwaitforevent() wakes it
+ * like serial_waitforevent().
+ *
+ * \param handle The handle returned by serial_init() that is opened.
+ * \param timeout The timeout before returning in milliseconds. A negative
+ *   value waits forever.
+ * \return READEVENT if data was added to the receive ring, and WRITEEVENT if
+ *   data was removed from the transmit ring. NOEVENT indicates a timeout or
+ *   abort.
+ * \return -1 if there was an error. Use errno to get the error code. Data
+ *   transferred before the error remains in the rings.
+ * \exception EINVAL Invalid parameters, no rings are allocated, or the I/O
+ *   thread services the rings.
+ * \exception EIO The serial port is not open, or was closed.
+ */
+NSERIAL_EXPORT serialevent_t WINAPI serial_ring_service(struct serialhandle *handle, int timeout);
+
 /*! \brief Get the state of the DCD line on the serial port.
  *
  * Read the state of the Data Carrier Detect signal from the serial port.
@@ -930,11 +1878,15 @@ typedef enum serialmodemevent {
  * Block the current thread until a modem signal change occurs.
  *
  * The underlying operation TIOCMIWAIT blocks forever until a modem signal
- * changes. This method creates its own posix thread which it will run on and
- * your thread will block until a signal change is detected, or until you call
- * serial_abortwaitformodemevent().
+ * changes. The first call to this method starts a posix thread that monitors
+ * all modem signals until the serial port is closed, so that changes between
+ * two calls are not lost. Your thread will block until a signal change is
+ * detected, or until you call serial_abortwaitformodemevent().
+ *
+ * Changes to signals not in \p event are kept, and are returned by a later
+ * call that waits for them.
  *
- * Note, only one invocation of this function is allowed per instance.
+ * Note, only one thread may wait at a time per instance.
  *
  * The behaviour of this function depends on the support of the underlying
  * drivers. On Linux, there are two modes:
@@ -975,9 +1927,26 @@ typedef enum serialmodemevent {
  */
 NSERIAL_EXPORT serialmodemevent_t WINAPI serial_waitformodemevent(struct serialhandle *handle, serialmodemevent_t event);
 
+/*! \brief Wait for a modem event to occur, with a timeout.
+ *
+ * The same as serial_waitformodemevent(), but returns MODEMEVENT_NONE if no
+ * modem signal changes within the timeout.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param event The events to wait for.
+ * \param timeout Timeout in milliseconds. A negative value waits forever.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \return MODEMEVENT_NONE if there was a timeout or the wait was aborted.
+ * \return The events that occurred as a bitmask.
+ * \exception EBADFS The serial port is not open.
+ * \exception EINVAL Another thread is already waiting.
+ */
+NSERIAL_EXPORT serialmodemevent_t WINAPI serial_timedwaitformodemevent(struct serialhandle *handle, serialmodemevent_t event, int timeout);
+
 /*! \brief Trigger abort of the serial_waitformodemevent
  *
- * Abort action of the function serial_waitformodemevent().
+ * Abort action of the function serial_waitformodemevent(). Only a thread
+ * that is currently waiting is aborted.
  *
  * \param handle The handle returned by serial_init()
  * \return -1 if there was an error. Use errno to get the error code.
@@ -985,6 +1954,60 @@ NSERIAL_EXPORT serialmodemevent_t WINAPI serial_waitformodemevent(struct serialh
  */
 NSERIAL_EXPORT int WINAPI serial_abortwaitformodemevent(struct serialhandle *handle);
 
+/*! \brief Functions called by the I/O thread of the library.
+ *
+ * Any of the callbacks may be NULL, if the application isn't interested in
+ * the event. All callbacks are invoked from the I/O thread started by
+ * serial_open(), never concurrently for the same serial port.
+ */
+struct serialcallbacks {
+  /*! \brief Data was read from the serial port.
+   *
+   * The buffer is only valid until the callback returns. If a receive ring
+   * is allocated, the data was added to the ring and buffer is NULL. */
+  void (*datareceived)(struct serialhandle *handle, const char *buffer, size_t length, void *userdata);
+  /*! \brief The transmit ring was written to the serial port and is empty. */
+  void (*writedrained)(struct serialhandle *handle, void *userdata);
+  /*! \brief The modem signals in event changed. */
+  void (*pinchanged)(struct serialhandle *handle, serialmodemevent_t event, void *userdata);
+  /*! \brief An error occurred. Use serial_error() to get the message. */
+  void (*error)(struct serialhandle *handle, int posixerrno, void *userdata);
+};
+
+/*! \brief Set the callbacks for an I/O thread owned by the library.
+ *
+ * If callbacks are set, serial_open() starts a thread that waits for the
+ * serial port, reads the data and invokes the callbacks, so the application
+ * doesn't need its own loop around serial_waitforevent(). The thread is
+ * stopped by serial_close(), which may also be called from a callback.
+ *
+ * The data received is given to datareceived() directly from the buffer it
+ * was read into. If a receive ring was allocated with serial_ring_init(),
+ * the data is read into the ring instead, and datareceived() is only told
+ * how much was added, so the application consumes it in place with
+ * serial_ring_readpeek() and serial_ring_readcommit(). While the ring is
+ * full, no data is read. The application must not call serial_read() itself. To send
+ * data, allocate a transmit ring with serial_ring_init() and add the data
+ * with serial_ring_writecommit(). The I/O thread writes it and calls
+ * writedrained() when the ring is empty.
+ *
+ * If pinchanged() is set, the modem signals are monitored and the
+ * application must not call serial_waitformodemevent() itself. If the modem
+ * signals can't be monitored, error() is called once and the thread continues
+ * to service the data. Any other error stops the thread after calling
+ * error().
+ *
+ * \param handle The handle returned by serial_init(), which is not open.
+ * \param callbacks The callbacks, which are copied. NULL disables the I/O
+ *   thread.
+ * \param userdata A value given to every callback.
+ * \return 0 on success.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception EINVAL Invalid parameters.
+ * \exception EIO The serial port is open.
+ */
+NSERIAL_EXPORT int WINAPI serial_setcallbacks(struct serialhandle *handle, const struct serialcallbacks *callbacks, void *userdata);
+
 /*! \brief Retrieve the number of bytes in the driver in queue.
  *
  * Get the number of bytes in the input queue.
@@ -1011,6 +2034,85 @@ NSERIAL_EXPORT int WINAPI serial_getreadbytes(struct serialhandle *handle, int *
  */
 NSERIAL_EXPORT int WINAPI serial_getwritebytes(struct serialhandle *handle, int *queue);
 
+/*! \brief Wait until all data written is sent, with a timeout.
+ *
+ * Wait until the driver has sent all data written, like tcdrain(), but
+ * return when the timeout expires. Data buffered by
+ * serial_setwritecoalesce() is written first.
+ *
+ * The function sleeps for the time the data in the output queue needs at
+ * the baud rate and frame size, and then checks the queue again. If the
+ * driver has a line status register, it also waits until the transmitter
+ * has sent the last character.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param timeout The time to wait in milliseconds. A negative value waits
+ *   forever.
+ * \return 0 if all data was sent.
+ * \return The number of bytes not yet sent if the timeout expired. A
+ *   character in the transmitter counts as one byte.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \exception ENOSYS This operation is not supported on this platform.
+ * \exception EIO The serial port is not open.
+ * \exception EINVAL invalid handle was provided.
+ */
+NSERIAL_EXPORT int WINAPI serial_drain(struct serialhandle *handle, int timeout);
+
+/*! \brief Counters of the serial port driver.
+ *
+ * The counters are maintained by the driver since it was loaded, and wrap
+ * around. They show if data is lost by the UART (overrun), by the terminal
+ * layer not being read quickly enough (bufoverrun), or on the line.
+ */
+struct serialicount {
+  unsigned int cts;        /*!< Changes of the CTS signal */
+  unsigned int dsr;        /*!< Changes of the DSR signal */
+  unsigned int rng;        /*!< Changes of the RI signal */
+  unsigned int dcd;        /*!< Changes of the DCD signal */
+  unsigned int rx;         /*!< Bytes received */
+  unsigned int tx;         /*!< Bytes sent */
+  unsigned int frame;      /*!< Framing errors */
+  unsigned int overrun;    /*!< Bytes lost by the UART */
+  unsigned int parity;     /*!< Parity errors */
+  unsigned int brk;        /*!< Breaks received */
+  unsigned int bufoverrun; /*!< Bytes lost by the terminal buffer */
+};
+
+/*! \brief Get the counters of the serial port driver.
+ *
+ * Get the counters of the serial port driver with TIOCGICOUNT. Not all
+ * drivers support the counters.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param icount On return contains the counters.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \return 0 Operation performed correctly.
+ * \exception EINVAL Invalid parameters.
+ * \exception ENOSYS This operation is not supported on this platform.
+ * \exception EBADFS The serial port is not open.
+ * \exception ENOTTY The driver doesn't support the counters.
+ */
+NSERIAL_EXPORT int WINAPI serial_geticount(struct serialhandle *handle, struct serialicount *icount);
+
+/*! \brief Get the change of the counters of the serial port driver.
+ *
+ * Get the counters of the serial port driver, like serial_geticount(), and
+ * return how much they have changed since the counters in last. Then last is
+ * updated to the current counters for the next call. Initialise last with
+ * serial_geticount(). Wrapping counters are handled.
+ *
+ * \param handle The handle returned by serial_init().
+ * \param last The counters of the previous call, updated on return.
+ * \param delta On return contains the change of the counters.
+ * \return -1 if there was an error. Use errno to get the error code.
+ * \return 0 Operation performed correctly.
+ * \exception EINVAL Invalid parameters.
+ * \exception ENOSYS This operation is not supported on this platform.
+ * \exception EBADFS The serial port is not open.
+ * \exception ENOTTY The driver doesn't support the counters.
+ */
+NSERIAL_EXPORT int WINAPI serial_geticountdelta(struct serialhandle *handle, struct serialicount *last, struct serialicount *delta);
+
 /*! \brief Set the break state of the serial port (to the level, no pulse).
  *
  * Set the break state of the serial port.
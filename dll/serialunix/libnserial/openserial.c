@@ -29,6 +29,11 @@
 #include "modem.h"
 #include "openserial.h"
 #include "flush.h"
+#include "events.h"
+#include "eventloop.h"
+#include "iothread.h"
+#include "lowlatency.h"
+#include "ring.h"
 #include "log.h"
 
 static int closeserial(struct serialhandle *handle)
@@ -36,6 +41,7 @@ static int closeserial(struct serialhandle *handle)
   int result;
 
   nslog(handle, NSLOG_DEBUG, "close: closing serial port");
+  lowlatencyrestore(handle);
 #if defined HAVE_TERMIOS_EXCLUSIVE
   if (ioctl(handle->fd, TIOCNXCL)) {
     nslog(handle, NSLOG_NOTICE, "close: error setting TIOCNXCL: errno=%d", errno);
@@ -82,34 +88,23 @@ NSERIAL_EXPORT int WINAPI serial_open(struct serialhandle *handle)
   }
 #endif
 
-  int pipefd[2];
-  if (pipe(pipefd) == -1) {
-    nslog(handle, NSLOG_ERR, "open: error opening pipes: errno=%d", errno);
-    serial_seterror(handle, ERRMSG_CANTOPENANONPIPE);
+  if (openabort(handle) == -1) {
     closeserial(handle);
     handle->fd = -1;
     return -1;
   }
 
-  handle->prfd = pipefd[0];
-  handle->pwfd = pipefd[1];
-  if (fcntl(handle->prfd, F_SETFL, O_NONBLOCK) == -1 ||
-      fcntl(handle->pwfd, F_SETFL, O_NONBLOCK) == -1) {
-    nslog(handle, NSLOG_ERR, "open: couldn't set nonblock: errno=%d", errno);
-    serial_seterror(handle, ERRMSG_CANTCONFIGUREANONPIPE);
+  ringreset(handle);
+  serial_setrtsinternal(handle);
+  serial_setdtrinternal(handle);
+
+  if (iothreadstart(handle) == -1) {
+    int lerrno = errno;
+    closeabort(handle);
     closeserial(handle);
-    close(handle->prfd);
-    close(handle->pwfd);
-    handle->fd = -1;
-    handle->prfd = -1;
-    handle->pwfd = -1;
+    errno = lerrno;
     return -1;
   }
-
-  handle->abortpending = FALSE;
-
-  serial_setrtsinternal(handle);
-  serial_setdtrinternal(handle);
   nslog(handle, NSLOG_INFO, "open: succeeded");
   return 0;
 }
@@ -353,6 +348,12 @@ NSERIAL_EXPORT int WINAPI serial_setproperties(struct serialhandle *handle)
     return -1;
   }
 
+  // When errors are marked, a break can be marked as a null byte with an
+  // error, so that serial_readerrors() can report it. It's only done if asked
+  // for, as serial_read() would return ParityReplace for it.
+  if (handle->reportbreak && (newtio.c_iflag & PARMRK))
+    newtio.c_iflag &= ~IGNBRK;
+
   // Set handshake
   newtio.c_cflag &= ~CRTSCTS;
   newtio.c_iflag &= ~(IXON | IXOFF | IXANY);
@@ -399,6 +400,7 @@ NSERIAL_EXPORT int WINAPI serial_setproperties(struct serialhandle *handle)
   nslog(handle, NSLOG_DEBUG, "setproperties: setting attributes done");
 
   flushbuffer(handle);
+  lowlatencyapply(handle);
 
   // Get the baudrate and compare with what we set
   tcgetattr(handle->fd, &newtio);
@@ -414,20 +416,6 @@ NSERIAL_EXPORT int WINAPI serial_setproperties(struct serialhandle *handle)
     return -1;
   }
 
-  // Allocate temporary buffer if needed
-  if (handle->tmpbuffer == NULL) {
-    if (handle->parityrepactive || handle->discardnull) {
-      // In these two modes, we need to read data first, then parse it into
-      // the user supplied buffer.
-      handle->tmpbuffer = malloc(SERIALBUFFERSIZE);
-      if (handle->tmpbuffer == NULL) {
-	serial_seterror(handle, ERRMSG_OUTOFMEMORY);
-	errno = ENOMEM;
-	return -1;
-      }
-    }
-  }
-
   return 0;
 }
 
@@ -439,19 +427,15 @@ NSERIAL_EXPORT int WINAPI serial_close(struct serialhandle *handle)
   }
 
   if (handle->fd == -1) return 0;
+  iothreadstop(handle);
+  eventloopremove(handle);
+  modemmonitorstop(handle);
+
   nslog(handle, NSLOG_DEBUG, "close: flushing buffer");
   flushbuffer(handle);
 
-  nslog(handle, NSLOG_DEBUG, "close: closing pipe read fd");
-  if (handle->prfd != -1) {
-    close(handle->prfd);
-    handle->prfd = -1;
-  }
-  nslog(handle, NSLOG_DEBUG, "close: closing pipe write fd");
-  if (handle->pwfd != -1) {
-    close(handle->pwfd);
-    handle->pwfd = -1;
-  }
+  nslog(handle, NSLOG_DEBUG, "close: closing abort fd");
+  closeabort(handle);
 
   nslog(handle, NSLOG_DEBUG, "close: flushing with TCIOFLUSH");
   if (tcflush(handle->fd, TCIOFLUSH)) {
@@ -15,7 +15,8 @@
 #ifndef NSERIAL_OPENSERIAL_H
 #define NSERIAL_OPENSERIAL_H
 
-// Number of bytes to allocate for temporary storage when reading data.
+// Default number of bytes to allocate for temporary storage when reading data.
+// See serial_setbuffersize().
 #define SERIALBUFFERSIZE 8192
 
 #endif
@@ -0,0 +1,247 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : pacing.c
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Paces the data written, for devices that have a small receive
+// FIFO and no flow control.
+//
+// The rate is limited with a token bucket, implemented as the generic cell
+// rate algorithm: instead of counting tokens, the time the bucket would be
+// empty is kept, so that no timer is needed to add tokens. The bucket holds
+// burst bytes. Bytes still in the output queue of the driver (TIOCOUTQ) are
+// sent at the baud rate together with new data, so they count against the
+// burst.
+//
+// For gaps between bytes or chunks, the time the chunk is sent is estimated
+// from the baud rate and the output queue, and is checked with TIOCOUTQ
+// before the next chunk is written.
+//
+// All sleeps are with clock_nanosleep() to an absolute time, so the rate
+// doesn't drift with the time taken to write.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define NSERIAL_EXPORTS
+#include "nserial.h"
+#include "serialhandle.h"
+#include "errmsg.h"
+#include "baudrate.h"
+#include "coalesce.h"
+#include "drain.h"
+#include "events.h"
+#include "timeutil.h"
+
+static long long timespecns(const struct timespec *ts)
+{
+  return (long long)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+static long long monotonicns(void)
+{
+  struct timespec now;
+  monotonictime(&now);
+  return timespecns(&now);
+}
+
+// Sleeps until the time wake of CLOCK_MONOTONIC in nanoseconds. Returns
+// non-zero if the deadline is before wake, after sleeping until the deadline.
+static int sleepuntil(long long wake, const struct timespec *deadline)
+{
+  int expired = FALSE;
+  struct timespec ts;
+  if (deadline && timespecns(deadline) <= wake) {
+    ts = *deadline;
+    expired = TRUE;
+  } else {
+    ts.tv_sec = wake / NSEC_PER_SEC;
+    ts.tv_nsec = wake % NSEC_PER_SEC;
+  }
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+  return expired;
+}
+
+// Gets the number of bytes that may be written at time now. If none, wake is
+// set to the time the next byte may be written.
+static size_t pacetokens(struct serialhandle *handle, long long now, long long *wake)
+{
+  long long interval = NSEC_PER_SEC / handle->pacing.rate;
+  if (interval == 0) interval = 1;
+  long long burst = handle->pacing.burst ? handle->pacing.burst : 1;
+  long long empty = handle->paceempty > now ? handle->paceempty : now;
+
+  long long tokens = (now + burst * interval - empty) / interval;
+  if (tokens <= 0) {
+    *wake = empty - (burst - 1) * interval;
+    return 0;
+  }
+  return tokens;
+}
+
+// Takes length bytes from the bucket at time now.
+static void paceconsume(struct serialhandle *handle, long long now, size_t length)
+{
+  long long interval = NSEC_PER_SEC / handle->pacing.rate;
+  if (interval == 0) interval = 1;
+  long long empty = handle->paceempty > now ? handle->paceempty : now;
+  handle->paceempty = empty + (long long)length * interval;
+}
+
+NSERIAL_EXPORT ssize_t WINAPI serial_writepaced(struct serialhandle *handle, const char *buffer, size_t length, int timeout)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  if (buffer == NULL) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (checkopen(handle)) return -1;
+
+  struct timespec deadlinets;
+  struct timespec *deadline = NULL;
+  if (timeout >= 0) {
+    struct timespec ts;
+    monotonictime(&deadlinets);
+    addtimespec(&deadlinets, mstotimespec(timeout, &ts));
+    deadline = &deadlinets;
+  }
+
+  struct serialpacing *pacing = &(handle->pacing);
+  long long chartimens = chartime(handle);
+  int gap = pacing->bytegap ? pacing->bytegap : pacing->chunkgap;
+  size_t written = 0;
+  while (written < length) {
+    size_t chunk = length - written;
+    if (pacing->bytegap) {
+      chunk = 1;
+    } else if (pacing->burst && chunk > (size_t)pacing->burst) {
+      chunk = pacing->burst;
+    }
+
+    long long now = monotonicns();
+    if (gap) {
+      // Wait until the previous chunk is estimated to be sent, and the gap
+      // after it. If the driver hasn't sent it yet (e.g. the estimate is
+      // short), the gap starts again when it's sent.
+      if (now < handle->pacenext) {
+        if (sleepuntil(handle->pacenext, deadline)) break;
+        continue;
+      }
+      int pending = drainpending(handle);
+      if (pending > 0) {
+        pending = drainuntil(handle, deadline);
+        if (pending == -1) return written ? (ssize_t)written : -1;
+        if (pending) break;
+        handle->pacenext = monotonicns() + (long long)gap * 1000;
+        continue;
+      }
+    }
+
+    if (pacing->rate) {
+      long long wake;
+      size_t tokens = pacetokens(handle, now, &wake);
+      if (tokens == 0) {
+        if (sleepuntil(wake, deadline)) break;
+        continue;
+      }
+      if (chunk > tokens) chunk = tokens;
+
+      // Bytes still queued by the driver would be received by the device
+      // together with this chunk.
+      long long burst = pacing->burst ? pacing->burst : 1;
+      int queued = drainpending(handle);
+      if (queued >= burst) {
+        if (sleepuntil(now + (queued - burst + 1) * chartimens, deadline)) break;
+        continue;
+      }
+      if (queued > 0 && chunk > (size_t)(burst - queued)) chunk = burst - queued;
+    }
+
+    // Data buffered by serial_setwritecoalesce() is written first.
+    ssize_t writebytes = 0;
+    ssize_t buffered = coalesceflush(handle);
+    if (buffered == -1) return written ? (ssize_t)written : -1;
+    if (!buffered) {
+      writebytes = writedata(handle, buffer + written, chunk);
+      if (writebytes == -1) return written ? (ssize_t)written : -1;
+    }
+    if (writebytes == 0) {
+      // The driver is full, so wait until it can be written to.
+      struct timespec remaining;
+      if (deadline && timeuntil(deadline, &remaining)) break;
+      serialevent_t event =
+        waitevent(handle, WRITEEVENT, deadline ? &remaining : NULL);
+      if ((int)event == -1) return written ? (ssize_t)written : -1;
+      continue;
+    }
+
+    written += writebytes;
+    if (pacing->rate) paceconsume(handle, now, writebytes);
+    if (gap) {
+      int queued = drainpending(handle);
+      if (queued < writebytes) queued = writebytes;
+      handle->pacenext = monotonicns() + queued * chartimens +
+        (long long)gap * 1000;
+    }
+  }
+
+  return written;
+}
+
+NSERIAL_EXPORT int WINAPI serial_setpacing(struct serialhandle *handle, const struct serialpacing *pacing)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  if (pacing == NULL) {
+    memset(&(handle->pacing), 0, sizeof(struct serialpacing));
+    return 0;
+  }
+
+  if (pacing->rate < 0 || pacing->burst < 0 ||
+      pacing->bytegap < 0 || pacing->chunkgap < 0 ||
+      (pacing->bytegap && pacing->chunkgap)) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+
+  handle->pacing = *pacing;
+  handle->paceempty = 0;
+  handle->pacenext = 0;
+  return 0;
+}
+
+NSERIAL_EXPORT int WINAPI serial_getpacing(struct serialhandle *handle, struct serialpacing *pacing)
+{
+  if (handle == NULL || pacing == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  *pacing = handle->pacing;
+  return 0;
+}
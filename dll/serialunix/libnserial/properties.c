@@ -70,6 +70,28 @@ NSERIAL_EXPORT int WINAPI serial_getdiscardnull(struct serialhandle *handle, int
   return 0;
 }
 
+NSERIAL_EXPORT int WINAPI serial_setreportbreak(struct serialhandle *handle, int reportbreak)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  handle->reportbreak = reportbreak ? 1 : 0;
+  return 0;
+}
+
+NSERIAL_EXPORT int WINAPI serial_getreportbreak(struct serialhandle *handle, int *reportbreak)
+{
+  if (handle == NULL || reportbreak == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  *reportbreak = handle->reportbreak;
+  return 0;
+}
+
 NSERIAL_EXPORT int WINAPI serial_setxonlimit(struct serialhandle *handle, int xonlimit)
 {
   if (handle == NULL) {
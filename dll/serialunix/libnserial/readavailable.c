@@ -0,0 +1,108 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : readavailable.c
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Reads all data that is available, to reduce the number of
+// system calls at high baud rates.
+//
+// By the time the first read returns, the driver has often received more
+// data. Instead of returning to wait for the next READEVENT, TIOCINQ is
+// checked and the data is read directly. If the driver is empty, it's
+// waited for more data until the time budget expires.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+
+#define NSERIAL_EXPORTS
+#include "nserial.h"
+#include "serialhandle.h"
+#include "errmsg.h"
+#include "events.h"
+#include "timeutil.h"
+
+// Gets the number of bytes the driver has received, counting the system
+// call. Returns -1 if it's not known.
+static int driverqueue(struct serialhandle *handle, int *calls)
+{
+#ifdef HAVE_TERMIOS_TIOCINQ
+  int queue;
+  (*calls)++;
+  if (ioctl(handle->fd, TIOCINQ, &queue) == 0) return queue;
+#endif
+  return -1;
+}
+
+NSERIAL_EXPORT ssize_t WINAPI serial_readavailable(struct serialhandle *handle, char *buffer, size_t length, int budget, int *syscalls)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  if (buffer == NULL || budget < 0) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (checkopen(handle)) return -1;
+
+  struct timespec deadline;
+  struct timespec budgetts;
+  budgetts.tv_sec = budget / 1000000;
+  budgetts.tv_nsec = (long)(budget % 1000000) * 1000;
+  monotonictime(&deadline);
+  addtimespec(&deadline, &budgetts);
+
+  // Reads are counted by the handle, as data cached in the ring is returned
+  // without a read.
+  unsigned int readcalls = handle->readcalls;
+  int calls = 0;
+  size_t total = 0;
+  int error = FALSE;
+
+  // The first read is like serial_read(), after a READEVENT.
+  int available = TRUE;
+  while (total < length) {
+    if (!available && !hasreaddata(handle)) {
+      int queue = driverqueue(handle, &calls);
+      if (queue <= 0) {
+        // Without TIOCINQ, the driver is polled after the budget expires.
+        struct timespec remaining;
+        if (timeuntil(&deadline, &remaining) && queue == 0) break;
+        calls++;
+        serialevent_t event = waitevent(handle, READEVENT, &remaining);
+        if ((int)event == -1) {
+          error = !total;
+          break;
+        }
+        if (!(event & READEVENT)) break;
+      }
+    }
+    available = FALSE;
+
+    ssize_t readbytes = readdata(handle, buffer + total, length - total);
+    if (readbytes == -1) {
+      error = !total;
+      break;
+    }
+    total += readbytes;
+  }
+
+  calls += handle->readcalls - readcalls;
+  if (syscalls) *syscalls = calls;
+  return error ? -1 : (ssize_t)total;
+}
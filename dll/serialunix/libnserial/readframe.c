@@ -0,0 +1,91 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : readframe.c
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Reads frames that are separated by silence on the line.
+//
+// Protocols such as Modbus RTU end a frame when nothing is received for 3.5
+// character times. The time each chunk arrives is taken directly after the
+// read, and the frame ends when the next chunk doesn't arrive within the gap,
+// which is independent of when the application gets to process the data.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+
+#define NSERIAL_EXPORTS
+#include "nserial.h"
+#include "serialhandle.h"
+#include "errmsg.h"
+#include "baudrate.h"
+#include "events.h"
+#include "timeutil.h"
+
+NSERIAL_EXPORT ssize_t WINAPI serial_readframe(struct serialhandle *handle, char *buffer, size_t length, int gap, int timeout)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  if (buffer == NULL || length == 0 || gap < 0) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (checkopen(handle)) return -1;
+
+  struct timespec gapts;
+  if (gap == 0) {
+    long long ns = chartime(handle) * 7 / 2;
+    gapts.tv_sec = ns / NSEC_PER_SEC;
+    gapts.tv_nsec = ns % NSEC_PER_SEC;
+  } else {
+    gapts.tv_sec = gap / 1000000;
+    gapts.tv_nsec = (long)(gap % 1000000) * 1000;
+  }
+
+  // Wait for the start of the frame.
+  struct timespec ts;
+  serialevent_t event = waitevent(handle, READEVENT, mstotimespec(timeout, &ts));
+  if ((int)event == -1) return -1;
+  if (!(event & READEVENT)) return 0;
+
+  struct timespec deadline;
+  monotonictime(&deadline);
+  addtimespec(&deadline, &gapts);
+
+  size_t total = 0;
+  while (total < length) {
+    ssize_t readbytes = readdata(handle, buffer + total, length - total);
+    if (readbytes == -1) return total ? (ssize_t)total : -1;
+    if (readbytes > 0) {
+      total += readbytes;
+      monotonictime(&deadline);
+      addtimespec(&deadline, &gapts);
+      if (total == length) break;
+    }
+
+    // The frame ends if nothing more arrives within the gap. If aborted, the
+    // frame received so far is returned.
+    struct timespec remaining;
+    if (timeuntil(&deadline, &remaining)) break;
+    event = waitevent(handle, READEVENT, &remaining);
+    if ((int)event == -1) return total ? (ssize_t)total : -1;
+    if (!(event & READEVENT)) break;
+  }
+  return total;
+}
@@ -0,0 +1,183 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : readuntil.c
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Reads records ending with a delimiter.
+//
+// Line oriented protocols otherwise read chunks and search for the delimiter
+// byte by byte in managed code. Here the data is read ahead into a buffer of
+// the handle, which is searched with memchr() or memmem(), which the C library
+// vectorises. Only the record is copied to the user, and the data after it is
+// kept for the next call. Data that was searched isn't searched again when
+// more data arrives.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// For memmem()
+#define _GNU_SOURCE
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define NSERIAL_EXPORTS
+#include "nserial.h"
+#include "serialhandle.h"
+#include "errmsg.h"
+#include "buffer.h"
+#include "events.h"
+#include "readuntil.h"
+#include "timeutil.h"
+
+int untilpending(struct serialhandle *handle)
+{
+  return handle->untillength > 0;
+}
+
+ssize_t untilcopy(struct serialhandle *handle, const struct iovec *iov, int iovcnt, struct timespec *ts)
+{
+  if (ts) *ts = handle->untilarrival.first;
+
+  size_t total = 0;
+  for (int i = 0; i < iovcnt && handle->untillength > 0; i++) {
+    size_t length = iov[i].iov_len;
+    if (length > handle->untillength) length = handle->untillength;
+    memcpy(iov[i].iov_base, handle->untilbuffer + handle->untilstart, length);
+    handle->untilstart += length;
+    handle->untillength -= length;
+    total += length;
+  }
+  if (handle->untilsearched > total) {
+    handle->untilsearched -= total;
+  } else {
+    handle->untilsearched = 0;
+  }
+  arrivalconsume(&(handle->untilarrival), handle->untillength);
+  return total;
+}
+
+void untilfree(struct serialhandle *handle)
+{
+  bufferfree(handle->untilbuffer, handle->buffersize);
+  handle->untilbuffer = NULL;
+  handle->untilstart = 0;
+  handle->untillength = 0;
+  handle->untilsearched = 0;
+}
+
+// Searches the data left over for the delimiter, skipping the data already
+// searched. Returns the length of the record including the delimiter, or 0 if
+// the delimiter wasn't found.
+static size_t untilsearch(struct serialhandle *handle, const char *delim, size_t delimlength)
+{
+  const char *data = handle->untilbuffer + handle->untilstart;
+  size_t length = handle->untillength;
+
+  // A delimiter may start in the data searched and end in new data.
+  size_t start = 0;
+  if (handle->untilsearched >= delimlength) {
+    start = handle->untilsearched - (delimlength - 1);
+  }
+  handle->untilsearched = length;
+  if (length - start < delimlength) return 0;
+
+  const char *found;
+  if (delimlength == 1) {
+    found = memchr(data + start, delim[0], length - start);
+  } else {
+    found = memmem(data + start, length - start, delim, delimlength);
+  }
+  if (found == NULL) return 0;
+
+  // Only the data before the last byte of the delimiter is known not to
+  // contain a delimiter, so a record that doesn't fit is found again.
+  handle->untilsearched = found - data + delimlength - 1;
+  return found - data + delimlength;
+}
+
+// Copies length bytes of the data left over to the users buffer.
+static ssize_t untilrecord(struct serialhandle *handle, char *buffer, size_t length)
+{
+  struct iovec iov;
+  iov.iov_base = buffer;
+  iov.iov_len = length;
+  return untilcopy(handle, &iov, 1, NULL);
+}
+
+NSERIAL_EXPORT ssize_t WINAPI serial_readuntil(struct serialhandle *handle, char *buffer, size_t length, const char *delim, size_t delimlength, int timeout)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  if (buffer == NULL || length == 0 || delim == NULL || delimlength == 0) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (checkopen(handle)) return -1;
+
+  if (handle->untilbuffer == NULL) {
+    handle->untilbuffer = bufferalloc(handle, handle->buffersize);
+    if (handle->untilbuffer == NULL) return -1;
+  }
+
+  struct timespec deadline;
+  struct timespec remaining;
+  if (timeout >= 0) {
+    monotonictime(&deadline);
+    addtimespec(&deadline, mstotimespec(timeout, &remaining));
+  }
+
+  while (TRUE) {
+    size_t record = untilsearch(handle, delim, delimlength);
+    if (record > 0) {
+      if (record > length) record = length;
+      return untilrecord(handle, buffer, record);
+    }
+
+    // The record doesn't fit, so it's returned in parts.
+    if (handle->untillength >= length ||
+        handle->untillength == handle->buffersize) {
+      return untilrecord(handle, buffer, length);
+    }
+
+    struct timespec *reltimeout = NULL;
+    if (timeout >= 0) {
+      timeuntil(&deadline, &remaining);
+      reltimeout = &remaining;
+    }
+    // The data left over isn't a record yet, so only the serial port can
+    // complete it.
+    serialevent_t event = waitport(handle, READEVENT, reltimeout);
+    if ((int)event == -1) return -1;
+
+    // Timeout or aborted. The data is kept for the next call.
+    if (!(event & READEVENT)) return 0;
+
+    if (handle->untilstart > 0) {
+      memmove(handle->untilbuffer,
+              handle->untilbuffer + handle->untilstart, handle->untillength);
+      handle->untilstart = 0;
+    }
+    struct iovec iov;
+    struct timespec ts;
+    iov.iov_base = handle->untilbuffer + handle->untillength;
+    iov.iov_len = handle->buffersize - handle->untillength;
+    ssize_t readbytes = readport(handle, &iov, 1, &ts);
+    if (readbytes == -1) return -1;
+    arrivaladd(&(handle->untilarrival), handle->untillength, readbytes, &ts);
+    handle->untillength += readbytes;
+  }
+}
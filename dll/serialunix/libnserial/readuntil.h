@@ -0,0 +1,37 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : readuntil.h
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Internal methods for data read ahead by serial_readuntil().
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifndef NSERIAL_READUNTIL_H
+#define NSERIAL_READUNTIL_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#include "nserial.h"
+
+// Returns non-zero if serial_readuntil() has data left over, which must be
+// read before the serial port. This is also data that was searched for the
+// delimiter, if serial_readuntil() returned without a record.
+int untilpending(struct serialhandle *handle);
+
+// Copies the data left over by serial_readuntil() into the vector. Returns
+// the number of bytes copied. If ts isn't NULL, it's set to the time the first
+// byte was read.
+ssize_t untilcopy(struct serialhandle *handle, const struct iovec *iov, int iovcnt, struct timespec *ts);
+
+// Frees the buffer of serial_readuntil(). Called when the handle is
+// terminated, or the buffer size changes.
+void untilfree(struct serialhandle *handle);
+
+#endif
@@ -0,0 +1,394 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : ring.c
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Single producer, single consumer receive and transmit rings,
+// owned by the library.
+//
+// serial_ring_service(), or the I/O thread if callbacks are set, is the
+// producer of the receive ring and the consumer of the transmit ring. The
+// application is the other side of each ring. Data
+// is read from the serial port directly into the receive ring, and written
+// from the transmit ring, so no lock or extra copy is needed in between.
+//
+// The thread servicing the rings doesn't wait for READEVENT if the receive
+// ring is full, nor for WRITEEVENT if the transmit ring is empty. So the
+// application must wake it with serial_abortwaitforevent() when it frees
+// space, or adds data. To avoid a system call for every commit, this is only
+// done if the ring was full or empty. Both sides store their own index then
+// load the other index, with sequential consistency, so at least one side
+// sees the update of the other and no wake up can be lost.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#define NSERIAL_EXPORTS
+#include "nserial.h"
+#include "serialhandle.h"
+#include "errmsg.h"
+#include "events.h"
+#include "ring.h"
+#include "buffer.h"
+#include "coalesce.h"
+#include "timeutil.h"
+
+// The largest ring that can be allocated.
+#define RINGMAXSIZE (1 << 30)
+
+// Alignment of the ring and its indices, so that the producer and consumer
+// don't contend for the same cache line.
+#define RINGALIGN 64
+
+struct serialring {
+  char                 *buffer;
+  size_t                size;           // Size of buffer, a power of 2
+  _Alignas(RINGALIGN) atomic_size_t head; // Next byte to consume
+  _Alignas(RINGALIGN) atomic_size_t tail; // Next byte to produce
+};
+
+static size_t roundpow2(size_t size)
+{
+  size_t result = RINGALIGN;
+  while (result < size) result <<= 1;
+  return result;
+}
+
+static void ringdestroy(struct serialring *ring)
+{
+  if (ring == NULL) return;
+  bufferfree(ring->buffer, ring->size);
+  free(ring);
+}
+
+static struct serialring *ringcreate(struct serialhandle *handle, size_t size)
+{
+  struct serialring *ring;
+  if (posix_memalign((void **)&ring, RINGALIGN, sizeof(struct serialring))) {
+    serial_seterror(handle, ERRMSG_OUTOFMEMORY);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  ring->size = roundpow2(size);
+  ring->buffer = bufferalloc(handle, ring->size);
+  if (ring->buffer == NULL) {
+    free(ring);
+    return NULL;
+  }
+  atomic_init(&(ring->head), 0);
+  atomic_init(&(ring->tail), 0);
+  return ring;
+}
+
+void ringreset(struct serialhandle *handle)
+{
+  if (handle->rxring) {
+    atomic_store(&(handle->rxring->head), 0);
+    atomic_store(&(handle->rxring->tail), 0);
+  }
+  if (handle->txring) {
+    atomic_store(&(handle->txring->head), 0);
+    atomic_store(&(handle->txring->tail), 0);
+  }
+}
+
+void ringfree(struct serialhandle *handle)
+{
+  ringdestroy(handle->rxring);
+  ringdestroy(handle->txring);
+  handle->rxring = NULL;
+  handle->txring = NULL;
+}
+
+// Returns the ring, or NULL with the error set if it isn't allocated.
+static struct serialring *getring(struct serialhandle *handle,
+                                  struct serialring *ring)
+{
+  if (ring == NULL) {
+    serial_seterror(handle, ERRMSG_RINGNOTALLOCATED);
+    errno = EINVAL;
+  }
+  return ring;
+}
+
+// Wakes the thread in serial_ring_service(), if the serial port is open.
+static int ringwakeup(struct serialhandle *handle)
+{
+  if (handle->fd == -1) return 0;
+  return serial_abortwaitforevent(handle);
+}
+
+NSERIAL_EXPORT int WINAPI serial_ring_init(struct serialhandle *handle, size_t rxsize, size_t txsize)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  if (handle->fd != -1) {
+    serial_seterror(handle, ERRMSG_SERIALPORTALREADYOPEN);
+    errno = EIO;
+    return -1;
+  }
+
+  if (rxsize > RINGMAXSIZE || txsize > RINGMAXSIZE) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+
+  struct serialring *rxring = NULL;
+  struct serialring *txring = NULL;
+  if (rxsize > 0) {
+    rxring = ringcreate(handle, rxsize);
+    if (rxring == NULL) return -1;
+  }
+  if (txsize > 0) {
+    txring = ringcreate(handle, txsize);
+    if (txring == NULL) {
+      ringdestroy(rxring);
+      return -1;
+    }
+  }
+
+  ringfree(handle);
+  handle->rxring = rxring;
+  handle->txring = txring;
+  return 0;
+}
+
+NSERIAL_EXPORT ssize_t WINAPI serial_ring_readpeek(struct serialhandle *handle, const char **buffer)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  if (buffer == NULL) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+
+  struct serialring *ring = getring(handle, handle->rxring);
+  if (ring == NULL) return -1;
+
+  size_t head = atomic_load_explicit(&(ring->head), memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&(ring->tail), memory_order_acquire);
+  size_t offset = head & (ring->size - 1);
+  size_t length = tail - head;
+  if (length > ring->size - offset) length = ring->size - offset;
+
+  *buffer = ring->buffer + offset;
+  return length;
+}
+
+NSERIAL_EXPORT int WINAPI serial_ring_readcommit(struct serialhandle *handle, size_t length)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  struct serialring *ring = getring(handle, handle->rxring);
+  if (ring == NULL) return -1;
+
+  size_t head = atomic_load_explicit(&(ring->head), memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&(ring->tail), memory_order_acquire);
+  if (length > tail - head) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+  if (length == 0) return 0;
+
+  atomic_store(&(ring->head), head + length);
+  if (atomic_load(&(ring->tail)) - head == ring->size) {
+    return ringwakeup(handle);
+  }
+  return 0;
+}
+
+NSERIAL_EXPORT ssize_t WINAPI serial_ring_writereserve(struct serialhandle *handle, char **buffer)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  if (buffer == NULL) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+
+  struct serialring *ring = getring(handle, handle->txring);
+  if (ring == NULL) return -1;
+
+  size_t tail = atomic_load_explicit(&(ring->tail), memory_order_relaxed);
+  size_t head = atomic_load_explicit(&(ring->head), memory_order_acquire);
+  size_t offset = tail & (ring->size - 1);
+  size_t length = ring->size - (tail - head);
+  if (length > ring->size - offset) length = ring->size - offset;
+
+  *buffer = ring->buffer + offset;
+  return length;
+}
+
+NSERIAL_EXPORT int WINAPI serial_ring_writecommit(struct serialhandle *handle, size_t length)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  struct serialring *ring = getring(handle, handle->txring);
+  if (ring == NULL) return -1;
+
+  size_t tail = atomic_load_explicit(&(ring->tail), memory_order_relaxed);
+  size_t head = atomic_load_explicit(&(ring->head), memory_order_acquire);
+  if (length > ring->size - (tail - head)) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+  if (length == 0) return 0;
+
+  atomic_store(&(ring->tail), tail + length);
+  if (atomic_load(&(ring->head)) == tail) {
+    return ringwakeup(handle);
+  }
+  return 0;
+}
+
+ssize_t ringfill(struct serialhandle *handle, struct serialring *ring)
+{
+  size_t tail = atomic_load_explicit(&(ring->tail), memory_order_relaxed);
+  size_t head = atomic_load(&(ring->head));
+  size_t offset = tail & (ring->size - 1);
+  size_t length = ring->size - (tail - head);
+  if (length == 0) return 0;
+
+  struct iovec iov[2];
+  int iovcnt = 1;
+  iov[0].iov_base = ring->buffer + offset;
+  iov[0].iov_len = length;
+  if (length > ring->size - offset) {
+    iov[0].iov_len = ring->size - offset;
+    iov[1].iov_base = ring->buffer;
+    iov[1].iov_len = length - iov[0].iov_len;
+    iovcnt = 2;
+  }
+
+  ssize_t readbytes = readdatav(handle, iov, iovcnt);
+  if (readbytes > 0) atomic_store(&(ring->tail), tail + readbytes);
+  return readbytes;
+}
+
+int ringpending(struct serialring *ring)
+{
+  if (ring == NULL) return FALSE;
+  size_t head = atomic_load_explicit(&(ring->head), memory_order_relaxed);
+  return atomic_load(&(ring->tail)) != head;
+}
+
+int ringspace(struct serialring *ring)
+{
+  if (ring == NULL) return FALSE;
+  size_t tail = atomic_load_explicit(&(ring->tail), memory_order_relaxed);
+  return tail - atomic_load(&(ring->head)) < ring->size;
+}
+
+ssize_t ringdrain(struct serialhandle *handle, struct serialring *ring)
+{
+  size_t head = atomic_load_explicit(&(ring->head), memory_order_relaxed);
+  size_t tail = atomic_load(&(ring->tail));
+  size_t offset = head & (ring->size - 1);
+  size_t length = tail - head;
+  if (length == 0) return 0;
+
+  struct iovec iov[2];
+  int iovcnt = 1;
+  iov[0].iov_base = ring->buffer + offset;
+  iov[0].iov_len = length;
+  if (length > ring->size - offset) {
+    iov[0].iov_len = ring->size - offset;
+    iov[1].iov_base = ring->buffer;
+    iov[1].iov_len = length - iov[0].iov_len;
+    iovcnt = 2;
+  }
+
+  ssize_t writebytes = coalescewritev(handle, iov, iovcnt);
+  if (writebytes > 0) atomic_store(&(ring->head), head + writebytes);
+  return writebytes;
+}
+
+NSERIAL_EXPORT serialevent_t WINAPI serial_ring_service(struct serialhandle *handle, int timeout)
+{
+  if (handle == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  serial_seterror(handle, ERRMSG_OK);
+
+  struct serialring *rxring = handle->rxring;
+  struct serialring *txring = handle->txring;
+  if (rxring == NULL && txring == NULL) {
+    serial_seterror(handle, ERRMSG_RINGNOTALLOCATED);
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (checkopen(handle)) return -1;
+
+  // The I/O thread already services the rings.
+  if (handle->iothread != NULL) {
+    serial_seterror(handle, ERRMSG_INVALIDPARAMETER);
+    errno = EINVAL;
+    return -1;
+  }
+
+  serialevent_t event = NOEVENT;
+  if (ringspace(rxring)) event |= READEVENT;
+  if (ringpending(txring)) event |= WRITEEVENT;
+
+  struct timespec ts;
+  serialevent_t gotevent = waitevent(handle, event, mstotimespec(timeout, &ts));
+  if ((int)gotevent == -1) return -1;
+
+  serialevent_t result = NOEVENT;
+  if (gotevent & READEVENT) {
+    ssize_t readbytes = ringfill(handle, rxring);
+    if (readbytes == -1) return -1;
+    if (readbytes > 0) result |= READEVENT;
+  }
+  if (gotevent & WRITEEVENT) {
+    ssize_t writebytes = ringdrain(handle, txring);
+    if (writebytes == -1) return -1;
+    if (writebytes > 0) result |= WRITEEVENT;
+  }
+  return result;
+}
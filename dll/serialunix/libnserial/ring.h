@@ -0,0 +1,46 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : ring.h
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Internal methods for the receive and transmit rings.
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifndef NSERIAL_RING_H
+#define NSERIAL_RING_H
+
+#include <sys/types.h>
+
+#include "nserial.h"
+
+// Empties the rings of the handle, if they are allocated. Called when the
+// serial port is opened.
+void ringreset(struct serialhandle *handle);
+
+// Returns non-zero if the transmit ring has data to write. Only called by the
+// thread that drains the ring.
+int ringpending(struct serialring *ring);
+
+// Returns non-zero if the receive ring has space to read into. Only called by
+// the thread that fills the ring.
+int ringspace(struct serialring *ring);
+
+// Reads from the serial port into the receive ring with a single system call,
+// also if the free space wraps at the end of the ring. Returns the number of
+// bytes read, or -1 on error.
+ssize_t ringfill(struct serialhandle *handle, struct serialring *ring);
+
+// Writes the transmit ring to the serial port with a single system call, also
+// if the data wraps at the end of the ring. Returns the number of bytes
+// written, or -1 on error.
+ssize_t ringdrain(struct serialhandle *handle, struct serialring *ring);
+
+// Frees the rings of the handle. Called when the handle is terminated.
+void ringfree(struct serialhandle *handle);
+
+#endif
@@ -16,11 +16,13 @@
 #define NSERIAL_SERIALHANDLE_H
 
 #include <pthread.h>
-#include <semaphore.h>
+#include <stdatomic.h>
 
 #define NSERIAL_EXPORTS
 #include "nserial.h"
 #include "types.h"
+#include "timeutil.h"
+#include "wakeup.h"
 
 typedef enum parityrepmode {
   PARMODE_INACTIVE = 0,
@@ -28,16 +30,6 @@ typedef enum parityrepmode {
   PARMODE_NOSTRIP  = 2
 } parityrepmode_t;
 
-struct modemstate {
-  struct serialhandle *handle;
-  serialmodemevent_t   waitevent;
-  serialmodemevent_t   eventresult;
-  int                  serialerror;
-  int                  posixerrno;
-  sem_t                modemevent;
-  int                  modemeventabort;
-};
-
 // Maximum number of ports we have in the port descrip
 #define MAXPORTS    64
 
@@ -57,6 +49,7 @@ struct serialhandle {
   serialhandshake_t  handshake;         // Handshake:
   int                txcontinueonxoff;  // TxContinueOnXOff boolean
   int                discardnull;       // DiscardNull boolean
+  int                reportbreak;       // ReportBreak boolean
   int                xonlimit;          // XOnLimit in bytes
   int                xofflimit;         // XOffLimit in bytes
   int                parityreplace;     // ParityReplace byte
@@ -64,25 +57,51 @@ struct serialhandle {
   int                breakstate;        // Current break state.
   struct serialmodembits modembits;     // Modem bits, until port is opened.
 
-  char              *tmpbuffer;         // Temporary buffer
-  int                tmpstart;          // Offset where last read starts
-  int                tmplength;         // Length of data to read
-  int                tmpread;           // If we should read into tmpbuffer
+  size_t             buffersize;        // Size of the internal buffers
+  int                lowlatency;        // LowLatency boolean
+  seriallowlatency_t lowlatencyapplied; // Settings changed for LowLatency
+  int                lowlatencyasync;   // Original ASYNC_LOW_LATENCY
+  int                lowlatencytimer;   // Original latency timer
+  char              *tmpbuffer;         // Ring of data not yet filtered
+  int                tmpstart;          // Offset of the data in the ring
+  int                tmplength;         // Length of the data in the ring
+  int                tmpread;           // Ring has data to filter
+  struct arrivaltime tmparrival;        // When the data in the ring arrived
+  char              *untilbuffer;       // Data read by serial_readuntil()
+  size_t             untilstart;        // Offset of the data in untilbuffer
+  size_t             untillength;       // Length of the data in untilbuffer
+  size_t             untilsearched;     // Length searched for the delimiter
+  struct arrivaltime untilarrival;      // When the data in untilbuffer arrived
+  unsigned int       readcalls;         // Number of reads from the driver
+  int                coalescedelay;     // Maximum delay of buffered writes in us
+  size_t             coalescethreshold; // Writes at least this long aren't buffered
+  char              *coalescebuffer;    // Buffered writes
+  size_t             coalescelength;    // Length of the data in coalescebuffer
+  struct timespec    coalescedeadline;  // When the buffered writes must be written
+  struct serialpacing pacing;           // Pacing of serial_writepaced()
+  long long          paceempty;         // Time in ns the token bucket is empty
+  long long          pacenext;          // Time in ns the next chunk may be written
 
-  // When handling the abort, we just can't rely on writing to the named
-  // pipe, as if some stupid program happens to abort a million times, it
-  // would eventually fill up the buffer and cause serial_abortwaitforevent()
-  // to block. Even if we solved that by ignoring write errors, it's not
-  // atomic and might still lead to some subtle race conditions. So we do
-  // it very carefully with a mutex. See events.c for details.
-  int                prfd;              // Pipe read file descriptor
-  int                pwfd;              // Pipe write file descriptor
-  int                abortpending;      // Flag if there is an abort pending
-  pthread_mutex_t    abortmutex;        // For synchronisation of abortpending
-                                        // and writing to the pipe
+  // When handling the abort, we just can't rely on writing to the pipe, as
+  // if some stupid program happens to abort a million times, it would
+  // eventually fill up the buffer and cause serial_abortwaitforevent() to
+  // block. So only the first abort signals the file descriptor, until the
+  // waiting thread clears the abortpending flag. See events.c for details.
+  struct wakeupfd    abortfd;           // Abort file descriptor
+  atomic_int         abortpending;      // Flag if there is an abort pending
   pthread_mutex_t    modemmutex;        // Managing modem events
-  struct modemstate *modemstate;        // Are we waiting on a modem event?
-  pthread_t          modemthread;       // Waiting on a modem event
+  struct modemmonitor *modemmonitor;    // Thread monitoring modem signals
+
+  struct serialring *rxring;            // Ring filled by serial_ring_service()
+  struct serialring *txring;            // Ring drained by serial_ring_service()
+
+  struct serialcallbacks callbacks;      // Callbacks for the I/O thread
+  void              *callbackdata;      // User data given to the callbacks
+  int                hascallbacks;      // Start the I/O thread on open
+  struct iothread   *iothread;          // The I/O thread, if running
+
+  struct serialeventloop *eventloop;    // Event loop handle is registered to
+  int                eventloopindex;    // Index of the handle in eventloop
 
   struct portdescription *ports;        // List of available ports
   char              *portbuffer;        // Space to write port description
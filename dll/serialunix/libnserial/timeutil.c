@@ -0,0 +1,94 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : timeutil.c
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Calculations with timeouts and deadlines.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "config.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "timeutil.h"
+
+void monotonictime(struct timespec *now)
+{
+  clock_gettime(CLOCK_MONOTONIC, now);
+}
+
+struct timespec *mstotimespec(int ms, struct timespec *ts)
+{
+  if (ms < 0) return NULL;
+  ts->tv_sec = ms / 1000;
+  ts->tv_nsec = (long)(ms % 1000) * NSEC_PER_MSEC;
+  return ts;
+}
+
+int timespectoms(const struct timespec *ts)
+{
+  if (ts == NULL) return -1;
+  if (ts->tv_sec < 0) return 0;
+  if (ts->tv_sec >= INT_MAX / 1000) return INT_MAX;
+  return (int)(ts->tv_sec * 1000 +
+               (ts->tv_nsec + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC);
+}
+
+int timespecvalid(const struct timespec *ts)
+{
+  return ts->tv_nsec >= 0 && ts->tv_nsec < NSEC_PER_SEC;
+}
+
+void addtimespec(struct timespec *ts, const struct timespec *add)
+{
+  ts->tv_sec += add->tv_sec;
+  ts->tv_nsec += add->tv_nsec;
+  if (ts->tv_nsec >= NSEC_PER_SEC) {
+    ts->tv_sec++;
+    ts->tv_nsec -= NSEC_PER_SEC;
+  }
+}
+
+int timeuntil(const struct timespec *deadline, struct timespec *remaining)
+{
+  struct timespec now;
+  monotonictime(&now);
+
+  remaining->tv_sec = deadline->tv_sec - now.tv_sec;
+  remaining->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+  if (remaining->tv_nsec < 0) {
+    remaining->tv_sec--;
+    remaining->tv_nsec += NSEC_PER_SEC;
+  }
+  if (remaining->tv_sec < 0 ||
+      (remaining->tv_sec == 0 && remaining->tv_nsec == 0)) {
+    remaining->tv_sec = 0;
+    remaining->tv_nsec = 0;
+    return 1;
+  }
+  return 0;
+}
+
+void arrivaladd(struct arrivaltime *arrival, size_t buffered, size_t length, const struct timespec *now)
+{
+  if (length == 0) return;
+  if (buffered == 0) arrival->first = *now;
+  arrival->last = *now;
+  arrival->lastlength = length;
+}
+
+void arrivalconsume(struct arrivaltime *arrival, size_t remaining)
+{
+  if (remaining <= arrival->lastlength) {
+    arrival->first = arrival->last;
+    arrival->lastlength = remaining;
+  }
+}
@@ -0,0 +1,62 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : timeutil.h
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : Calculations with timeouts and deadlines. All absolute times
+// are for CLOCK_MONOTONIC.
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifndef NSERIAL_TIMEUTIL_H
+#define NSERIAL_TIMEUTIL_H
+
+#include <time.h>
+
+#define NSEC_PER_SEC  1000000000L
+#define NSEC_PER_MSEC 1000000L
+
+// Gets the current time of CLOCK_MONOTONIC.
+void monotonictime(struct timespec *now);
+
+// Converts a timeout in milliseconds to a timespec. A negative timeout
+// returns NULL, meaning to wait forever, else ts is returned.
+struct timespec *mstotimespec(int ms, struct timespec *ts);
+
+// Converts the timespec to milliseconds for poll(), rounding up so that we
+// never wake up before the timeout. A NULL timespec returns -1.
+int timespectoms(const struct timespec *ts);
+
+// Returns non-zero if the nanoseconds of ts are in the range of a timespec.
+int timespecvalid(const struct timespec *ts);
+
+// Adds the relative time add to ts.
+void addtimespec(struct timespec *ts, const struct timespec *add);
+
+// Sets remaining to the time until the deadline, which is zero if the
+// deadline is in the past. Returns non-zero if the deadline has expired.
+int timeuntil(const struct timespec *deadline, struct timespec *remaining);
+
+// Tracks when the data in a buffer arrived, so that data kept for a later
+// read keeps the time it was read. Only the first byte and the last read are
+// tracked, which is exact as long as the data in the buffer comes from at most
+// two reads.
+struct arrivaltime {
+  struct timespec first;        // Arrival of the first byte in the buffer
+  struct timespec last;         // Arrival of the last read
+  size_t          lastlength;   // Length of the last read still buffered
+};
+
+// Records that length bytes that arrived at time now are added to a buffer
+// that had buffered bytes.
+void arrivaladd(struct arrivaltime *arrival, size_t buffered, size_t length, const struct timespec *now);
+
+// Records that data was removed from the start of a buffer, leaving
+// remaining bytes.
+void arrivalconsume(struct arrivaltime *arrival, size_t remaining);
+
+#endif
@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include "ptydevice.hpp"
+
+PtyDevice::PtyDevice()
+{
+  m_device[0] = 0;
+  m_master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (m_master == -1) return;
+
+  if (grantpt(m_master) || unlockpt(m_master) ||
+      ptsname_r(m_master, m_device, sizeof(m_device))) {
+    close(m_master);
+    m_master = -1;
+    m_device[0] = 0;
+  }
+}
+
+PtyDevice::~PtyDevice()
+{
+  if (m_master != -1) close(m_master);
+}
+
+bool PtyDevice::IsOpen()
+{
+  return m_master != -1;
+}
+
+const char *PtyDevice::GetDevice()
+{
+  return m_device;
+}
+
+int PtyDevice::GetMaster()
+{
+  return m_master;
+}
+
+// Closing the master hangs up the slave device opened by the library.
+void PtyDevice::Close()
+{
+  if (m_master != -1) close(m_master);
+  m_master = -1;
+}
+
+int PtyDevice::Write(const char *buffer, int length)
+{
+  return write(m_master, buffer, length);
+}
+
+int PtyDevice::Read(char *buffer, int length, int timeout)
+{
+  struct pollfd pfd;
+  pfd.fd = m_master;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  if (poll(&pfd, 1, timeout) <= 0) return 0;
+  return read(m_master, buffer, length);
+}
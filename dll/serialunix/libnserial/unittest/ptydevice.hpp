@@ -0,0 +1,26 @@
+#ifndef PTYDEVICE_HPP
+#define PTYDEVICE_HPP
+
+// A pseudo terminal pair, so that test cases can send data to a serial handle
+// without needing real hardware. The library opens the slave device, the
+// test case reads and writes the master file descriptor.
+class PtyDevice
+{
+public:
+  PtyDevice();
+  ~PtyDevice();
+
+  bool IsOpen();
+  const char *GetDevice();
+  int GetMaster();
+  void Close();
+
+  int Write(const char *buffer, int length);
+  int Read(char *buffer, int length, int timeout);
+
+private:
+  int  m_master;
+  char m_device[64];
+};
+
+#endif
@@ -0,0 +1,262 @@
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "gtest/gtest.h"
+#include "main.hpp"
+#include "ptydevice.hpp"
+#include "nserial.h"
+
+#define PORTS 4
+
+class SerialEventLoopTest : public ::testing::Test
+{
+protected:
+  SerialEventLoopTest();
+  virtual ~SerialEventLoopTest();
+
+  virtual void SetUp();
+  virtual void TearDown();
+
+protected:
+  struct serialeventloop *loop;
+  PtyDevice              pty[PORTS];
+  struct serialhandle   *handle[PORTS];
+};
+
+SerialEventLoopTest::SerialEventLoopTest() : ::testing::Test()
+{
+}
+
+SerialEventLoopTest::~SerialEventLoopTest()
+{
+}
+
+void SerialEventLoopTest::SetUp()
+{
+  for (int i = 0; i < PORTS; i++) handle[i] = NULL;
+
+  loop = serial_eventloop_init();
+  ASSERT_TRUE(loop != NULL)
+    << "Error initialising loop: " << strerror(errno) << " (" << errno << ")";
+
+  for (int i = 0; i < PORTS; i++) {
+    ASSERT_TRUE(pty[i].IsOpen());
+    handle[i] = serial_init();
+    ASSERT_TRUE(handle[i] != NULL)
+      << "Error initialising: " << strerror(errno) << " (" << errno << ")";
+    ASSERT_EQ(0, serial_setdevicename(handle[i], pty[i].GetDevice()));
+    ASSERT_EQ(0, serial_open(handle[i]))
+      << "Message: " << serial_error(handle[i]) << "; "
+      << "Error opening: " << strerror(errno) << " (" << errno << ")";
+    ASSERT_EQ(0, serial_setproperties(handle[i]))
+      << "Message: " << serial_error(handle[i]) << "; "
+      << "Error setting properties: " << strerror(errno) << " (" << errno << ")";
+  }
+}
+
+void SerialEventLoopTest::TearDown()
+{
+  serial_eventloop_terminate(loop);
+  for (int i = 0; i < PORTS; i++) {
+    if (handle[i] != NULL) serial_terminate(handle[i]);
+  }
+}
+
+TEST_F(SerialEventLoopTest, Timeout)
+{
+  struct serialeventresult results[PORTS];
+
+  for (int i = 0; i < PORTS; i++) {
+    ASSERT_EQ(0, serial_eventloop_add(loop, handle[i], READEVENT));
+  }
+  EXPECT_EQ(0, serial_eventloop_wait(loop, results, PORTS, 50));
+}
+
+TEST_F(SerialEventLoopTest, ReadEventsFromManyPorts)
+{
+  struct serialeventresult results[PORTS];
+
+  for (int i = 0; i < PORTS; i++) {
+    ASSERT_EQ(0, serial_eventloop_add(loop, handle[i], READEVENT));
+  }
+
+  ASSERT_EQ(1, pty[1].Write("a", 1));
+  ASSERT_EQ(1, pty[3].Write("b", 1));
+
+  int events = 0;
+  int found = 0;
+  for (int retry = 0; retry < 10 && found != ((1 << 1) | (1 << 3)); retry++) {
+    int n = serial_eventloop_wait(loop, results, PORTS, 100);
+    ASSERT_NE(-1, n) << "Error: " << strerror(errno) << " (" << errno << ")";
+    for (int r = 0; r < n; r++) {
+      events++;
+      EXPECT_EQ(READEVENT, results[r].event);
+      char buffer[16];
+      for (int i = 0; i < PORTS; i++) {
+        if (results[r].handle == handle[i]) {
+          found |= 1 << i;
+          EXPECT_EQ(1, serial_read(handle[i], buffer, sizeof(buffer)));
+        }
+      }
+    }
+  }
+  EXPECT_EQ((1 << 1) | (1 << 3), found);
+  EXPECT_EQ(2, events);
+}
+
+TEST_F(SerialEventLoopTest, ReadWriteMerged)
+{
+  struct serialeventresult results[PORTS];
+
+  ASSERT_EQ(0, serial_eventloop_add(loop, handle[0], READWRITEEVENT));
+  ASSERT_EQ(1, pty[0].Write("a", 1));
+  usleep(10000);
+
+  ASSERT_EQ(1, serial_eventloop_wait(loop, results, PORTS, 100));
+  EXPECT_EQ(handle[0], results[0].handle);
+  EXPECT_EQ(READWRITEEVENT, results[0].event);
+}
+
+TEST_F(SerialEventLoopTest, ModifyEvents)
+{
+  struct serialeventresult results[PORTS];
+
+  ASSERT_EQ(0, serial_eventloop_add(loop, handle[0], READEVENT));
+  EXPECT_EQ(0, serial_eventloop_wait(loop, results, PORTS, 10));
+
+  ASSERT_EQ(0, serial_eventloop_add(loop, handle[0], WRITEEVENT));
+  ASSERT_EQ(1, serial_eventloop_wait(loop, results, PORTS, 100));
+  EXPECT_EQ(handle[0], results[0].handle);
+  EXPECT_EQ(WRITEEVENT, results[0].event);
+}
+
+// A hangup isn't reported if the serial port isn't waited for, and must not
+// wake up the loop.
+TEST_F(SerialEventLoopTest, HangupNotWaited)
+{
+  struct serialeventresult results[PORTS];
+  struct timespec before, after;
+
+  ASSERT_EQ(0, serial_eventloop_add(loop, handle[0], NOEVENT));
+  pty[0].Close();
+
+  clock_gettime(CLOCK_MONOTONIC, &before);
+  EXPECT_EQ(0, serial_eventloop_wait(loop, results, PORTS, 50));
+  clock_gettime(CLOCK_MONOTONIC, &after);
+  long long elapsed = (after.tv_sec - before.tv_sec) * 1000LL +
+    (after.tv_nsec - before.tv_nsec) / 1000000;
+  EXPECT_LE(40, elapsed);
+
+  // Waiting for an error reports the hangup.
+  ASSERT_EQ(0, serial_eventloop_add(loop, handle[0], ERROREVENT));
+  ASSERT_EQ(1, serial_eventloop_wait(loop, results, PORTS, 100));
+  EXPECT_EQ(handle[0], results[0].handle);
+  EXPECT_EQ(ERROREVENT, results[0].event);
+}
+
+TEST_F(SerialEventLoopTest, Abort)
+{
+  struct serialeventresult results[PORTS];
+
+  for (int i = 0; i < PORTS; i++) {
+    ASSERT_EQ(0, serial_eventloop_add(loop, handle[i], READEVENT));
+  }
+
+  // Many aborts result in a single wake up.
+  ASSERT_EQ(0, serial_abortwaitforevent(handle[2]));
+  ASSERT_EQ(0, serial_abortwaitforevent(handle[2]));
+  ASSERT_EQ(1, serial_eventloop_wait(loop, results, PORTS, 100));
+  EXPECT_EQ(handle[2], results[0].handle);
+  EXPECT_EQ(NOEVENT, results[0].event);
+
+  EXPECT_EQ(0, serial_eventloop_wait(loop, results, PORTS, 10));
+}
+
+TEST_F(SerialEventLoopTest, MoreEventsThanResults)
+{
+  struct serialeventresult results[PORTS];
+
+  for (int i = 0; i < PORTS; i++) {
+    ASSERT_EQ(0, serial_eventloop_add(loop, handle[i], READEVENT));
+    ASSERT_EQ(0, serial_abortwaitforevent(handle[i]));
+  }
+
+  int found = 0;
+  ASSERT_EQ(2, serial_eventloop_wait(loop, results, 2, 100));
+  for (int r = 0; r < 2; r++) {
+    for (int i = 0; i < PORTS; i++) {
+      if (results[r].handle == handle[i]) found |= 1 << i;
+    }
+  }
+  ASSERT_EQ(2, serial_eventloop_wait(loop, results, 2, 100));
+  for (int r = 0; r < 2; r++) {
+    for (int i = 0; i < PORTS; i++) {
+      if (results[r].handle == handle[i]) found |= 1 << i;
+    }
+  }
+  EXPECT_EQ((1 << PORTS) - 1, found);
+  EXPECT_EQ(0, serial_eventloop_wait(loop, results, PORTS, 10));
+}
+
+TEST_F(SerialEventLoopTest, RemoveAndClose)
+{
+  struct serialeventresult results[PORTS];
+
+  ASSERT_EQ(0, serial_eventloop_add(loop, handle[0], READEVENT));
+  ASSERT_EQ(0, serial_eventloop_add(loop, handle[1], READEVENT));
+  ASSERT_EQ(0, serial_eventloop_remove(loop, handle[0]));
+  EXPECT_EQ(-1, serial_eventloop_remove(loop, handle[0]));
+  EXPECT_EQ(EINVAL, errno);
+
+  // Closing the serial port removes it from the loop.
+  ASSERT_EQ(0, serial_close(handle[1]));
+  EXPECT_EQ(-1, serial_eventloop_remove(loop, handle[1]));
+
+  ASSERT_EQ(0, serial_abortwaitforevent(handle[0]));
+  EXPECT_EQ(0, serial_eventloop_wait(loop, results, PORTS, 10));
+}
+
+TEST_F(SerialEventLoopTest, AddToTwoLoops)
+{
+  struct serialeventloop *loop2 = serial_eventloop_init();
+  ASSERT_TRUE(loop2 != NULL);
+
+  ASSERT_EQ(0, serial_eventloop_add(loop, handle[0], READEVENT));
+  EXPECT_EQ(-1, serial_eventloop_add(loop2, handle[0], READEVENT));
+  EXPECT_EQ(EINVAL, errno);
+
+  serial_eventloop_terminate(loop2);
+}
+
+// The transmitter being empty can't be waited for with epoll.
+TEST_F(SerialEventLoopTest, TxEmptyUnsupported)
+{
+  EXPECT_EQ(-1, serial_eventloop_add(loop, handle[0], (serialevent_t)(READEVENT | TXEMPTYEVENT)));
+  EXPECT_EQ(EINVAL, errno);
+}
+
+TEST_F(SerialEventLoopTest, ModemChangeUnsupported)
+{
+  struct serialeventresult results[PORTS];
+
+  ASSERT_EQ(0, serial_eventloop_add(loop, handle[0], READEVENT));
+  ASSERT_EQ(0, serial_eventloop_add(loop, handle[1], (serialevent_t)(READEVENT | MODEMCHANGEEVENT | ERROREVENT)));
+
+  // The monitor thread for a pseudo terminal stops with an error.
+  ASSERT_EQ(1, serial_eventloop_wait(loop, results, PORTS, 1000));
+  EXPECT_EQ(handle[1], results[0].handle);
+  EXPECT_EQ(ERROREVENT, results[0].event);
+
+  // The error remains until the serial port is removed.
+  ASSERT_EQ(1, serial_eventloop_wait(loop, results, PORTS, 0));
+  EXPECT_EQ(ERROREVENT, results[0].event);
+  ASSERT_EQ(0, serial_eventloop_add(loop, handle[1], READEVENT));
+  EXPECT_EQ(0, serial_eventloop_wait(loop, results, PORTS, 10));
+
+  ASSERT_EQ(0, serial_eventloop_add(loop, handle[1], (serialevent_t)(READEVENT | MODEMCHANGEEVENT | ERROREVENT)));
+  EXPECT_EQ(0, serial_close(handle[1]));
+  EXPECT_EQ(0, serial_eventloop_wait(loop, results, PORTS, 10));
+}
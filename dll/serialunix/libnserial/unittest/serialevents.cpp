@@ -0,0 +1,1144 @@
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "gtest/gtest.h"
+#include "main.hpp"
+#include "ptydevice.hpp"
+#include "nserial.h"
+
+class SerialEventsTest : public ::testing::Test
+{
+protected:
+  SerialEventsTest();
+  virtual ~SerialEventsTest();
+
+  virtual void SetUp();
+  virtual void TearDown();
+
+  void Open();
+
+protected:
+  PtyDevice            pty;
+  struct serialhandle *handle;
+};
+
+SerialEventsTest::SerialEventsTest() : ::testing::Test()
+{
+}
+
+SerialEventsTest::~SerialEventsTest()
+{
+}
+
+void SerialEventsTest::SetUp()
+{
+  ASSERT_TRUE(pty.IsOpen());
+  handle = serial_init();
+  ASSERT_TRUE(handle != NULL)
+    << "Error initialising: " << strerror(errno) << " (" << errno << ")";
+  ASSERT_EQ(0, serial_setdevicename(handle, pty.GetDevice()));
+}
+
+void SerialEventsTest::TearDown()
+{
+  serial_terminate(handle);
+}
+
+void SerialEventsTest::Open()
+{
+  ASSERT_EQ(0, serial_open(handle))
+    << "Message: " << serial_error(handle) << "; "
+    << "Error opening: " << strerror(errno) << " (" << errno << ")";
+  ASSERT_EQ(0, serial_setproperties(handle))
+    << "Message: " << serial_error(handle) << "; "
+    << "Error setting properties: " << strerror(errno) << " (" << errno << ")";
+}
+
+TEST_F(SerialEventsTest, ReadEvent)
+{
+  Open();
+
+  EXPECT_EQ(NOEVENT, serial_waitforevent(handle, READEVENT, 10));
+  ASSERT_EQ(3, pty.Write("abc", 3));
+  EXPECT_EQ(READEVENT, serial_waitforevent(handle, READEVENT, 100));
+
+  char buffer[16];
+  EXPECT_EQ(3, serial_read(handle, buffer, sizeof(buffer)));
+  EXPECT_EQ(0, memcmp("abc", buffer, 3));
+}
+
+TEST_F(SerialEventsTest, WriteEvent)
+{
+  Open();
+
+  EXPECT_EQ(WRITEEVENT, serial_waitforevent(handle, READWRITEEVENT, 100));
+  ASSERT_EQ(3, serial_write(handle, "abc", 3));
+
+  char buffer[16];
+  EXPECT_EQ(3, pty.Read(buffer, sizeof(buffer), 100));
+  EXPECT_EQ(0, memcmp("abc", buffer, 3));
+}
+
+TEST_F(SerialEventsTest, AbortBeforeWait)
+{
+  Open();
+
+  ASSERT_EQ(0, serial_abortwaitforevent(handle));
+  EXPECT_EQ(NOEVENT, serial_waitforevent(handle, READEVENT, -1));
+}
+
+static int elapsedms(const struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000 +
+    (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+TEST_F(SerialEventsTest, AbortCoalesced)
+{
+  Open();
+
+  for (int i = 0; i < 100000; i++) {
+    ASSERT_EQ(0, serial_abortwaitforevent(handle));
+  }
+  EXPECT_EQ(NOEVENT, serial_waitforevent(handle, READEVENT, -1));
+
+  // All aborts were consumed by the previous wait, so this one times out.
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  EXPECT_EQ(NOEVENT, serial_waitforevent(handle, READEVENT, 50));
+  EXPECT_GE(elapsedms(&start), 40);
+
+  // And a new abort after the wait is not lost.
+  ASSERT_EQ(0, serial_abortwaitforevent(handle));
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  EXPECT_EQ(NOEVENT, serial_waitforevent(handle, READEVENT, 5000));
+  EXPECT_LT(elapsedms(&start), 1000);
+}
+
+#define ABORTCOUNT 20000
+
+struct abortthreaddata {
+  struct serialhandle *handle;
+  volatile int         count;
+};
+
+static void *abortthread(void *arg)
+{
+  struct abortthreaddata *data = (struct abortthreaddata *)arg;
+  for (int i = 0; i < ABORTCOUNT; i++) {
+    __atomic_add_fetch(&(data->count), 1, __ATOMIC_RELAXED);
+    serial_abortwaitforevent(data->handle);
+  }
+  return NULL;
+}
+
+// An abort that occurs while the waiting thread is clearing the previous abort
+// must not be lost, else the waiting thread would block forever.
+TEST_F(SerialEventsTest, AbortFromThread)
+{
+  Open();
+
+  struct abortthreaddata data;
+  data.handle = handle;
+  data.count = 0;
+
+  pthread_t thread;
+  ASSERT_EQ(0, pthread_create(&thread, NULL, abortthread, &data));
+
+  int timeouts = 0;
+  while (__atomic_load_n(&(data.count), __ATOMIC_RELAXED) < ABORTCOUNT) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    EXPECT_EQ(NOEVENT, serial_waitforevent(handle, READEVENT, 2000));
+    if (elapsedms(&start) >= 2000) timeouts++;
+  }
+  pthread_join(thread, NULL);
+  EXPECT_EQ(0, timeouts);
+}
+
+TEST_F(SerialEventsTest, ServiceReadWrite)
+{
+  Open();
+
+  struct serialserviceresult result;
+  char buffer[16];
+
+  ASSERT_EQ(3, pty.Write("abc", 3));
+  usleep(10000);
+  ASSERT_EQ(0, serial_service(handle, buffer, sizeof(buffer), "xyz", 3, 100, &result));
+  EXPECT_EQ(READWRITEEVENT, result.event);
+  EXPECT_EQ(3, result.readbytes);
+  EXPECT_EQ(3, result.writebytes);
+  EXPECT_EQ(0, memcmp("abc", buffer, 3));
+
+  char ptybuffer[16];
+  EXPECT_EQ(3, pty.Read(ptybuffer, sizeof(ptybuffer), 100));
+  EXPECT_EQ(0, memcmp("xyz", ptybuffer, 3));
+}
+
+TEST_F(SerialEventsTest, ServiceReadOnly)
+{
+  Open();
+
+  struct serialserviceresult result;
+  char buffer[16];
+
+  ASSERT_EQ(0, serial_service(handle, buffer, sizeof(buffer), NULL, 0, 10, &result));
+  EXPECT_EQ(NOEVENT, result.event);
+  EXPECT_EQ(0, result.readbytes);
+  EXPECT_EQ(0, result.writebytes);
+
+  ASSERT_EQ(2, pty.Write("de", 2));
+  ASSERT_EQ(0, serial_service(handle, buffer, sizeof(buffer), NULL, 0, 100, &result));
+  EXPECT_EQ(READEVENT, result.event);
+  EXPECT_EQ(2, result.readbytes);
+  EXPECT_EQ(0, memcmp("de", buffer, 2));
+}
+
+TEST_F(SerialEventsTest, ServiceAbort)
+{
+  Open();
+
+  struct serialserviceresult result;
+
+  // Without buffers, the wait is only for an abort.
+  ASSERT_EQ(0, serial_abortwaitforevent(handle));
+  ASSERT_EQ(0, serial_service(handle, NULL, 0, NULL, 0, -1, &result));
+  EXPECT_EQ(NOEVENT, result.event);
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  ASSERT_EQ(0, serial_service(handle, NULL, 0, NULL, 0, 50, &result));
+  EXPECT_GE(elapsedms(&start), 40);
+}
+
+TEST_F(SerialEventsTest, ServiceInvalid)
+{
+  struct serialserviceresult result;
+  char buffer[16];
+
+  EXPECT_EQ(-1, serial_service(handle, buffer, sizeof(buffer), NULL, 0, 0, &result));
+  EXPECT_EQ(EIO, errno);
+
+  Open();
+  EXPECT_EQ(-1, serial_service(handle, NULL, 1, NULL, 0, 0, &result));
+  EXPECT_EQ(EINVAL, errno);
+  EXPECT_EQ(-1, serial_service(handle, buffer, sizeof(buffer), NULL, 0, 0, NULL));
+  EXPECT_EQ(EINVAL, errno);
+}
+
+TEST_F(SerialEventsTest, TimedWaitRelative)
+{
+  Open();
+
+  struct timespec timeout = {0, 2000000};
+  struct timespec remaining;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  EXPECT_EQ(NOEVENT, serial_timedwaitforevent(handle, READEVENT, &timeout, TIMEOUT_RELATIVE, &remaining));
+  EXPECT_GE(elapsedms(&start), 2);
+  EXPECT_LT(elapsedms(&start), 50);
+  EXPECT_EQ(0, remaining.tv_sec);
+  EXPECT_EQ(0, remaining.tv_nsec);
+
+  ASSERT_EQ(1, pty.Write("a", 1));
+  timeout.tv_sec = 5;
+  timeout.tv_nsec = 0;
+  EXPECT_EQ(READEVENT, serial_timedwaitforevent(handle, READEVENT, &timeout, TIMEOUT_RELATIVE, &remaining));
+  EXPECT_GE(remaining.tv_sec, 3);
+}
+
+TEST_F(SerialEventsTest, TimedWaitAbsolute)
+{
+  Open();
+
+  struct timespec deadline;
+  struct timespec remaining;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_nsec += 20000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  // An abort returns early. Waiting again to the same deadline doesn't drift.
+  ASSERT_EQ(0, serial_abortwaitforevent(handle));
+  EXPECT_EQ(NOEVENT, serial_timedwaitforevent(handle, NOEVENT, &deadline, TIMEOUT_ABSOLUTE, &remaining));
+  EXPECT_TRUE(remaining.tv_sec > 0 || remaining.tv_nsec > 0);
+  EXPECT_EQ(NOEVENT, serial_timedwaitforevent(handle, NOEVENT, &deadline, TIMEOUT_ABSOLUTE, &remaining));
+  EXPECT_EQ(0, remaining.tv_sec);
+  EXPECT_EQ(0, remaining.tv_nsec);
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  EXPECT_TRUE(now.tv_sec > deadline.tv_sec ||
+              (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec));
+
+  // A deadline in the past doesn't wait.
+  EXPECT_EQ(NOEVENT, serial_timedwaitforevent(handle, READEVENT, &deadline, TIMEOUT_ABSOLUTE, NULL));
+}
+
+TEST_F(SerialEventsTest, TimedWaitInvalid)
+{
+  Open();
+
+  struct timespec timeout = {0, 1000000000};
+  EXPECT_EQ(-1, serial_timedwaitforevent(handle, READEVENT, &timeout, TIMEOUT_RELATIVE, NULL));
+  EXPECT_EQ(EINVAL, errno);
+}
+
+TEST_F(SerialEventsTest, ErrorEventHangup)
+{
+  Open();
+
+  EXPECT_EQ(NOEVENT, serial_waitforevent(handle, ERROREVENT, 10));
+  pty.Close();
+  EXPECT_EQ(ERROREVENT, serial_waitforevent(handle, ERROREVENT, 1000));
+  EXPECT_EQ(READEVENT | ERROREVENT, serial_waitforevent(handle, (serialevent_t)(READEVENT | ERROREVENT), 1000));
+}
+
+// A pseudo terminal has no modem signals, so the thread monitoring them stops
+// and that is reported as an error.
+TEST_F(SerialEventsTest, ModemChangeUnsupported)
+{
+  Open();
+
+  EXPECT_EQ(ERROREVENT, serial_waitforevent(handle, (serialevent_t)(MODEMCHANGEEVENT | ERROREVENT), 1000));
+  EXPECT_EQ(MODEMEVENT_ERROR, serial_timedwaitformodemevent(handle, MODEMEVENT_CTS, 0));
+
+  // Data is still reported, and the error isn't reported again once
+  // serial_timedwaitformodemevent() returned it.
+  ASSERT_EQ(1, pty.Write("a", 1));
+  usleep(10000);
+  EXPECT_EQ(READEVENT, serial_waitforevent(handle, (serialevent_t)(READEVENT | MODEMCHANGEEVENT | ERROREVENT), 1000));
+}
+
+// Ensure that waiting works with file descriptors that select() can't handle.
+TEST_F(SerialEventsTest, HighFileDescriptor)
+{
+  const int highfd = 1100;
+
+  struct rlimit limit;
+  ASSERT_EQ(0, getrlimit(RLIMIT_NOFILE, &limit));
+  if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < highfd + 16) {
+    if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < highfd + 16) {
+      GTEST_SKIP() << "RLIMIT_NOFILE is too small";
+    }
+    limit.rlim_cur = highfd + 16;
+    ASSERT_EQ(0, setrlimit(RLIMIT_NOFILE, &limit));
+  }
+
+  // Use all file descriptors below highfd, so the serial port and the
+  // internal file descriptors of the library are above FD_SETSIZE.
+  std::vector<int> fds;
+  int fd;
+  do {
+    fd = open("/dev/null", O_RDONLY);
+    ASSERT_NE(-1, fd);
+    fds.push_back(fd);
+  } while (fd < highfd);
+
+  Open();
+  for (size_t i = 0; i < fds.size(); i++) close(fds[i]);
+  ASSERT_GE(serial_getfd(handle), highfd);
+
+  EXPECT_EQ(NOEVENT, serial_waitforevent(handle, READEVENT, 10));
+  ASSERT_EQ(3, pty.Write("abc", 3));
+  EXPECT_EQ(READEVENT, serial_waitforevent(handle, READEVENT, 100));
+
+  char buffer[16];
+  EXPECT_EQ(3, serial_read(handle, buffer, sizeof(buffer)));
+  EXPECT_EQ(0, memcmp("abc", buffer, 3));
+
+  ASSERT_EQ(0, serial_abortwaitforevent(handle));
+  EXPECT_EQ(NOEVENT, serial_waitforevent(handle, READEVENT, -1));
+  EXPECT_EQ(NOEVENT, serial_waitforevent(handle, READEVENT, 10));
+}
+
+TEST_F(SerialEventsTest, ReadVector)
+{
+  char header[2];
+  char payload[4];
+  struct iovec iov[2];
+  iov[0].iov_base = header;
+  iov[0].iov_len = sizeof(header);
+  iov[1].iov_base = payload;
+  iov[1].iov_len = sizeof(payload);
+
+  Open();
+  ASSERT_EQ(5, pty.Write("abcde", 5));
+  EXPECT_EQ(READEVENT, serial_waitforevent(handle, READEVENT, 100));
+  EXPECT_EQ(5, serial_readv(handle, iov, 2));
+  EXPECT_EQ(0, memcmp("ab", header, 2));
+  EXPECT_EQ(0, memcmp("cde", payload, 3));
+}
+
+TEST_F(SerialEventsTest, WriteVector)
+{
+  char buffer[16];
+  struct iovec iov[3];
+  iov[0].iov_base = (void *)"hdr";
+  iov[0].iov_len = 3;
+  iov[1].iov_base = (void *)"data";
+  iov[1].iov_len = 4;
+  iov[2].iov_base = (void *)"C";
+  iov[2].iov_len = 1;
+
+  Open();
+  EXPECT_EQ(8, serial_writev(handle, iov, 3));
+  ASSERT_EQ(8, pty.Read(buffer, sizeof(buffer), 1000));
+  EXPECT_EQ(0, memcmp("hdrdataC", buffer, 8));
+}
+
+TEST_F(SerialEventsTest, VectorInvalid)
+{
+  struct iovec iov;
+  iov.iov_base = NULL;
+  iov.iov_len = 1;
+
+  Open();
+  EXPECT_EQ(-1, serial_readv(handle, &iov, 1));
+  EXPECT_EQ(EINVAL, errno);
+  EXPECT_EQ(-1, serial_writev(handle, &iov, -1));
+  EXPECT_EQ(EINVAL, errno);
+}
+
+// The filtered data is scattered over the vector, and data that doesn't fit
+// is returned by the next read.
+TEST_F(SerialEventsTest, ReadVectorDiscardNull)
+{
+  char buffer[8];
+  struct iovec iov[2];
+  iov[0].iov_base = buffer;
+  iov[0].iov_len = 1;
+  iov[1].iov_base = buffer + 1;
+  iov[1].iov_len = 2;
+
+  ASSERT_EQ(0, serial_setdiscardnull(handle, 1));
+  Open();
+  ASSERT_EQ(9, pty.Write("a\0b\0\0c\0de", 9));
+  EXPECT_EQ(READEVENT, serial_waitforevent(handle, READEVENT, 100));
+  EXPECT_EQ(3, serial_readv(handle, iov, 2));
+  EXPECT_EQ(0, memcmp("abc", buffer, 3));
+
+  // The remaining data is cached, so the wait returns immediately.
+  EXPECT_EQ(READEVENT, serial_waitforevent(handle, READEVENT, 0));
+  EXPECT_EQ(2, serial_readv(handle, iov, 2));
+  EXPECT_EQ(0, memcmp("de", buffer, 2));
+  EXPECT_EQ(NOEVENT, serial_waitforevent(handle, READEVENT, 0));
+}
+
+// The terminal escapes 0xFF as 0xFF 0xFF, which must be kept when the buffer
+// of the user is full.
+TEST_F(SerialEventsTest, ReadParityEscapeCached)
+{
+  char buffer[8];
+
+  ASSERT_EQ(0, serial_setparity(handle, EVEN));
+  ASSERT_EQ(0, serial_setparityreplace(handle, '?'));
+  Open();
+  ASSERT_EQ(2, pty.Write("a\xff", 2));
+  EXPECT_EQ(READEVENT, serial_waitforevent(handle, READEVENT, 100));
+  EXPECT_EQ(1, serial_read(handle, buffer, 1));
+  EXPECT_EQ('a', buffer[0]);
+  EXPECT_EQ(1, serial_read(handle, buffer, sizeof(buffer)));
+  EXPECT_EQ('\xff', buffer[0]);
+}
+
+// Data with bytes to filter, and the result of filtering it.
+static void FilterData(std::vector<char> &data, std::vector<char> &expected)
+{
+  data.resize(1000);
+  for (size_t i = 0; i < data.size(); i++) {
+    if (i % 37 == 5 || i % 53 == 0) {
+      data[i] = '\0';
+    } else if (i % 41 == 7 || i == data.size() - 1) {
+      data[i] = '\xff';
+    } else {
+      data[i] = 'a' + (i % 26);
+    }
+    if (data[i]) expected.push_back(data[i]);
+  }
+}
+
+// Filtered data is copied in blocks between the bytes to filter, which must
+// give the same result as filtering byte by byte, independent of where the
+// bytes are in a block. Reads of the given length alternate with writes.
+static void ReadFiltered(PtyDevice &pty, struct serialhandle *handle, size_t chunk)
+{
+  std::vector<char> data;
+  std::vector<char> expected;
+  FilterData(data, expected);
+
+  ASSERT_EQ(0, serial_setparity(handle, EVEN));
+  ASSERT_EQ(0, serial_setparityreplace(handle, '?'));
+  ASSERT_EQ(0, serial_setdiscardnull(handle, 1));
+  ASSERT_EQ(0, serial_open(handle));
+  ASSERT_EQ(0, serial_setproperties(handle));
+
+  std::vector<char> buffer(expected.size() + chunk);
+  size_t written = 0;
+  size_t length = 0;
+  while (length < expected.size()) {
+    if (written < data.size()) {
+      // Odd sizes so that escape sequences are split over reads.
+      size_t towrite = data.size() - written;
+      if (towrite > 97) towrite = 97;
+      ASSERT_EQ((ssize_t)towrite, pty.Write(&data[written], towrite));
+      written += towrite;
+    }
+    ASSERT_EQ(READEVENT, serial_waitforevent(handle, READEVENT, 1000));
+    ssize_t readbytes = serial_read(handle, &buffer[length], chunk);
+    ASSERT_LE(0, readbytes);
+    length += readbytes;
+  }
+  buffer.resize(length);
+  EXPECT_TRUE(expected == buffer);
+}
+
+TEST_F(SerialEventsTest, ReadFilterLarge)
+{
+  ReadFiltered(pty, handle, 1000);
+}
+
+// Small reads are buffered by the library.
+TEST_F(SerialEventsTest, ReadFilterSmall)
+{
+  ReadFiltered(pty, handle, 7);
+}
+
+// Large reads are filtered in the users buffer.
+TEST_F(SerialEventsTest, ReadFilterInPlace)
+{
+  ReadFiltered(pty, handle, 300);
+}
+
+TEST_F(SerialEventsTest, BufferSize)
+{
+  size_t size;
+  ASSERT_EQ(0, serial_getbuffersize(handle, &size));
+  EXPECT_EQ(8192u, size);
+  EXPECT_EQ(-1, serial_setbuffersize(handle, 63));
+  EXPECT_EQ(EINVAL, errno);
+  EXPECT_EQ(-1, serial_getbuffersize(handle, NULL));
+  EXPECT_EQ(EINVAL, errno);
+  ASSERT_EQ(0, serial_setbuffersize(handle, 64));
+  ASSERT_EQ(0, serial_getbuffersize(handle, &size));
+  EXPECT_EQ(64u, size);
+
+  Open();
+  EXPECT_EQ(-1, serial_setbuffersize(handle, 4096));
+  EXPECT_EQ(EIO, errno);
+}
+
+// The smallest buffer still keeps the data that doesn't fit.
+TEST_F(SerialEventsTest, ReadFilterSmallBuffer)
+{
+  ASSERT_EQ(0, serial_setbuffersize(handle, 64));
+  ReadFiltered(pty, handle, 7);
+}
+
+// A buffer large enough to be mapped with huge pages.
+TEST_F(SerialEventsTest, ReadFilterLargeBuffer)
+{
+  ASSERT_EQ(0, serial_setbuffersize(handle, 4 * 1024 * 1024));
+  ReadFiltered(pty, handle, 7);
+}
+
+// A pseudo terminal can't generate parity errors, but the escaped 0xFF must
+// still be read as data without errors.
+TEST_F(SerialEventsTest, ReadErrorsEscaped)
+{
+  char buffer[16];
+  struct serialrxerrorinfo errors[4];
+  int errorcount = -1;
+
+  ASSERT_EQ(0, serial_setparity(handle, EVEN));
+  ASSERT_EQ(0, serial_setparityreplace(handle, '?'));
+  Open();
+  ASSERT_EQ(4, pty.Write("a\xff" "b\xff", 4));
+  EXPECT_EQ(READEVENT, serial_waitforevent(handle, READEVENT, 100));
+  EXPECT_EQ(4, serial_readerrors(handle, buffer, sizeof(buffer),
+                                 errors, 4, &errorcount));
+  EXPECT_EQ(0, memcmp("a\xff" "b\xff", buffer, 4));
+  EXPECT_EQ(0, errorcount);
+}
+
+TEST_F(SerialEventsTest, ReadErrorsNotFiltered)
+{
+  char buffer[16];
+  struct serialrxerrorinfo errors[4];
+  int errorcount = -1;
+
+  Open();
+  ASSERT_EQ(3, pty.Write("abc", 3));
+  EXPECT_EQ(READEVENT, serial_waitforevent(handle, READEVENT, 100));
+  EXPECT_EQ(3, serial_readerrors(handle, buffer, sizeof(buffer),
+                                 errors, 4, &errorcount));
+  EXPECT_EQ(0, memcmp("abc", buffer, 3));
+  EXPECT_EQ(0, errorcount);
+}
+
+TEST_F(SerialEventsTest, ReadErrorsInvalid)
+{
+  char buffer[16];
+  struct serialrxerrorinfo errors[4];
+  int errorcount;
+
+  Open();
+  EXPECT_EQ(-1, serial_readerrors(handle, buffer, sizeof(buffer),
+                                  errors, 0, &errorcount));
+  EXPECT_EQ(EINVAL, errno);
+  EXPECT_EQ(-1, serial_readerrors(handle, buffer, sizeof(buffer),
+                                  NULL, 4, &errorcount));
+  EXPECT_EQ(EINVAL, errno);
+  EXPECT_EQ(-1, serial_readerrors(handle, buffer, sizeof(buffer),
+                                  errors, 4, NULL));
+  EXPECT_EQ(EINVAL, errno);
+}
+
+TEST_F(SerialEventsTest, ReadUntil)
+{
+  char buffer[32];
+
+  Open();
+  ASSERT_EQ(10, pty.Write("$GPA,1\n$GP", 10));
+  EXPECT_EQ(7, serial_readuntil(handle, buffer, sizeof(buffer), "\n", 1, 1000));
+  EXPECT_EQ(0, memcmp("$GPA,1\n", buffer, 7));
+
+  // The start of the next record is kept until the rest is received.
+  EXPECT_EQ(0, serial_readuntil(handle, buffer, sizeof(buffer), "\n", 1, 10));
+  ASSERT_EQ(9, pty.Write("B,2\n$GPC\n", 9));
+  EXPECT_EQ(7, serial_readuntil(handle, buffer, sizeof(buffer), "\n", 1, 1000));
+  EXPECT_EQ(0, memcmp("$GPB,2\n", buffer, 7));
+
+  // The remaining record is already received.
+  EXPECT_EQ(READEVENT, serial_waitforevent(handle, READEVENT, 0));
+  EXPECT_EQ(5, serial_readuntil(handle, buffer, sizeof(buffer), "\n", 1, 0));
+  EXPECT_EQ(0, memcmp("$GPC\n", buffer, 5));
+  EXPECT_EQ(NOEVENT, serial_waitforevent(handle, READEVENT, 0));
+}
+
+// The delimiter may be split over reads.
+TEST_F(SerialEventsTest, ReadUntilMultiByte)
+{
+  char buffer[32];
+
+  Open();
+  ASSERT_EQ(5, pty.Write("OK\r\nE", 5));
+  EXPECT_EQ(4, serial_readuntil(handle, buffer, sizeof(buffer), "\r\n", 2, 1000));
+  EXPECT_EQ(0, memcmp("OK\r\n", buffer, 4));
+
+  ASSERT_EQ(5, pty.Write("RROR\r", 5));
+  EXPECT_EQ(0, serial_readuntil(handle, buffer, sizeof(buffer), "\r\n", 2, 10));
+  ASSERT_EQ(1, pty.Write("\n", 1));
+  EXPECT_EQ(7, serial_readuntil(handle, buffer, sizeof(buffer), "\r\n", 2, 1000));
+  EXPECT_EQ(0, memcmp("ERROR\r\n", buffer, 7));
+}
+
+// A record longer than the buffer is returned in parts.
+TEST_F(SerialEventsTest, ReadUntilLongRecord)
+{
+  char buffer[4];
+
+  Open();
+  ASSERT_EQ(7, pty.Write("abcdef\n", 7));
+  EXPECT_EQ(4, serial_readuntil(handle, buffer, sizeof(buffer), "\n", 1, 1000));
+  EXPECT_EQ(0, memcmp("abcd", buffer, 4));
+  EXPECT_EQ(3, serial_readuntil(handle, buffer, sizeof(buffer), "\n", 1, 1000));
+  EXPECT_EQ(0, memcmp("ef\n", buffer, 3));
+}
+
+// Data after the record is returned first by serial_read().
+TEST_F(SerialEventsTest, ReadUntilThenRead)
+{
+  char buffer[32];
+
+  Open();
+  ASSERT_EQ(6, pty.Write("ab\ncde", 6));
+  EXPECT_EQ(3, serial_readuntil(handle, buffer, sizeof(buffer), "\n", 1, 1000));
+  EXPECT_EQ(READEVENT, serial_waitforevent(handle, READEVENT, 0));
+  EXPECT_EQ(3, serial_read(handle, buffer, sizeof(buffer)));
+  EXPECT_EQ(0, memcmp("cde", buffer, 3));
+  EXPECT_EQ(NOEVENT, serial_waitforevent(handle, READEVENT, 0));
+}
+
+// Data searched by serial_readuntil() that timed out is read first.
+TEST_F(SerialEventsTest, ReadUntilTimeoutThenRead)
+{
+  char buffer[32];
+
+  Open();
+  ASSERT_EQ(3, pty.Write("$GP", 3));
+  EXPECT_EQ(0, serial_readuntil(handle, buffer, sizeof(buffer), "\n", 1, 50));
+  EXPECT_EQ(READEVENT, serial_waitforevent(handle, READEVENT, 0));
+  ASSERT_EQ(3, pty.Write("XYZ", 3));
+  EXPECT_EQ(3, serial_read(handle, buffer, sizeof(buffer)));
+  EXPECT_EQ(0, memcmp("$GP", buffer, 3));
+  EXPECT_EQ(READEVENT, serial_waitforevent(handle, READEVENT, 1000));
+  EXPECT_EQ(3, serial_read(handle, buffer, sizeof(buffer)));
+  EXPECT_EQ(0, memcmp("XYZ", buffer, 3));
+}
+
+// A record completed by more data after a timeout is found.
+TEST_F(SerialEventsTest, ReadUntilTimeoutThenRecord)
+{
+  char buffer[32];
+
+  Open();
+  ASSERT_EQ(3, pty.Write("$GP", 3));
+  EXPECT_EQ(0, serial_readuntil(handle, buffer, sizeof(buffer), "\n", 1, 50));
+  ASSERT_EQ(3, pty.Write("X\nY", 3));
+  EXPECT_EQ(5, serial_readuntil(handle, buffer, sizeof(buffer), "\n", 1, 1000));
+  EXPECT_EQ(0, memcmp("$GPX\n", buffer, 5));
+  EXPECT_EQ(1, serial_read(handle, buffer, sizeof(buffer)));
+  EXPECT_EQ('Y', buffer[0]);
+}
+
+TEST_F(SerialEventsTest, ReadUntilInvalid)
+{
+  char buffer[32];
+
+  EXPECT_EQ(-1, serial_readuntil(handle, buffer, sizeof(buffer), "\n", 1, 0));
+  EXPECT_EQ(EIO, errno);
+  Open();
+  EXPECT_EQ(-1, serial_readuntil(handle, buffer, sizeof(buffer), "\n", 0, 0));
+  EXPECT_EQ(EINVAL, errno);
+  EXPECT_EQ(-1, serial_readuntil(handle, buffer, 0, "\n", 1, 0));
+  EXPECT_EQ(EINVAL, errno);
+}
+
+struct writethreaddata {
+  PtyDevice  *pty;
+  const char *data;
+  int         delay;
+};
+
+// Writes to the pseudo terminal after the delay in milliseconds.
+static void *writethread(void *ptr)
+{
+  struct writethreaddata *data = (struct writethreaddata *)ptr;
+  usleep(data->delay * 1000);
+  data->pty->Write(data->data, strlen(data->data));
+  return NULL;
+}
+
+TEST_F(SerialEventsTest, ReadFrame)
+{
+  char buffer[32];
+
+  Open();
+  EXPECT_EQ(0, serial_readframe(handle, buffer, sizeof(buffer), 0, 10));
+  ASSERT_EQ(4, pty.Write("\x01\x03\x00\x01", 4));
+  EXPECT_EQ(4, serial_readframe(handle, buffer, sizeof(buffer), 0, 1000));
+  EXPECT_EQ(0, memcmp("\x01\x03\x00\x01", buffer, 4));
+}
+
+// Data arriving within the gap belongs to the same frame, and data after the
+// gap to the next frame.
+TEST_F(SerialEventsTest, ReadFrameGap)
+{
+  char buffer[32];
+  struct writethreaddata first = { &pty, "cd", 20 };
+  struct writethreaddata second = { &pty, "ef", 300 };
+
+  Open();
+  ASSERT_EQ(2, pty.Write("ab", 2));
+  pthread_t thread1, thread2;
+  ASSERT_EQ(0, pthread_create(&thread1, NULL, writethread, &first));
+  ASSERT_EQ(0, pthread_create(&thread2, NULL, writethread, &second));
+
+  EXPECT_EQ(4, serial_readframe(handle, buffer, sizeof(buffer), 100000, 1000));
+  EXPECT_EQ(0, memcmp("abcd", buffer, 4));
+  EXPECT_EQ(2, serial_readframe(handle, buffer, sizeof(buffer), 100000, 1000));
+  EXPECT_EQ(0, memcmp("ef", buffer, 2));
+  pthread_join(thread1, NULL);
+  pthread_join(thread2, NULL);
+}
+
+TEST_F(SerialEventsTest, ReadFrameInvalid)
+{
+  char buffer[32];
+
+  Open();
+  EXPECT_EQ(-1, serial_readframe(handle, buffer, sizeof(buffer), -1, 0));
+  EXPECT_EQ(EINVAL, errno);
+  EXPECT_EQ(-1, serial_readframe(handle, NULL, sizeof(buffer), 0, 0));
+  EXPECT_EQ(EINVAL, errno);
+}
+
+static long long tsdiffms(const struct timespec *a, const struct timespec *b)
+{
+  return (a->tv_sec - b->tv_sec) * 1000LL + (a->tv_nsec - b->tv_nsec) / 1000000;
+}
+
+TEST_F(SerialEventsTest, ReadTimestamp)
+{
+  char buffer[16];
+  struct timespec before, after, ts;
+
+  Open();
+  clock_gettime(CLOCK_MONOTONIC, &before);
+  ASSERT_EQ(3, pty.Write("abc", 3));
+  EXPECT_EQ(READEVENT, serial_waitforevent(handle, READEVENT, 100));
+  EXPECT_EQ(3, serial_read_ts(handle, buffer, sizeof(buffer), &ts));
+  clock_gettime(CLOCK_MONOTONIC, &after);
+  EXPECT_LE(0, tsdiffms(&ts, &before));
+  EXPECT_LE(0, tsdiffms(&after, &ts));
+}
+
+// Data kept by the library keeps the time it was read, not when it's
+// returned.
+TEST_F(SerialEventsTest, ReadTimestampCached)
+{
+  char buffer[16];
+  struct timespec first, ts;
+
+  ASSERT_EQ(0, serial_setdiscardnull(handle, 1));
+  Open();
+  ASSERT_EQ(4, pty.Write("ab\0c", 4));
+  EXPECT_EQ(READEVENT, serial_waitforevent(handle, READEVENT, 100));
+  EXPECT_EQ(1, serial_read_ts(handle, buffer, 1, &first));
+  usleep(50000);
+  EXPECT_EQ(2, serial_read_ts(handle, buffer, sizeof(buffer), &ts));
+  EXPECT_EQ(0, memcmp("bc", buffer, 2));
+  EXPECT_EQ(first.tv_sec, ts.tv_sec);
+  EXPECT_EQ(first.tv_nsec, ts.tv_nsec);
+
+  // New data gets a new time.
+  ASSERT_EQ(1, pty.Write("d", 1));
+  EXPECT_EQ(READEVENT, serial_waitforevent(handle, READEVENT, 100));
+  EXPECT_EQ(1, serial_read_ts(handle, buffer, sizeof(buffer), &ts));
+  EXPECT_LE(50, tsdiffms(&ts, &first));
+}
+
+// Data left over by serial_readuntil() keeps the time it was read.
+TEST_F(SerialEventsTest, ReadTimestampUntil)
+{
+  char buffer[16];
+  struct timespec before, ts;
+
+  Open();
+  clock_gettime(CLOCK_MONOTONIC, &before);
+  ASSERT_EQ(5, pty.Write("ab\ncd", 5));
+  EXPECT_EQ(3, serial_readuntil(handle, buffer, sizeof(buffer), "\n", 1, 1000));
+  usleep(50000);
+  EXPECT_EQ(2, serial_read_ts(handle, buffer, sizeof(buffer), &ts));
+  EXPECT_GT(50, tsdiffms(&ts, &before));
+}
+
+TEST_F(SerialEventsTest, ReadAvailable)
+{
+  char buffer[32];
+  int syscalls;
+
+  Open();
+  ASSERT_EQ(6, pty.Write("abcdef", 6));
+  ASSERT_EQ(READEVENT, serial_waitforevent(handle, READEVENT, 1000));
+  EXPECT_EQ(6, serial_readavailable(handle, buffer, sizeof(buffer), 0, &syscalls));
+  EXPECT_EQ(0, memcmp("abcdef", buffer, 6));
+  EXPECT_LE(1, syscalls);
+}
+
+// A full buffer returns without checking the driver.
+TEST_F(SerialEventsTest, ReadAvailableFull)
+{
+  char buffer[32];
+  int syscalls;
+
+  Open();
+  ASSERT_EQ(6, pty.Write("abcdef", 6));
+  ASSERT_EQ(READEVENT, serial_waitforevent(handle, READEVENT, 1000));
+  EXPECT_EQ(4, serial_readavailable(handle, buffer, 4, 0, &syscalls));
+  EXPECT_EQ(0, memcmp("abcd", buffer, 4));
+  EXPECT_EQ(1, syscalls);
+  EXPECT_EQ(2, serial_readavailable(handle, buffer, sizeof(buffer), 0, NULL));
+  EXPECT_EQ(0, memcmp("ef", buffer, 2));
+}
+
+// Data arriving within the budget is read by the same call.
+TEST_F(SerialEventsTest, ReadAvailableBudget)
+{
+  char buffer[32];
+  int syscalls;
+  struct writethreaddata data = { &pty, "cd", 20 };
+
+  Open();
+  ASSERT_EQ(2, pty.Write("ab", 2));
+  ASSERT_EQ(READEVENT, serial_waitforevent(handle, READEVENT, 1000));
+  pthread_t thread;
+  ASSERT_EQ(0, pthread_create(&thread, NULL, writethread, &data));
+  EXPECT_EQ(4, serial_readavailable(handle, buffer, sizeof(buffer), 200000, &syscalls));
+  EXPECT_EQ(0, memcmp("abcd", buffer, 4));
+  EXPECT_LE(3, syscalls);
+  pthread_join(thread, NULL);
+}
+
+TEST_F(SerialEventsTest, ReadAvailableInvalid)
+{
+  char buffer[32];
+
+  Open();
+  EXPECT_EQ(-1, serial_readavailable(handle, buffer, sizeof(buffer), -1, NULL));
+  EXPECT_EQ(EINVAL, errno);
+  EXPECT_EQ(-1, serial_readavailable(handle, NULL, sizeof(buffer), 0, NULL));
+  EXPECT_EQ(EINVAL, errno);
+}
+
+// Small writes are buffered until explicitly flushed.
+TEST_F(SerialEventsTest, WriteCoalesceFlush)
+{
+  char buffer[32];
+
+  ASSERT_EQ(0, serial_setwritecoalesce(handle, 10000000, 64));
+  Open();
+  EXPECT_EQ(3, serial_write(handle, "abc", 3));
+  EXPECT_EQ(3, serial_write(handle, "def", 3));
+  EXPECT_EQ(0, pty.Read(buffer, sizeof(buffer), 50));
+  EXPECT_EQ(0, serial_flushwrite(handle));
+  ASSERT_EQ(6, pty.Read(buffer, sizeof(buffer), 1000));
+  EXPECT_EQ(0, memcmp("abcdef", buffer, 6));
+}
+
+// The write that reaches the threshold is written with the buffered data.
+TEST_F(SerialEventsTest, WriteCoalesceThreshold)
+{
+  char buffer[32];
+
+  ASSERT_EQ(0, serial_setwritecoalesce(handle, 10000000, 8));
+  Open();
+  EXPECT_EQ(4, serial_write(handle, "abcd", 4));
+  EXPECT_EQ(0, pty.Read(buffer, sizeof(buffer), 50));
+  EXPECT_EQ(4, serial_write(handle, "efgh", 4));
+  ASSERT_EQ(8, pty.Read(buffer, sizeof(buffer), 1000));
+  EXPECT_EQ(0, memcmp("abcdefgh", buffer, 8));
+  EXPECT_EQ(0, serial_flushwrite(handle));
+}
+
+// Waiting for an event writes the buffered data after the delay, without
+// ending the wait early.
+TEST_F(SerialEventsTest, WriteCoalesceDelay)
+{
+  char buffer[32];
+  struct timespec before, after;
+
+  ASSERT_EQ(0, serial_setwritecoalesce(handle, 20000, 64));
+  Open();
+  EXPECT_EQ(2, serial_write(handle, "ab", 2));
+  clock_gettime(CLOCK_MONOTONIC, &before);
+  EXPECT_EQ(NOEVENT, serial_waitforevent(handle, READEVENT, 100));
+  clock_gettime(CLOCK_MONOTONIC, &after);
+  EXPECT_LE(95, tsdiffms(&after, &before));
+  ASSERT_EQ(2, pty.Read(buffer, sizeof(buffer), 100));
+  EXPECT_EQ(0, memcmp("ab", buffer, 2));
+}
+
+// Vectors are written after the buffered data.
+TEST_F(SerialEventsTest, WriteCoalesceVector)
+{
+  char buffer[32];
+  struct iovec iov[2];
+
+  ASSERT_EQ(0, serial_setwritecoalesce(handle, 10000000, 64));
+  Open();
+  EXPECT_EQ(2, serial_write(handle, "ab", 2));
+  iov[0].iov_base = (void *)"cd";
+  iov[0].iov_len = 2;
+  iov[1].iov_base = (void *)"ef";
+  iov[1].iov_len = 2;
+  EXPECT_EQ(4, serial_writev(handle, iov, 2));
+  ASSERT_EQ(6, pty.Read(buffer, sizeof(buffer), 1000));
+  EXPECT_EQ(0, memcmp("abcdef", buffer, 6));
+}
+
+TEST_F(SerialEventsTest, WriteCoalesceInvalid)
+{
+  int delay;
+  size_t threshold;
+
+  EXPECT_EQ(0, serial_getwritecoalesce(handle, &delay, &threshold));
+  EXPECT_EQ(0, delay);
+  EXPECT_EQ(-1, serial_setwritecoalesce(handle, -1, 64));
+  EXPECT_EQ(EINVAL, errno);
+  EXPECT_EQ(-1, serial_setwritecoalesce(handle, 1000, 1));
+  EXPECT_EQ(EINVAL, errno);
+  EXPECT_EQ(0, serial_setwritecoalesce(handle, 1000, 64));
+  EXPECT_EQ(0, serial_getwritecoalesce(handle, &delay, &threshold));
+  EXPECT_EQ(1000, delay);
+  EXPECT_EQ(64, threshold);
+  EXPECT_EQ(-1, serial_flushwrite(handle));
+}
+
+// A pseudo terminal passes the data directly to the master, so the output
+// queue is always empty.
+TEST_F(SerialEventsTest, Drain)
+{
+  char buffer[32];
+
+  Open();
+  EXPECT_EQ(3, serial_write(handle, "abc", 3));
+  EXPECT_EQ(0, serial_drain(handle, 1000));
+  ASSERT_EQ(3, pty.Read(buffer, sizeof(buffer), 1000));
+  EXPECT_EQ(0, memcmp("abc", buffer, 3));
+}
+
+// Data buffered by coalescing is written first.
+TEST_F(SerialEventsTest, DrainCoalesced)
+{
+  char buffer[32];
+
+  ASSERT_EQ(0, serial_setwritecoalesce(handle, 10000000, 64));
+  Open();
+  EXPECT_EQ(3, serial_write(handle, "abc", 3));
+  EXPECT_EQ(0, serial_drain(handle, 1000));
+  ASSERT_EQ(3, pty.Read(buffer, sizeof(buffer), 1000));
+  EXPECT_EQ(0, memcmp("abc", buffer, 3));
+}
+
+TEST_F(SerialEventsTest, DrainNotOpen)
+{
+  EXPECT_EQ(-1, serial_drain(handle, 0));
+  EXPECT_EQ(EIO, errno);
+}
+
+// Reads from the pseudo terminal until length bytes are received.
+static int ReadAll(PtyDevice *pty, char *buffer, int length)
+{
+  int total = 0;
+  while (total < length) {
+    int readbytes = pty->Read(buffer + total, length - total, 1000);
+    if (readbytes <= 0) break;
+    total += readbytes;
+  }
+  return total;
+}
+
+// The burst is sent at once, the rest at the rate.
+TEST_F(SerialEventsTest, WritePacedRate)
+{
+  char buffer[32];
+  struct serialpacing pacing = { 1000, 10, 0, 0 };
+  struct timespec before, after;
+
+  ASSERT_EQ(0, serial_setpacing(handle, &pacing));
+  Open();
+  clock_gettime(CLOCK_MONOTONIC, &before);
+  EXPECT_EQ(30, serial_writepaced(handle, "abcdefghijklmnopqrstuvwxyz0123", 30, 1000));
+  clock_gettime(CLOCK_MONOTONIC, &after);
+  EXPECT_LE(19, tsdiffms(&after, &before));
+  ASSERT_EQ(30, ReadAll(&pty, buffer, 30));
+  EXPECT_EQ(0, memcmp("abcdefghijklmnopqrstuvwxyz0123", buffer, 30));
+}
+
+TEST_F(SerialEventsTest, WritePacedByteGap)
+{
+  char buffer[32];
+  struct serialpacing pacing = { 0, 0, 5000, 0 };
+  struct timespec before, after;
+
+  ASSERT_EQ(0, serial_setpacing(handle, &pacing));
+  Open();
+  clock_gettime(CLOCK_MONOTONIC, &before);
+  EXPECT_EQ(5, serial_writepaced(handle, "abcde", 5, 1000));
+  clock_gettime(CLOCK_MONOTONIC, &after);
+  EXPECT_LE(20, tsdiffms(&after, &before));
+  ASSERT_EQ(5, ReadAll(&pty, buffer, 5));
+  EXPECT_EQ(0, memcmp("abcde", buffer, 5));
+}
+
+// The gap is also kept between calls.
+TEST_F(SerialEventsTest, WritePacedChunkGap)
+{
+  char buffer[32];
+  struct serialpacing pacing = { 0, 4, 0, 10000 };
+  struct timespec before, after;
+
+  ASSERT_EQ(0, serial_setpacing(handle, &pacing));
+  Open();
+  clock_gettime(CLOCK_MONOTONIC, &before);
+  EXPECT_EQ(8, serial_writepaced(handle, "abcdefgh", 8, 1000));
+  EXPECT_EQ(4, serial_writepaced(handle, "ijkl", 4, 1000));
+  clock_gettime(CLOCK_MONOTONIC, &after);
+  EXPECT_LE(20, tsdiffms(&after, &before));
+  ASSERT_EQ(12, ReadAll(&pty, buffer, 12));
+  EXPECT_EQ(0, memcmp("abcdefghijkl", buffer, 12));
+}
+
+TEST_F(SerialEventsTest, WritePacedTimeout)
+{
+  struct serialpacing pacing = { 100, 1, 0, 0 };
+
+  ASSERT_EQ(0, serial_setpacing(handle, &pacing));
+  Open();
+  ssize_t written = serial_writepaced(handle, "abcdefghij", 10, 25);
+  EXPECT_LE(1, written);
+  EXPECT_GT(10, written);
+}
+
+TEST_F(SerialEventsTest, WritePacedInvalid)
+{
+  struct serialpacing pacing = { 0, 0, 1000, 1000 };
+  struct serialpacing result;
+
+  EXPECT_EQ(-1, serial_setpacing(handle, &pacing));
+  EXPECT_EQ(EINVAL, errno);
+  pacing.bytegap = 0;
+  pacing.rate = -1;
+  EXPECT_EQ(-1, serial_setpacing(handle, &pacing));
+  EXPECT_EQ(EINVAL, errno);
+  pacing.rate = 1000;
+  EXPECT_EQ(0, serial_setpacing(handle, &pacing));
+  EXPECT_EQ(0, serial_getpacing(handle, &result));
+  EXPECT_EQ(1000, result.rate);
+  EXPECT_EQ(1000, result.chunkgap);
+  EXPECT_EQ(-1, serial_writepaced(handle, "a", 1, 0));
+  EXPECT_EQ(EIO, errno);
+}
+
+// A pseudo terminal passes the data directly to the master, so the output
+// queue is empty after writing.
+TEST_F(SerialEventsTest, TxEmpty)
+{
+  char buffer[32];
+
+  Open();
+  EXPECT_EQ(TXEMPTYEVENT, serial_waitforevent(handle, TXEMPTYEVENT, 1000));
+  EXPECT_EQ(3, serial_write(handle, "abc", 3));
+  EXPECT_EQ(TXEMPTYEVENT, serial_waitforevent(handle, TXEMPTYEVENT, 1000));
+  ASSERT_EQ(3, pty.Read(buffer, sizeof(buffer), 1000));
+}
+
+// Data buffered by coalescing isn't sent until the delay expires.
+TEST_F(SerialEventsTest, TxEmptyCoalesced)
+{
+  char buffer[32];
+  struct timespec before, after;
+
+  ASSERT_EQ(0, serial_setwritecoalesce(handle, 50000, 64));
+  Open();
+  EXPECT_EQ(2, serial_write(handle, "ab", 2));
+  clock_gettime(CLOCK_MONOTONIC, &before);
+  EXPECT_EQ(TXEMPTYEVENT, serial_waitforevent(handle, TXEMPTYEVENT, 1000));
+  clock_gettime(CLOCK_MONOTONIC, &after);
+  EXPECT_LE(45, tsdiffms(&after, &before));
+  EXPECT_GT(500, tsdiffms(&after, &before));
+  ASSERT_EQ(2, pty.Read(buffer, sizeof(buffer), 1000));
+}
+
+// Other events are reported together with TXEMPTYEVENT.
+TEST_F(SerialEventsTest, TxEmptyWithRead)
+{
+  Open();
+  ASSERT_EQ(3, pty.Write("abc", 3));
+  ASSERT_EQ(READEVENT, serial_waitforevent(handle, READEVENT, 1000));
+  EXPECT_EQ(READEVENT | TXEMPTYEVENT, serial_waitforevent(handle, (serialevent_t)(READEVENT | TXEMPTYEVENT), 1000));
+}
@@ -322,6 +322,25 @@ TEST_F(SerialInitTest, GetSetTxContinueOnXOffWhenClosed)
   EXPECT_EQ(0, txcontinue);
 }
 
+TEST_F(SerialInitTest, GetSetReportBreakWhenClosed)
+{
+  int reportbreak;
+
+  EXPECT_EQ(0, serial_getreportbreak(handle, &reportbreak));
+  EXPECT_EQ(0, reportbreak);
+
+  EXPECT_EQ(0, serial_setreportbreak(handle, 1));
+  EXPECT_EQ(0, serial_getreportbreak(handle, &reportbreak));
+  EXPECT_NE(0, reportbreak);
+
+  EXPECT_EQ(0, serial_setreportbreak(handle, 0));
+  EXPECT_EQ(0, serial_getreportbreak(handle, &reportbreak));
+  EXPECT_EQ(0, reportbreak);
+
+  EXPECT_EQ(-1, serial_getreportbreak(handle, NULL));
+  EXPECT_EQ(EINVAL, errno);
+}
+
 TEST_F(SerialInitTest, GetSetDiscardNullWhenClosed)
 {
   int discardnull;
@@ -0,0 +1,265 @@
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "gtest/gtest.h"
+#include "main.hpp"
+#include "ptydevice.hpp"
+#include "nserial.h"
+
+#define PORTS 4
+
+// The tests are run for io_uring (if the kernel supports it) and for poll().
+class SerialIoQueueTest : public ::testing::TestWithParam<serialioqueueflags_t>
+{
+protected:
+  SerialIoQueueTest();
+  virtual ~SerialIoQueueTest();
+
+  virtual void SetUp();
+  virtual void TearDown();
+
+  void Open(int port);
+
+protected:
+  struct serialioqueue *queue;
+  PtyDevice             pty[PORTS];
+  struct serialhandle  *handle[PORTS];
+};
+
+SerialIoQueueTest::SerialIoQueueTest() : ::testing::TestWithParam<serialioqueueflags_t>()
+{
+}
+
+SerialIoQueueTest::~SerialIoQueueTest()
+{
+}
+
+void SerialIoQueueTest::SetUp()
+{
+  queue = NULL;
+  for (int i = 0; i < PORTS; i++) handle[i] = NULL;
+
+  queue = serial_ioqueue_init(8, GetParam());
+  ASSERT_TRUE(queue != NULL)
+    << "Error initialising queue: " << strerror(errno) << " (" << errno << ")";
+  if (GetParam() == IOQUEUE_NOURING) {
+    EXPECT_EQ(0, serial_ioqueue_isuring(queue));
+  } else if (!serial_ioqueue_isuring(queue)) {
+    std::cout << "io_uring not available, testing with poll()" << std::endl;
+  }
+
+  for (int i = 0; i < PORTS; i++) {
+    ASSERT_TRUE(pty[i].IsOpen());
+    handle[i] = serial_init();
+    ASSERT_TRUE(handle[i] != NULL)
+      << "Error initialising: " << strerror(errno) << " (" << errno << ")";
+    ASSERT_EQ(0, serial_setdevicename(handle[i], pty[i].GetDevice()));
+  }
+}
+
+void SerialIoQueueTest::TearDown()
+{
+  serial_ioqueue_terminate(queue);
+  for (int i = 0; i < PORTS; i++) {
+    if (handle[i] != NULL) serial_terminate(handle[i]);
+  }
+}
+
+void SerialIoQueueTest::Open(int port)
+{
+  ASSERT_EQ(0, serial_open(handle[port]))
+    << "Message: " << serial_error(handle[port]) << "; "
+    << "Error opening: " << strerror(errno) << " (" << errno << ")";
+  ASSERT_EQ(0, serial_setproperties(handle[port]))
+    << "Message: " << serial_error(handle[port]) << "; "
+    << "Error setting properties: " << strerror(errno) << " (" << errno << ")";
+}
+
+TEST_P(SerialIoQueueTest, Timeout)
+{
+  struct serialiocompletion completions[PORTS];
+  char buffer[16];
+
+  Open(0);
+  EXPECT_EQ(0, serial_ioqueue_complete(queue, completions, PORTS, 10));
+
+  ASSERT_EQ(0, serial_ioqueue_read(queue, handle[0], buffer, sizeof(buffer), NULL));
+  EXPECT_EQ(1, serial_ioqueue_submit(queue));
+  EXPECT_EQ(0, serial_ioqueue_complete(queue, completions, PORTS, 50));
+}
+
+TEST_P(SerialIoQueueTest, ReadManyPorts)
+{
+  struct serialiocompletion completions[PORTS];
+  char buffer[PORTS][16];
+
+  for (int i = 0; i < PORTS; i++) {
+    Open(i);
+    ASSERT_EQ(0, serial_ioqueue_read(queue, handle[i], buffer[i], sizeof(buffer[i]),
+                                     (void *)(intptr_t)i));
+  }
+  EXPECT_EQ(PORTS, serial_ioqueue_submit(queue));
+
+  ASSERT_EQ(3, pty[1].Write("abc", 3));
+  ASSERT_EQ(2, pty[2].Write("de", 2));
+
+  int found = 0;
+  for (int retry = 0; retry < 10 && found != ((1 << 1) | (1 << 2)); retry++) {
+    int n = serial_ioqueue_complete(queue, completions, PORTS, 100);
+    ASSERT_NE(-1, n) << "Error: " << strerror(errno) << " (" << errno << ")";
+    for (int c = 0; c < n; c++) {
+      int port = (int)(intptr_t)completions[c].userdata;
+      found |= 1 << port;
+      EXPECT_EQ(handle[port], completions[c].handle);
+      EXPECT_EQ(IOQUEUE_READ, completions[c].type);
+      EXPECT_EQ(buffer[port], completions[c].buffer);
+      if (port == 1) {
+        EXPECT_EQ(3, completions[c].result);
+        EXPECT_EQ(0, memcmp("abc", buffer[1], 3));
+      } else if (port == 2) {
+        EXPECT_EQ(2, completions[c].result);
+        EXPECT_EQ(0, memcmp("de", buffer[2], 2));
+      }
+    }
+  }
+  EXPECT_EQ((1 << 1) | (1 << 2), found);
+
+  // The other reads are still pending.
+  EXPECT_EQ(0, serial_ioqueue_complete(queue, completions, PORTS, 10));
+  ASSERT_EQ(1, pty[3].Write("f", 1));
+  ASSERT_EQ(1, serial_ioqueue_complete(queue, completions, PORTS, 1000));
+  EXPECT_EQ(handle[3], completions[0].handle);
+  EXPECT_EQ(1, completions[0].result);
+
+  ASSERT_EQ(1, pty[0].Write("g", 1));
+  ASSERT_EQ(1, serial_ioqueue_complete(queue, completions, PORTS, 1000));
+  EXPECT_EQ(handle[0], completions[0].handle);
+}
+
+TEST_P(SerialIoQueueTest, Write)
+{
+  struct serialiocompletion completions[PORTS];
+
+  Open(0);
+  Open(1);
+  ASSERT_EQ(0, serial_ioqueue_write(queue, handle[0], "hello", 5, NULL));
+  ASSERT_EQ(0, serial_ioqueue_write(queue, handle[1], "world", 5, NULL));
+
+  int n = 0;
+  for (int retry = 0; retry < 10 && n < 2; retry++) {
+    int r = serial_ioqueue_complete(queue, completions + n, PORTS - n, 100);
+    ASSERT_NE(-1, r);
+    n += r;
+  }
+  ASSERT_EQ(2, n);
+  for (int c = 0; c < n; c++) {
+    EXPECT_EQ(IOQUEUE_WRITE, completions[c].type);
+    EXPECT_EQ(5, completions[c].result);
+  }
+
+  char buffer[16];
+  ASSERT_EQ(5, pty[0].Read(buffer, sizeof(buffer), 100));
+  EXPECT_EQ(0, memcmp("hello", buffer, 5));
+  ASSERT_EQ(5, pty[1].Read(buffer, sizeof(buffer), 100));
+  EXPECT_EQ(0, memcmp("world", buffer, 5));
+}
+
+TEST_P(SerialIoQueueTest, WriteCoalesce)
+{
+  struct serialiocompletion completions[PORTS];
+
+  Open(0);
+  ASSERT_EQ(0, serial_setwritecoalesce(handle[0], 1000000, 4));
+  ASSERT_EQ(2, serial_write(handle[0], "ab", 2));
+
+  // The buffered data is written before the data of the queue.
+  ASSERT_EQ(0, serial_ioqueue_write(queue, handle[0], "cdef", 4, NULL));
+  ASSERT_EQ(1, serial_ioqueue_complete(queue, completions, PORTS, 1000));
+  EXPECT_EQ(4, completions[0].result);
+
+  char buffer[16];
+  ASSERT_EQ(6, pty[0].Read(buffer, sizeof(buffer), 100));
+  EXPECT_EQ(0, memcmp("abcdef", buffer, 6));
+}
+
+TEST_P(SerialIoQueueTest, ReadDiscardNull)
+{
+  struct serialiocompletion completions[PORTS];
+  char buffer[16];
+
+  ASSERT_EQ(0, serial_setdiscardnull(handle[0], 1));
+  Open(0);
+
+  ASSERT_EQ(0, serial_ioqueue_read(queue, handle[0], buffer, sizeof(buffer), NULL));
+  ASSERT_EQ(4, pty[0].Write("a\0bc", 4));
+  ASSERT_EQ(1, serial_ioqueue_complete(queue, completions, PORTS, 1000));
+  ASSERT_EQ(3, completions[0].result);
+  EXPECT_EQ(0, memcmp("abc", buffer, 3));
+}
+
+TEST_P(SerialIoQueueTest, MoreCompletionsThanResults)
+{
+  struct serialiocompletion completions[PORTS];
+  char buffer[PORTS][16];
+
+  for (int i = 0; i < PORTS; i++) {
+    Open(i);
+    ASSERT_EQ(1, pty[i].Write("x", 1));
+  }
+  for (int i = 0; i < PORTS; i++) {
+    ASSERT_EQ(0, serial_ioqueue_read(queue, handle[i], buffer[i], sizeof(buffer[i]), NULL));
+  }
+
+  int n = 0;
+  for (int retry = 0; retry < 10 && n < PORTS; retry++) {
+    int r = serial_ioqueue_complete(queue, completions, 1, 100);
+    ASSERT_NE(-1, r);
+    EXPECT_GE(1, r);
+    n += r;
+  }
+  EXPECT_EQ(PORTS, n);
+}
+
+TEST_P(SerialIoQueueTest, QueueFull)
+{
+  char buffer[16];
+
+  Open(0);
+  for (int i = 0; i < 8; i++) {
+    ASSERT_EQ(0, serial_ioqueue_read(queue, handle[0], buffer, sizeof(buffer), NULL));
+  }
+  EXPECT_EQ(-1, serial_ioqueue_read(queue, handle[0], buffer, sizeof(buffer), NULL));
+  EXPECT_EQ(EAGAIN, errno);
+}
+
+TEST_P(SerialIoQueueTest, TerminatePending)
+{
+  char buffer[PORTS][16];
+
+  for (int i = 0; i < PORTS; i++) {
+    Open(i);
+    ASSERT_EQ(0, serial_ioqueue_read(queue, handle[i], buffer[i], sizeof(buffer[i]), NULL));
+  }
+  EXPECT_EQ(PORTS, serial_ioqueue_submit(queue));
+  serial_ioqueue_terminate(queue);
+  queue = NULL;
+
+  // The cancelled reads don't take the data.
+  ASSERT_EQ(3, pty[0].Write("abc", 3));
+  ASSERT_EQ(READEVENT, serial_waitforevent(handle[0], READEVENT, 1000));
+  char data[16];
+  ASSERT_EQ(3, serial_read(handle[0], data, sizeof(data)));
+  EXPECT_EQ(0, memcmp("abc", data, 3));
+}
+
+TEST_P(SerialIoQueueTest, NotOpen)
+{
+  char buffer[16];
+
+  EXPECT_EQ(-1, serial_ioqueue_read(queue, handle[0], buffer, sizeof(buffer), NULL));
+  EXPECT_EQ(EIO, errno);
+}
+
+INSTANTIATE_TEST_SUITE_P(Backend, SerialIoQueueTest,
+  ::testing::Values(IOQUEUE_DEFAULT, IOQUEUE_NOURING));
@@ -0,0 +1,313 @@
+#include <iostream>
+#include <string>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include "gtest/gtest.h"
+#include "main.hpp"
+#include "ptydevice.hpp"
+#include "nserial.h"
+
+// Collects the results of the callbacks, which are called from the I/O
+// thread of the library.
+class CallbackResults
+{
+public:
+  CallbackResults();
+  ~CallbackResults();
+
+  void AddData(const char *buffer, size_t length);
+  void AddDrained();
+  void AddError(int posixerrno);
+
+  // Waits until the condition is true, or the timeout in milliseconds.
+  bool WaitForData(size_t length, int timeout);
+  bool WaitForDrained(int timeout);
+  bool WaitForErrors(int errors, int timeout);
+
+  std::string GetData();
+  int GetLastError();
+
+  bool closeondata;
+
+private:
+  bool Wait(int timeout);
+
+  pthread_mutex_t m_mutex;
+  pthread_cond_t  m_cond;
+  std::string     m_data;
+  size_t          m_received;
+  int             m_drained;
+  int             m_errors;
+  int             m_lasterror;
+};
+
+CallbackResults::CallbackResults()
+  : closeondata(false), m_received(0), m_drained(0), m_errors(0), m_lasterror(0)
+{
+  pthread_mutex_init(&m_mutex, NULL);
+  pthread_cond_init(&m_cond, NULL);
+}
+
+CallbackResults::~CallbackResults()
+{
+  pthread_cond_destroy(&m_cond);
+  pthread_mutex_destroy(&m_mutex);
+}
+
+// The buffer is NULL if the data was added to the receive ring.
+void CallbackResults::AddData(const char *buffer, size_t length)
+{
+  pthread_mutex_lock(&m_mutex);
+  if (buffer) m_data.append(buffer, length);
+  m_received += length;
+  pthread_cond_broadcast(&m_cond);
+  pthread_mutex_unlock(&m_mutex);
+}
+
+void CallbackResults::AddDrained()
+{
+  pthread_mutex_lock(&m_mutex);
+  m_drained++;
+  pthread_cond_broadcast(&m_cond);
+  pthread_mutex_unlock(&m_mutex);
+}
+
+void CallbackResults::AddError(int posixerrno)
+{
+  pthread_mutex_lock(&m_mutex);
+  m_errors++;
+  m_lasterror = posixerrno;
+  pthread_cond_broadcast(&m_cond);
+  pthread_mutex_unlock(&m_mutex);
+}
+
+// Must be called with the mutex locked.
+bool CallbackResults::Wait(int timeout)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += timeout / 1000;
+  ts.tv_nsec += (timeout % 1000) * 1000000;
+  if (ts.tv_nsec >= 1000000000) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000;
+  }
+  return pthread_cond_timedwait(&m_cond, &m_mutex, &ts) == 0;
+}
+
+bool CallbackResults::WaitForData(size_t length, int timeout)
+{
+  pthread_mutex_lock(&m_mutex);
+  while (m_received < length && Wait(timeout)) { }
+  bool result = m_received >= length;
+  pthread_mutex_unlock(&m_mutex);
+  return result;
+}
+
+bool CallbackResults::WaitForDrained(int timeout)
+{
+  pthread_mutex_lock(&m_mutex);
+  while (m_drained == 0 && Wait(timeout)) { }
+  bool result = m_drained > 0;
+  pthread_mutex_unlock(&m_mutex);
+  return result;
+}
+
+bool CallbackResults::WaitForErrors(int errors, int timeout)
+{
+  pthread_mutex_lock(&m_mutex);
+  while (m_errors < errors && Wait(timeout)) { }
+  bool result = m_errors >= errors;
+  pthread_mutex_unlock(&m_mutex);
+  return result;
+}
+
+std::string CallbackResults::GetData()
+{
+  pthread_mutex_lock(&m_mutex);
+  std::string result = m_data;
+  pthread_mutex_unlock(&m_mutex);
+  return result;
+}
+
+int CallbackResults::GetLastError()
+{
+  pthread_mutex_lock(&m_mutex);
+  int result = m_lasterror;
+  pthread_mutex_unlock(&m_mutex);
+  return result;
+}
+
+static void datareceived(struct serialhandle *handle, const char *buffer, size_t length, void *userdata)
+{
+  CallbackResults *results = static_cast<CallbackResults *>(userdata);
+  if (results->closeondata) serial_close(handle);
+  results->AddData(buffer, length);
+}
+
+static void writedrained(struct serialhandle *, void *userdata)
+{
+  static_cast<CallbackResults *>(userdata)->AddDrained();
+}
+
+static void pinchanged(struct serialhandle *, serialmodemevent_t, void *)
+{
+}
+
+static void error(struct serialhandle *, int posixerrno, void *userdata)
+{
+  static_cast<CallbackResults *>(userdata)->AddError(posixerrno);
+}
+
+class SerialIoThreadTest : public ::testing::Test
+{
+protected:
+  SerialIoThreadTest();
+  virtual ~SerialIoThreadTest();
+
+  virtual void SetUp();
+  virtual void TearDown();
+
+  void Open();
+
+protected:
+  PtyDevice              pty;
+  struct serialhandle   *handle;
+  struct serialcallbacks callbacks;
+  CallbackResults        results;
+};
+
+SerialIoThreadTest::SerialIoThreadTest() : ::testing::Test()
+{
+}
+
+SerialIoThreadTest::~SerialIoThreadTest()
+{
+}
+
+void SerialIoThreadTest::SetUp()
+{
+  ASSERT_TRUE(pty.IsOpen());
+  handle = serial_init();
+  ASSERT_TRUE(handle != NULL)
+    << "Error initialising: " << strerror(errno) << " (" << errno << ")";
+  ASSERT_EQ(0, serial_setdevicename(handle, pty.GetDevice()));
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  callbacks.datareceived = datareceived;
+  callbacks.writedrained = writedrained;
+  callbacks.error = error;
+}
+
+void SerialIoThreadTest::TearDown()
+{
+  serial_terminate(handle);
+}
+
+void SerialIoThreadTest::Open()
+{
+  ASSERT_EQ(0, serial_setcallbacks(handle, &callbacks, &results));
+  ASSERT_EQ(0, serial_open(handle))
+    << "Message: " << serial_error(handle) << "; "
+    << "Error opening: " << strerror(errno) << " (" << errno << ")";
+  ASSERT_EQ(0, serial_setproperties(handle))
+    << "Message: " << serial_error(handle) << "; "
+    << "Error setting properties: " << strerror(errno) << " (" << errno << ")";
+}
+
+TEST_F(SerialIoThreadTest, SetWhenOpen)
+{
+  Open();
+  EXPECT_EQ(-1, serial_setcallbacks(handle, NULL, NULL));
+  EXPECT_EQ(EIO, errno);
+}
+
+TEST_F(SerialIoThreadTest, DataReceived)
+{
+  Open();
+
+  ASSERT_EQ(3, pty.Write("abc", 3));
+  ASSERT_TRUE(results.WaitForData(3, 1000));
+  ASSERT_EQ(3, pty.Write("def", 3));
+  ASSERT_TRUE(results.WaitForData(6, 1000));
+  EXPECT_EQ("abcdef", results.GetData());
+  EXPECT_EQ(0, serial_close(handle));
+}
+
+TEST_F(SerialIoThreadTest, WriteDrained)
+{
+  char *buffer;
+  char data[16];
+
+  ASSERT_EQ(0, serial_ring_init(handle, 0, 64));
+  Open();
+
+  ASSERT_LT(5, serial_ring_writereserve(handle, &buffer));
+  memcpy(buffer, "hello", 5);
+  ASSERT_EQ(0, serial_ring_writecommit(handle, 5));
+  ASSERT_TRUE(results.WaitForDrained(1000));
+  ASSERT_EQ(5, pty.Read(data, sizeof(data), 1000));
+  EXPECT_EQ(0, memcmp("hello", data, 5));
+}
+
+TEST_F(SerialIoThreadTest, RingReceived)
+{
+  const char *buffer;
+  char data[100];
+
+  ASSERT_EQ(0, serial_ring_init(handle, 64, 0));
+  Open();
+  EXPECT_EQ(-1, serial_ring_service(handle, 0));
+  EXPECT_EQ(EINVAL, errno);
+
+  // The thread stops reading when the ring is full, until space is freed.
+  for (int i = 0; i < 100; i++) data[i] = (char)('a' + i % 26);
+  ASSERT_EQ(100, pty.Write(data, 100));
+  ASSERT_TRUE(results.WaitForData(64, 1000));
+  EXPECT_EQ(64, serial_ring_readpeek(handle, &buffer));
+  EXPECT_EQ(0, memcmp(data, buffer, 64));
+  ASSERT_EQ(0, serial_ring_readcommit(handle, 64));
+
+  ASSERT_TRUE(results.WaitForData(100, 1000));
+  EXPECT_EQ(36, serial_ring_readpeek(handle, &buffer));
+  EXPECT_EQ(0, memcmp(data + 64, buffer, 36));
+  EXPECT_EQ("", results.GetData());
+}
+
+TEST_F(SerialIoThreadTest, Hangup)
+{
+  Open();
+
+  pty.Close();
+  ASSERT_TRUE(results.WaitForErrors(1, 1000));
+  EXPECT_EQ(EIO, results.GetLastError());
+  EXPECT_EQ(0, serial_close(handle));
+}
+
+// A pseudo terminal has no modem signals. The error is reported, but data is
+// still received.
+TEST_F(SerialIoThreadTest, PinChangedUnsupported)
+{
+  callbacks.pinchanged = pinchanged;
+  Open();
+
+  ASSERT_TRUE(results.WaitForErrors(1, 1000));
+  ASSERT_EQ(3, pty.Write("abc", 3));
+  ASSERT_TRUE(results.WaitForData(3, 1000));
+  EXPECT_EQ("abc", results.GetData());
+}
+
+TEST_F(SerialIoThreadTest, CloseFromCallback)
+{
+  results.closeondata = true;
+  Open();
+
+  ASSERT_EQ(3, pty.Write("abc", 3));
+  ASSERT_TRUE(results.WaitForData(3, 1000));
+  int isopen;
+  ASSERT_EQ(0, serial_isopen(handle, &isopen));
+  EXPECT_EQ(0, isopen);
+}
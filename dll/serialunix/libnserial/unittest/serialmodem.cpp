@@ -3,9 +3,11 @@
 #include <errno.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <time.h>
 #include "gtest/gtest.h"
 #include "main.hpp"
 #include "configuration.hpp"
+#include "ptydevice.hpp"
 #include "nserial.h"
 
 class SerialModemTest : public ::testing::Test
@@ -124,3 +126,116 @@ TEST_F(SerialModemTest, EventAbortNotWaiting)
 
   ASSERT_EQ(0, serial_close(handle));
 }
+
+static int elapsedms(const struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000 +
+    (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+TEST_F(SerialModemTest, EventTimeout)
+{
+  ASSERT_EQ(0, serial_open(handle))
+    << "Message: " << serial_error(handle) << "; "
+    << "Error initialising: " << strerror(errno) << " (" << errno << ")";
+
+  // An abort while no thread is waiting is ignored.
+  ASSERT_EQ(0, serial_abortwaitformodemevent(handle));
+
+  // The monitor thread keeps running between the calls.
+  for (int i = 0; i < 3; i++) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    serialmodemevent_t result = serial_timedwaitformodemevent(handle,
+      (serialmodemevent_t)(MODEMEVENT_DCD | MODEMEVENT_RI |
+                           MODEMEVENT_DSR | MODEMEVENT_CTS), 50);
+    ASSERT_NE(MODEMEVENT_ERROR, result)
+      << "Message: " << serial_error(handle) << "; "
+      << "Error: " << strerror(errno) << " (" << errno << ")";
+    if (result == MODEMEVENT_NONE) {
+      EXPECT_GE(elapsedms(&start), 40);
+    }
+  }
+
+  ASSERT_EQ(0, serial_close(handle));
+}
+
+TEST_F(SerialModemTest, WaitForModemChangeEvent)
+{
+  ASSERT_EQ(0, serial_open(handle))
+    << "Message: " << serial_error(handle) << "; "
+    << "Error initialising: " << strerror(errno) << " (" << errno << ")";
+
+  serialevent_t result = serial_waitforevent(handle,
+    (serialevent_t)(MODEMCHANGEEVENT | ERROREVENT), 50);
+  ASSERT_NE(-1, result)
+    << "Message: " << serial_error(handle) << "; "
+    << "Error: " << strerror(errno) << " (" << errno << ")";
+  EXPECT_EQ(0, result & ERROREVENT);
+  if (result & MODEMCHANGEEVENT) {
+    // Consuming the changes clears the event.
+    EXPECT_NE(MODEMEVENT_NONE, serial_timedwaitformodemevent(handle,
+      (serialmodemevent_t)(MODEMEVENT_DCD | MODEMEVENT_RI |
+                           MODEMEVENT_DSR | MODEMEVENT_CTS), 0));
+  }
+
+  ASSERT_EQ(0, serial_abortwaitforevent(handle));
+  EXPECT_EQ(NOEVENT, serial_waitforevent(handle, MODEMCHANGEEVENT, -1));
+
+  ASSERT_EQ(0, serial_close(handle));
+}
+
+// A pseudo terminal has no modem signals, the error from the monitor thread
+// is returned to the waiting thread.
+TEST(SerialModemPtyTest, EventUnsupported)
+{
+  PtyDevice pty;
+  ASSERT_TRUE(pty.IsOpen());
+
+  struct serialhandle *handle = serial_init();
+  ASSERT_TRUE(handle != NULL);
+  ASSERT_EQ(0, serial_setdevicename(handle, pty.GetDevice()));
+  ASSERT_EQ(0, serial_open(handle));
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  EXPECT_EQ(MODEMEVENT_ERROR, serial_timedwaitformodemevent(handle, MODEMEVENT_CTS, 5000));
+  EXPECT_LT(elapsedms(&start), 1000);
+  EXPECT_EQ(MODEMEVENT_ERROR, serial_timedwaitformodemevent(handle, MODEMEVENT_CTS, 5000));
+
+  ASSERT_EQ(0, serial_close(handle));
+  serial_terminate(handle);
+}
+
+// The error of the modem monitor is reported once, so that waiting for errors
+// blocks again after it's consumed.
+TEST(SerialModemPtyTest, ErrorEventReportedOnce)
+{
+  PtyDevice pty;
+  ASSERT_TRUE(pty.IsOpen());
+
+  struct serialhandle *handle = serial_init();
+  ASSERT_TRUE(handle != NULL);
+  ASSERT_EQ(0, serial_setdevicename(handle, pty.GetDevice()));
+  ASSERT_EQ(0, serial_open(handle));
+
+  serialevent_t event = (serialevent_t)(READEVENT | MODEMCHANGEEVENT | ERROREVENT);
+  EXPECT_EQ(ERROREVENT, serial_waitforevent(handle, event, 1000));
+
+  // Without waiting for modem changes, the failure of the monitor isn't an
+  // error of the serial port.
+  EXPECT_EQ(NOEVENT, serial_waitforevent(handle, ERROREVENT, 10));
+
+  EXPECT_EQ(MODEMEVENT_ERROR, serial_timedwaitformodemevent(handle, MODEMEVENT_CTS, 0));
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  EXPECT_EQ(NOEVENT, serial_waitforevent(handle, event, 50));
+  EXPECT_GE(elapsedms(&start), 40);
+  EXPECT_EQ(NOEVENT, serial_waitforevent(handle, event, 10));
+
+  ASSERT_EQ(0, serial_close(handle));
+  serial_terminate(handle);
+}
@@ -412,6 +412,37 @@ TEST_F(SerialOpenTest, SerialDriverQueue)
     << "Error initialising: " << strerror(errno) << " (" << errno << ")";
 }
 
+// Not all drivers support the counters, e.g. a pseudo terminal.
+TEST_F(SerialOpenTest, SerialDriverCounters)
+{
+  struct serialicount last;
+  struct serialicount delta;
+
+  EXPECT_EQ(-1, serial_geticount(handle, &last));
+  EXPECT_EQ(EBADF, errno);
+
+  ASSERT_EQ(0, serial_open(handle));
+  EXPECT_EQ(-1, serial_geticount(handle, NULL));
+  EXPECT_EQ(EINVAL, errno);
+  EXPECT_EQ(-1, serial_geticountdelta(handle, &last, NULL));
+  EXPECT_EQ(EINVAL, errno);
+
+  if (serial_geticount(handle, &last) == -1) {
+    EXPECT_NE(EBADF, errno);
+    EXPECT_EQ(-1, serial_geticountdelta(handle, &last, &delta));
+    return;
+  }
+
+  // Without data, no errors are expected.
+  EXPECT_EQ(0, serial_geticountdelta(handle, &last, &delta))
+    << "Message: " << serial_error(handle) << "; "
+    << "Error: " << strerror(errno) << " (" << errno << ")";
+  EXPECT_EQ(0u, delta.frame);
+  EXPECT_EQ(0u, delta.parity);
+  EXPECT_EQ(0u, delta.overrun);
+  EXPECT_EQ(0u, delta.bufoverrun);
+}
+
 TEST_F(SerialOpenTest, SerialBreak)
 {
   ASSERT_EQ(0, serial_open(handle));
@@ -445,4 +476,26 @@ TEST_F(SerialOpenTest, SerialPortList)
     std::cout << "Port: " << ports[i].device << " - " << ports[i].description << std::endl;
     i++;
   }
-}
\ No newline at end of file
+}
+// A pseudo terminal has none of the settings for low latency, which is not
+// an error.
+TEST_F(SerialOpenTest, SerialLowLatency)
+{
+  int lowlatency;
+  seriallowlatency_t applied;
+
+  EXPECT_EQ(0, serial_getlowlatency(handle, &lowlatency));
+  EXPECT_EQ(0, lowlatency);
+  EXPECT_EQ(0, serial_setlowlatency(handle, 1));
+  EXPECT_EQ(0, serial_getlowlatency(handle, &lowlatency));
+  EXPECT_NE(0, lowlatency);
+
+  ASSERT_EQ(0, serial_open(handle));
+  ASSERT_EQ(0, serial_setproperties(handle))
+    << "Message: " << serial_error(handle) << "; "
+    << "Error: " << strerror(errno) << " (" << errno << ")";
+  EXPECT_EQ(0, serial_getlowlatencyapplied(handle, &applied));
+  ASSERT_EQ(0, serial_close(handle));
+  EXPECT_EQ(0, serial_getlowlatencyapplied(handle, &applied));
+  EXPECT_EQ(LOWLATENCY_NONE, applied);
+}
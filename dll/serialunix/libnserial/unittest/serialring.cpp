@@ -0,0 +1,158 @@
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "gtest/gtest.h"
+#include "main.hpp"
+#include "ptydevice.hpp"
+#include "nserial.h"
+
+// The smallest ring that is allocated, so wrapping is easy to test.
+#define RINGSIZE 64
+
+class SerialRingTest : public ::testing::Test
+{
+protected:
+  SerialRingTest();
+  virtual ~SerialRingTest();
+
+  virtual void SetUp();
+  virtual void TearDown();
+
+  void Open();
+
+protected:
+  PtyDevice            pty;
+  struct serialhandle *handle;
+};
+
+SerialRingTest::SerialRingTest() : ::testing::Test()
+{
+}
+
+SerialRingTest::~SerialRingTest()
+{
+}
+
+void SerialRingTest::SetUp()
+{
+  ASSERT_TRUE(pty.IsOpen());
+  handle = serial_init();
+  ASSERT_TRUE(handle != NULL)
+    << "Error initialising: " << strerror(errno) << " (" << errno << ")";
+  ASSERT_EQ(0, serial_setdevicename(handle, pty.GetDevice()));
+}
+
+void SerialRingTest::TearDown()
+{
+  serial_terminate(handle);
+}
+
+void SerialRingTest::Open()
+{
+  ASSERT_EQ(0, serial_open(handle))
+    << "Message: " << serial_error(handle) << "; "
+    << "Error opening: " << strerror(errno) << " (" << errno << ")";
+  ASSERT_EQ(0, serial_setproperties(handle))
+    << "Message: " << serial_error(handle) << "; "
+    << "Error setting properties: " << strerror(errno) << " (" << errno << ")";
+}
+
+TEST_F(SerialRingTest, NotAllocated)
+{
+  const char *rbuffer;
+  char *wbuffer;
+
+  Open();
+  EXPECT_EQ(-1, serial_ring_service(handle, 0));
+  EXPECT_EQ(EINVAL, errno);
+  EXPECT_EQ(-1, serial_ring_readpeek(handle, &rbuffer));
+  EXPECT_EQ(EINVAL, errno);
+  EXPECT_EQ(-1, serial_ring_writereserve(handle, &wbuffer));
+  EXPECT_EQ(EINVAL, errno);
+}
+
+TEST_F(SerialRingTest, InitWhenOpen)
+{
+  Open();
+  EXPECT_EQ(-1, serial_ring_init(handle, RINGSIZE, RINGSIZE));
+  EXPECT_EQ(EIO, errno);
+}
+
+TEST_F(SerialRingTest, ReceiveWraps)
+{
+  const char *buffer;
+  char data[RINGSIZE];
+
+  ASSERT_EQ(0, serial_ring_init(handle, RINGSIZE, 0));
+  Open();
+  EXPECT_EQ(NOEVENT, serial_ring_service(handle, 10));
+
+  for (int i = 0; i < RINGSIZE; i++) data[i] = (char)i;
+  ASSERT_EQ(48, pty.Write(data, 48));
+  EXPECT_EQ(READEVENT, serial_ring_service(handle, 1000));
+  ASSERT_EQ(48, serial_ring_readpeek(handle, &buffer));
+  EXPECT_EQ(0, memcmp(data, buffer, 48));
+  ASSERT_EQ(0, serial_ring_readcommit(handle, 48));
+  EXPECT_EQ(0, serial_ring_readpeek(handle, &buffer));
+
+  // The next data wraps at the end of the ring, so it is returned in two
+  // parts.
+  ASSERT_EQ(32, pty.Write(data, 32));
+  EXPECT_EQ(READEVENT, serial_ring_service(handle, 1000));
+  ASSERT_EQ(16, serial_ring_readpeek(handle, &buffer));
+  EXPECT_EQ(0, memcmp(data, buffer, 16));
+  ASSERT_EQ(0, serial_ring_readcommit(handle, 16));
+  ASSERT_EQ(16, serial_ring_readpeek(handle, &buffer));
+  EXPECT_EQ(0, memcmp(data + 16, buffer, 16));
+  EXPECT_EQ(-1, serial_ring_readcommit(handle, 17));
+  EXPECT_EQ(EINVAL, errno);
+  ASSERT_EQ(0, serial_ring_readcommit(handle, 16));
+}
+
+TEST_F(SerialRingTest, ReceiveFull)
+{
+  const char *buffer;
+  char data[RINGSIZE + 16];
+
+  ASSERT_EQ(0, serial_ring_init(handle, RINGSIZE, 0));
+  Open();
+
+  memset(data, 'x', sizeof(data));
+  ASSERT_EQ(sizeof(data), pty.Write(data, sizeof(data)));
+  usleep(10000);
+  EXPECT_EQ(READEVENT, serial_ring_service(handle, 1000));
+  ASSERT_EQ(RINGSIZE, serial_ring_readpeek(handle, &buffer));
+
+  // The ring is full, so the service only waits for the timeout, until space
+  // is freed, which also aborts the wait.
+  EXPECT_EQ(NOEVENT, serial_ring_service(handle, 10));
+  ASSERT_EQ(0, serial_ring_readcommit(handle, RINGSIZE));
+  EXPECT_EQ(READEVENT, serial_ring_service(handle, 1000));
+  EXPECT_EQ(16, serial_ring_readpeek(handle, &buffer));
+}
+
+TEST_F(SerialRingTest, Transmit)
+{
+  char *buffer;
+  char data[RINGSIZE];
+
+  ASSERT_EQ(0, serial_ring_init(handle, 0, RINGSIZE));
+  Open();
+
+  ASSERT_EQ(RINGSIZE, serial_ring_writereserve(handle, &buffer));
+  memcpy(buffer, "hello", 5);
+  EXPECT_EQ(-1, serial_ring_writecommit(handle, RINGSIZE + 1));
+  EXPECT_EQ(EINVAL, errno);
+  ASSERT_EQ(0, serial_ring_writecommit(handle, 5));
+  EXPECT_EQ(RINGSIZE - 5, serial_ring_writereserve(handle, &buffer));
+
+  EXPECT_EQ(WRITEEVENT, serial_ring_service(handle, 1000));
+  ASSERT_EQ(5, pty.Read(data, sizeof(data), 1000));
+  EXPECT_EQ(0, memcmp("hello", data, 5));
+
+  // The ring is empty, so the service doesn't wait for WRITEEVENT.
+  EXPECT_EQ(NOEVENT, serial_ring_service(handle, 10));
+  EXPECT_EQ(RINGSIZE - 5, serial_ring_writereserve(handle, &buffer));
+}
@@ -0,0 +1,107 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : wakeup.c
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : A file descriptor that can be polled, used to wake up a
+// thread waiting in poll() or epoll.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+#include "serialhandle.h"
+#include "errmsg.h"
+#include "log.h"
+#include "wakeup.h"
+
+void wakeupinit(struct wakeupfd *wakeup)
+{
+  wakeup->rfd = -1;
+  wakeup->wfd = -1;
+}
+
+int wakeupopen(struct serialhandle *handle, struct wakeupfd *wakeup)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+  int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (efd == -1) {
+    nslog(handle, NSLOG_ERR, "wakeup: error opening eventfd: errno=%d", errno);
+    serial_seterror(handle, ERRMSG_CANTOPENANONPIPE);
+    return -1;
+  }
+  wakeup->rfd = efd;
+  wakeup->wfd = efd;
+#else
+  int pipefd[2];
+  if (pipe(pipefd) == -1) {
+    nslog(handle, NSLOG_ERR, "wakeup: error opening pipes: errno=%d", errno);
+    serial_seterror(handle, ERRMSG_CANTOPENANONPIPE);
+    return -1;
+  }
+
+  wakeup->rfd = pipefd[0];
+  wakeup->wfd = pipefd[1];
+  if (fcntl(wakeup->rfd, F_SETFL, O_NONBLOCK) == -1 ||
+      fcntl(wakeup->wfd, F_SETFL, O_NONBLOCK) == -1 ||
+      fcntl(wakeup->rfd, F_SETFD, FD_CLOEXEC) == -1 ||
+      fcntl(wakeup->wfd, F_SETFD, FD_CLOEXEC) == -1) {
+    int lerrno = errno;
+    nslog(handle, NSLOG_ERR, "wakeup: couldn't set nonblock: errno=%d", errno);
+    serial_seterror(handle, ERRMSG_CANTCONFIGUREANONPIPE);
+    wakeupclose(wakeup);
+    errno = lerrno;
+    return -1;
+  }
+#endif
+  return 0;
+}
+
+void wakeupclose(struct wakeupfd *wakeup)
+{
+  if (wakeup->wfd != -1 && wakeup->wfd != wakeup->rfd) {
+    close(wakeup->wfd);
+  }
+  if (wakeup->rfd != -1) {
+    close(wakeup->rfd);
+  }
+  wakeup->rfd = -1;
+  wakeup->wfd = -1;
+}
+
+int wakeupsignal(struct wakeupfd *wakeup)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+  int result = eventfd_write(wakeup->wfd, 1);
+#else
+  char signal = 'X';
+  int result = write(wakeup->wfd, &signal, 1) == -1 ? -1 : 0;
+#endif
+  // If the pipe is full, it's readable, which is all we need.
+  if (result == -1 && errno != EAGAIN) return -1;
+  return 0;
+}
+
+void wakeupclear(struct wakeupfd *wakeup)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+  eventfd_t value;
+  eventfd_read(wakeup->rfd, &value);
+#else
+  char buffer[128];
+  while (read(wakeup->rfd, buffer, SIZEOF_ARRAY(buffer)) > 0) { }
+#endif
+  errno = 0;
+}
@@ -0,0 +1,43 @@
+////////////////////////////////////////////////////////////////////////////////
+// PROJECT : libnserial
+//  (C) Jason Curl, 2016-2017.
+//
+// FILE : wakeup.h
+//
+// Published under the MIT license.
+//
+// AUTHOR : Jason Curl
+//
+// DESCRIPTION : A file descriptor that can be polled, used to wake up a
+// thread waiting in poll() or epoll.
+//
+////////////////////////////////////////////////////////////////////////////////
+#ifndef NSERIAL_WAKEUP_H
+#define NSERIAL_WAKEUP_H
+
+#include "nserial.h"
+
+// Uses an eventfd if available, then rfd and wfd are the same. Else the two
+// ends of a nonblocking anonymous pipe.
+struct wakeupfd {
+  int rfd;                              // Poll for POLLIN on this fd
+  int wfd;                              // Written to wake up
+};
+
+// Initialises the file descriptors as not open.
+void wakeupinit(struct wakeupfd *wakeup);
+
+// Opens the file descriptors. On error, sets the error for handle.
+int wakeupopen(struct serialhandle *handle, struct wakeupfd *wakeup);
+
+// Closes the file descriptors, if open.
+void wakeupclose(struct wakeupfd *wakeup);
+
+// Makes rfd readable. The caller should ensure, that there is only one signal
+// outstanding, else a pipe might fill up.
+int wakeupsignal(struct wakeupfd *wakeup);
+
+// Empties rfd, so that it is no longer readable.
+void wakeupclear(struct wakeupfd *wakeup);
+
+#endif